@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "controlUnit.h"
+#include "allocCounter.h"
+#include "forkRunner.h"
+#include "lockstepRunner.h"
+
+/* Micro-benchmark of the interpreter.
+ * Every workload runs with every engine configuration: one warmup run, then
+ * the given number of measured repetitions. Only ControlUnit::run (or the
+ * cycle() loop) is timed, loading and construction are not.
+ * The last workload runs Fb.txt for many inputs on one thread, forked from the first READ
+ * or in lanes by the LockstepRunner; its rate counts the instructions of every input.
+ *
+ * Usage: benchmark [repetitions] [scale]
+ *     repetitions - measured runs per configuration (default 7)
+ *     scale       - multiplies the input of every workload (default 1)
+ */
+
+/// Workload struct
+struct Workload{
+    const char *name;       /// Name in the report
+    const char *program;    /// Program file in the input directory
+    long long input;        /// Value given to the READ instruction at scale 1
+};
+
+/// Config struct
+struct Config{
+    const char *name;       /// Name in the report
+    Engine engine;          /// Engine of the ControlUnit
+    bool fusion;            /// Superinstruction fusion of the threaded engine
+    bool loops;             /// Loop acceleration of the threaded engine
+    bool cycleLoop;         /// Drive the machine with cycle() instead of run()
+};
+
+/// Measurement struct
+struct Measurement{
+    unsigned long long steps;       /// Executed instructions of one run
+    unsigned long long allocations; /// Allocations during one run
+    double seconds;                 /// Time of one run
+    std::string output;             /// Output of the program
+};
+
+/// Runs the program once on a fresh ControlUnit.
+static Measurement measure(std::shared_ptr<const ProgramImage> image, const Config &config, long long input)
+{
+    std::istringstream is(std::to_string(input));
+    std::ostringstream os;
+    ControlUnit CU(image, os, is, config.engine);
+    CU.setFusion(config.fusion);
+    CU.setLoopAcceleration(config.loops);
+    Measurement m{0, 0, 0.0, ""};
+    unsigned long long allocations = allocationCount();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (config.cycleLoop)
+    {
+        try
+        {
+            while (true)
+            {
+                CU.cycle();
+                m.steps++;
+            }
+        }
+        catch (const char *)
+        {
+            m.steps++;  // The EXIT instruction
+        }
+    }
+    else
+        m.steps = CU.run().steps;
+    m.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m.allocations = allocationCount() - allocations;
+    m.output = os.str();
+    return m;
+}
+
+/// Runs the program for every input, with the ForkRunner or the LockstepRunner on one thread.
+static Measurement measureSweep(std::shared_ptr<const ProgramImage> image, bool lockstep, const std::vector<std::string> &inputs)
+{
+    Measurement m{0, 0, 0.0, ""};
+    unsigned long long allocations = allocationCount();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<ForkResult> results = lockstep ? LockstepRunner(image, 1).run(inputs) : ForkRunner(image, 1).run(inputs);
+    m.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m.allocations = allocationCount() - allocations;
+    for (const ForkResult &result : results)
+    {
+        m.steps += result.steps;
+        m.output += result.output;
+    }
+    return m;
+}
+
+/// Writes a row of the table from the nanoseconds per instruction of the measured runs.
+static void report(const char *workload, const char *config, unsigned long long steps, std::vector<double> ns,
+                   unsigned long long allocations)
+{
+    std::sort(ns.begin(), ns.end());
+    double median = ns.size() % 2 ? ns[ns.size() / 2] : (ns[ns.size() / 2 - 1] + ns[ns.size() / 2]) / 2;
+    double mean = 0, variance = 0;
+    for (double v : ns)
+        mean += v / ns.size();
+    for (double v : ns)
+        variance += (v - mean) * (v - mean) / ns.size();
+    std::cout << std::left << std::setw(11) << workload << std::setw(17) << config
+              << std::right << std::setw(12) << steps
+              << std::setw(14) << std::fixed << std::setprecision(1) << 1e3 / median
+              << std::setw(12) << std::setprecision(3) << median
+              << std::setw(10) << std::setprecision(1) << 100 * std::sqrt(variance) / mean
+              << std::setw(12) << allocations << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int repetitions = argc > 1 ? std::max(1, std::atoi(argv[1])) : 7;
+    long long scale = argc > 2 ? std::max(1LL, std::atoll(argv[2])) : 1;
+
+    const Workload workloads[] = {
+        {"fibonacci", "Fb.txt", 1000000},
+        {"countdown", "Countdown.txt", 3000000},
+        {"sweep", "Sweep.txt", 50000},
+        {"branchy", "Branchy.txt", 1000000}};
+    const Config configs[] = {
+        {"switch/cycle", ENGINE_SWITCH, false, false, true},
+        {"switch", ENGINE_SWITCH, false, false, false},
+        {"threaded", ENGINE_THREADED, false, false, false},
+        {"threaded+fusion", ENGINE_THREADED, true, false, false},
+        {"threaded+loops", ENGINE_THREADED, true, true, false}};
+
+    std::cout << std::left << std::setw(11) << "workload" << std::setw(17) << "engine"
+              << std::right << std::setw(12) << "instr/run" << std::setw(14) << "Minstr/s"
+              << std::setw(12) << "ns/instr" << std::setw(10) << "stddev%" << std::setw(12) << "allocs/run" << std::endl;
+    for (const Workload &workload : workloads)
+    {
+        std::shared_ptr<const ProgramImage> image;
+        try
+        {
+            image = ProgramImage::load(workload.program);
+        }
+        catch (const char *e)
+        {
+            std::cerr << workload.program << ": " << e;
+            return 2;
+        }
+        std::string expected;
+        for (const Config &config : configs)
+        {
+            long long input = workload.input * scale;
+            Measurement warmup = measure(image, config, input);
+            if (expected.empty())
+                expected = warmup.output;
+            else if (warmup.output != expected)
+                std::cerr << workload.name << ": " << config.name << " printed a different result" << std::endl;
+
+            std::vector<double> ns;
+            unsigned long long allocations = 0;
+            for (int r = 0; r < repetitions; r++)
+            {
+                Measurement m = measure(image, config, input);
+                ns.push_back(m.seconds * 1e9 / m.steps);
+                allocations = std::max(allocations, m.allocations);
+            }
+            report(workload.name, config.name, warmup.steps, ns, allocations);
+        }
+    }
+
+    // Inputs with different trip counts, so the lanes of a group diverge and reconverge
+    std::shared_ptr<const ProgramImage> image = ProgramImage::load("Fb.txt");
+    std::vector<std::string> inputs;
+    for (long long n = 0; n < 4096 * scale; n++)
+        inputs.push_back(std::to_string(n % 1000));
+    std::string expected;
+    for (bool lockstep : {false, true})
+    {
+        Measurement warmup = measureSweep(image, lockstep, inputs);
+        if (expected.empty())
+            expected = warmup.output;
+        else if (warmup.output != expected)
+            std::cerr << "lanes: lockstep printed a different result" << std::endl;
+        std::vector<double> ns;
+        unsigned long long allocations = 0;
+        for (int r = 0; r < repetitions; r++)
+        {
+            Measurement m = measureSweep(image, lockstep, inputs);
+            ns.push_back(m.seconds * 1e9 / m.steps);
+            allocations = std::max(allocations, m.allocations);
+        }
+        report("lanes", lockstep ? "lockstep" : "fork", warmup.steps, ns, allocations);
+    }
+    return 0;
+}
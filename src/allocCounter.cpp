@@ -0,0 +1,93 @@
+#include "allocCounter.h"
+#ifdef ALLOCCOUNTER
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<unsigned long long> allocations(0);   /// Number of allocations
+
+bool allocationCounting()
+{
+    return true;
+}
+
+unsigned long long allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+/// Allocates memory with malloc and counts the allocation.
+/// @return the memory, nullptr if it could not be allocated
+static void *countedAlloc(std::size_t size) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+/// Allocates aligned memory and counts the allocation.
+/// @return the memory, nullptr if it could not be allocated
+static void *countedAlloc(std::size_t size, std::align_val_t alignment) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t align = static_cast<std::size_t>(alignment);
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    std::size_t rounded = (size + align - 1) / align * align;  // aligned_alloc needs a multiple of the alignment
+#ifdef _WIN32
+    return _aligned_malloc(rounded == 0 ? align : rounded, align);
+#else
+    return std::aligned_alloc(align, rounded == 0 ? align : rounded);
+#endif
+}
+
+/// Frees memory from countedAlloc(size, alignment).
+static void alignedFree(void *p) noexcept
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+/// Gives the memory or throws bad_alloc, like the throwing forms of operator new.
+static void *checked(void *p)
+{
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+// Every form is replaced, so no allocation of the library reaches a delete of another allocator
+void *operator new(std::size_t size) { return checked(countedAlloc(size)); }
+void *operator new[](std::size_t size) { return checked(countedAlloc(size)); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+void *operator new(std::size_t size, std::align_val_t a) { return checked(countedAlloc(size, a)); }
+void *operator new[](std::size_t size, std::align_val_t a) { return checked(countedAlloc(size, a)); }
+void *operator new(std::size_t size, std::align_val_t a, const std::nothrow_t &) noexcept { return countedAlloc(size, a); }
+void *operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t &) noexcept { return countedAlloc(size, a); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { alignedFree(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { alignedFree(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { alignedFree(p); }
+#else
+bool allocationCounting()
+{
+    return false;
+}
+
+unsigned long long allocationCount()
+{
+    return 0;
+}
+#endif
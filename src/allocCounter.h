@@ -0,0 +1,18 @@
+#ifndef ALLOCCOUNTER_H_INCLUDED
+#define ALLOCCOUNTER_H_INCLUDED
+
+/* With ALLOCCOUNTER defined, every form of the global operator new and delete is
+ * replaced in allocCounter.cpp and every allocation increments a counter.
+ * Tests and benchmarks use it to check that the hot loop does not allocate,
+ * a build without the flag keeps the operators of the standard library.
+ */
+
+/// Checks if the allocations are counted.
+/// @return true if the program was compiled with ALLOCCOUNTER
+bool allocationCounting();
+
+/// Get the number of allocations.
+/// @return number of calls to the global operator new since the program started, 0 without ALLOCCOUNTER
+unsigned long long allocationCount();
+
+#endif // ALLOCCOUNTER_H_INCLUDED
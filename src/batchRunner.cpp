@@ -0,0 +1,205 @@
+#include "batchRunner.h"
+#include "workPool.h"
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+/// Constructor, 0 threads means one thread per core.
+BatchRunner::BatchRunner(unsigned threads, unsigned long long maxSteps, double timeLimit)
+    : threads(poolThreads(threads)), maxSteps(maxSteps), timeLimit(timeLimit)
+{
+}
+
+/// Converts a manifest field to text: reads the file after @ or replaces the \n escapes.
+static std::string fieldText(const std::string &field)
+{
+    if (!field.empty() && field[0] == '@')
+    {
+        std::ifstream file("input/" + field.substr(1), std::ios::binary);
+        if (!file)
+            throw "Manifest file open failed.\n";
+        std::ostringstream text;
+        text << file.rdbuf();
+        return text.str();
+    }
+    std::string text;
+    for (size_t i = 0; i < field.size(); i++)
+    {
+        if (field[i] == '\\' && i + 1 < field.size() && field[i + 1] == 'n')
+        {
+            text += '\n';
+            i++;
+        }
+        else
+            text += field[i];
+    }
+    return text;
+}
+
+/// Reads the tab separated jobs of the manifest.
+void BatchRunner::readManifest(std::string filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+        throw "Manifest open failed.\n";
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();  // Manifests written on Windows
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::vector<std::string> fields;
+        std::istringstream columns(line);
+        std::string field;
+        while (std::getline(columns, field, '\t'))
+            fields.push_back(field);
+        fields.resize(3);  // Missing input or expected output is empty
+        addJob(BatchJob{fields[0], fieldText(fields[1]), fieldText(fields[2])});
+    }
+}
+
+/// Runs one job on its own ControlUnit, the program image is shared with the other jobs.
+static BatchResult runJob(const BatchJob &job, std::shared_ptr<const ProgramImage> image, unsigned long long maxSteps, double timeLimit)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    BatchResult result{job, STATUS_NO_PROGRAM, 0, "", false, 0.0};
+    if (image != nullptr)
+    {
+        std::istringstream input(job.input);
+        std::ostringstream output;
+        ControlUnit CU(image, output, input, ENGINE_THREADED);
+        CU.setFusion(true);
+        CU.setLoopAcceleration(true);
+        CU.setBuffered(true);
+        CU.setTimeLimit(timeLimit);
+        RunResult run = CU.run(maxSteps);
+        result.status = run.status;
+        result.steps = run.steps;
+        result.output = output.str();
+    }
+    result.passed = result.status == STATUS_HALTED && result.output == job.expected;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+/// The jobs run on the work-stealing pool.
+std::vector<BatchResult> BatchRunner::run()
+{
+    std::vector<BatchResult> results(jobs.size());
+    if (jobs.empty())
+        return results;
+    // Every program is parsed once, the jobs share the read-only images
+    std::map<std::string, std::shared_ptr<const ProgramImage>> images;
+    for (const BatchJob &job : jobs)
+    {
+        if (images.count(job.program))
+            continue;
+        try
+        {
+            images[job.program] = ProgramImage::load(job.program);
+        }
+        catch (const char *)
+        {
+            images[job.program] = nullptr;  // Reported as STATUS_NO_PROGRAM
+        }
+    }
+
+    parallelFor(jobs.size(), threads, [&](size_t job)
+    {
+        results[job] = runJob(jobs[job], images.at(jobs[job].program), maxSteps, timeLimit);
+    });
+    return results;
+}
+
+/// Short name of a status for the report.
+static const char *statusName(Status status)
+{
+    switch (status)
+    {
+    case STATUS_HALTED:
+        return "halted";
+    case STATUS_STEP_LIMIT:
+        return "step_limit";
+    case STATUS_BAD_JUMP:
+        return "bad_jump";
+    case STATUS_BAD_ADDRESS:
+        return "bad_address";
+    case STATUS_VAR_EXECUTED:
+        return "var_executed";
+    case STATUS_NO_PROGRAM:
+        return "no_program";
+    case STATUS_TIMEOUT:
+        return "timeout";
+    case STATUS_OVERFLOW:
+        return "overflow";
+    default:
+        return "running";
+    }
+}
+
+/// Writes a string as a JSON string literal.
+static void writeJsonString(std::ostream &os, const std::string &text)
+{
+    os << '"';
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"':
+            os << "\\\"";
+            break;
+        case '\\':
+            os << "\\\\";
+            break;
+        case '\n':
+            os << "\\n";
+            break;
+        case '\r':
+            os << "\\r";
+            break;
+        case '\t':
+            os << "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                const char *digits = "0123456789abcdef";
+                os << "\\u00" << digits[(c >> 4) & 0xf] << digits[c & 0xf];
+            }
+            else
+                os << c;
+        }
+    }
+    os << '"';
+}
+
+/// Writes the summary and one object per job.
+void BatchRunner::writeReport(std::ostream &os, const std::vector<BatchResult> &results, double seconds)
+{
+    size_t passed = 0;
+    for (const BatchResult &result : results)
+        if (result.passed)
+            passed++;
+    os << "{\n  \"jobs\": " << results.size()
+       << ",\n  \"passed\": " << passed
+       << ",\n  \"failed\": " << results.size() - passed
+       << ",\n  \"threads\": " << threads
+       << ",\n  \"seconds\": " << seconds
+       << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BatchResult &result = results[i];
+        os << (i == 0 ? "\n" : ",\n") << "    {\"program\": ";
+        writeJsonString(os, result.job.program);
+        os << ", \"status\": \"" << statusName(result.status) << "\""
+           << ", \"steps\": " << result.steps
+           << ", \"passed\": " << (result.passed ? "true" : "false")
+           << ", \"seconds\": " << result.seconds
+           << ", \"output\": ";
+        writeJsonString(os, result.output);
+        os << "}";
+    }
+    os << "\n  ]\n}\n";
+}
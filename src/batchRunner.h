@@ -0,0 +1,76 @@
+#ifndef BATCHRUNNER_H_INCLUDED
+#define BATCHRUNNER_H_INCLUDED
+
+#include "controlUnit.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// BatchJob struct
+/* One program run of a batch: the program, the text given to READ and the expected output. */
+struct BatchJob{
+    std::string program;    /// Program file in the input directory
+    std::string input;      /// Text read by the READ instructions
+    std::string expected;   /// Expected text written by the PRINT instructions
+};
+
+/// BatchResult struct
+struct BatchResult{
+    BatchJob job;                   /// The job that was run
+    Status status;                  /// Why the program stopped
+    unsigned long long steps;       /// Number of executed instructions
+    std::string output;             /// Text written by the program
+    bool passed;                    /// The program halted and its output is the expected one
+    double seconds;                 /// Run time of the job
+};
+
+/// BatchRunner class
+/* Runs many jobs on a work-stealing thread pool. Every job gets its own ControlUnit
+ * and its own string streams, only the read-only program images are shared.
+ *
+ * Manifest format, one job per line, fields separated by tabs:
+ *     program<TAB>input<TAB>expected
+ * A field starting with @ names a file in the input directory, any other field is the text itself,
+ * where \n stands for a new line. Empty lines and lines starting with # are skipped.
+ */
+class BatchRunner{
+    std::vector<BatchJob> jobs;     /// Jobs to run
+    unsigned threads;               /// Number of worker threads
+    unsigned long long maxSteps;    /// Step budget of a single job
+    double timeLimit;               /// Wall-clock limit of a single job in seconds, 0 for none
+public:
+    /// Constructor.
+    /// @param threads - number of worker threads, 0 uses every core
+    /// @param maxSteps - step budget of a single job
+    /// @param timeLimit - wall-clock limit of a single job in seconds, 0 for none
+    BatchRunner(unsigned threads=0, unsigned long long maxSteps=100000000ULL, double timeLimit=0);
+
+    /// Adds a job to the batch.
+    /// @param job - the job to add
+    void addJob(const BatchJob& job){ jobs.push_back(job); }
+
+    /// Reads the jobs of a manifest file.
+    /// Throws an exception if the manifest or a file it names can't be opened.
+    /// @param filename - path of the manifest
+    void readManifest(std::string filename);
+
+    /// Get the number of jobs.
+    /// @return the number of jobs in the batch
+    size_t size(){ return jobs.size(); }
+
+    /// Get the number of worker threads.
+    /// @return the number of threads run() uses
+    unsigned getThreads(){ return threads; }
+
+    /// Runs every job in parallel.
+    /// @return the results in the order of the jobs
+    std::vector<BatchResult> run();
+
+    /// Writes the results as a JSON report.
+    /// @param os - the stream to write to
+    /// @param results - results returned by run()
+    /// @param seconds - wall-clock time of the whole batch
+    void writeReport(std::ostream& os, const std::vector<BatchResult>& results, double seconds);
+};
+
+#endif // BATCHRUNNER_H_INCLUDED
@@ -1,32 +1,89 @@
 #include "controlUnit.h"
+#include "profiler.h"
+#include "trace.h"
+#include "timeTravel.h"
+#include "programAnalysis.h"
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <type_traits>
+
+void IOUnit::flush()
+{
+    if (used == 0)
+        return;
+    os.write(buffer, used);
+    os.flush();
+    used = 0;
+}
 
 /// Prints the result or the value based on the output stream.
-void IOUnit::print(int var)
+void IOUnit::print(long long var)
 {
-    if(&os == &std::cout){
-        os << "Result: " << var << std::endl;
+    printed++;
+    if (printed <= quiet)
+        return;  // Written before the snapshot was restored
+    if (!buffered)
+    {
+        if (console)
+            os << "Result: " << var << std::endl;
+        else
+            os << var << std::endl;
+        return;
+    }
+    if (used + 32 > OUTPUT_BUFFER_SIZE)  // No room for the longest line: the buffer is full
+    {
+        os.write(buffer, used);
+        used = 0;
     }
-    else{
-        os << var << std::endl;
+    if (console)
+    {
+        std::memcpy(buffer + used, "Result: ", 8);
+        used += 8;
     }
+    // Writes the digits backwards into a temporary, the magnitude is unsigned to handle LLONG_MIN
+    char digits[21];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    unsigned long long magnitude = var < 0 ? 0ull - (unsigned long long)var : (unsigned long long)var;
+    do
+    {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (var < 0)
+        *--p = '-';
+    std::memcpy(buffer + used, p, end - p);
+    used += end - p;
+    buffer[used++] = '\n';
 }
 
 /// Reads an integer from the input, handles invalid input, and returns the integer.
 int IOUnit::read()
 {
     int val = 0;
-    std::string wrongI;
-    if (&is == &std::cin)
+    if (reader != nullptr)
+    {
+        std::string wrongI;
+        if (!reader->next(val, wrongI))
+            std::cerr << "[" + wrongI + "]" + " is a wrong input\n";  // Same message as for a stream
+        return val;
+    }
+    if (interactive)
+    {
+        flush();  // The user sees every result before the prompt
         os << "input: ";  // Prompt user for input if from std::cin
+    }
     
-    is >> val;
+    *is >> val;
 
-    if (is.fail())  // Check for failed input (invalid data)
+    if (is->fail())  // Check for failed input (invalid data)
     {
-        is.clear();  // Clear the input stream's error state
-        is >> wrongI;  // Read the invalid input as a string
+        is->clear();  // Clear the input stream's error state
+        std::string wrongI;
+        *is >> wrongI;  // Read the invalid input as a string
         std::cerr << "[" + wrongI + "]" + " is a wrong input\n";  // Print error message
         return val;  // Return current (possibly invalid) value
     }
@@ -34,40 +91,812 @@ int IOUnit::read()
     return val;  // Return valid input
 }
 
+long long IOUnit::inputPosition()
+{
+    if (reader != nullptr)
+        return reader->tell();
+    std::streampos position = is->rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in);  // Keeps the state flags
+    return position == std::streampos(-1) ? -1 : (long long)position;
+}
+
+bool IOUnit::seekInput(long long position)
+{
+    if (reader != nullptr)
+        return reader->seek(position);
+    if (is->rdbuf()->pubseekpos(position, std::ios::in) == std::streampos(-1))
+        return false;
+    is->clear();  // The end of the input may be ahead again
+    return true;
+}
+
+const char *statusMessage(Status status)
+{
+    switch (status)
+    {
+    case STATUS_HALTED:
+        return "Code exited\n";
+    case STATUS_STEP_LIMIT:
+        return "Step limit reached\n";
+    case STATUS_BAD_JUMP:
+        return "Can't jump here\n";
+    case STATUS_BAD_ADDRESS:
+        return "Invalid memory address\n";
+    case STATUS_VAR_EXECUTED:
+        return "Tried to execute a variable!\n";
+    case STATUS_NO_PROGRAM:
+        return "File open failed.\n";
+    case STATUS_TIMEOUT:
+        return "Time limit reached\n";
+    case STATUS_OVERFLOW:
+        return "Arithmetic overflow\n";
+    default:
+        return "Running\n";
+    }
+}
+
 /// Executes a single cycle, fetching and executing the next instruction.
 void ControlUnit::cycle()
 {
-    IR = fetch(PC);  // Fetch instruction at the current PC
-    PC++;  // Increment program counter
-    if (IR != nullptr)
-        IR->executeby(*this);  // Execute the fetched instruction
+    RunResult result = run(1);
+    if (result.status != STATUS_STEP_LIMIT)
+        throw statusMessage(result.status);  // EXIT or error
 }
 
-/// Fetches an instruction from memory based on the current PC.
-Instruction *ControlUnit::fetch(int address)
+/// Runs the program with the engine chosen at construction.
+RunResult ControlUnit::run(unsigned long long maxSteps)
 {
-    setMAR(address);  // Set the memory address register
-    readEnable();     // Enable reading from memory
-    return getMDR();  // Return the instruction stored in the MDR
+    NoProbe probe;
+    return runWith(probe, maxSteps);
+}
+
+/// Runs the program and counts every executed instruction in the profiler.
+RunResult ControlUnit::run(Profiler &profiler, unsigned long long maxSteps)
+{
+    if (!profiler.isAttached(getImage()))
+        profiler.attach(getImage(), getStorage());  // Another program, the old counters don't apply
+    RunResult result = runWith(profiler, maxSteps);
+    if (result.status == STATUS_HALTED)
+        profiler.halted();
+    return result;
+}
+
+RunResult ControlUnit::runUntilRead(unsigned long long maxSteps)
+{
+    RunResult result{STATUS_STEP_LIMIT, 0};
+    while (result.steps < maxSteps)
+    {
+        if (!NotValidMemory() && validAddress(PC) && cellAt(PC).op == OP_READ)
+            break;
+        RunResult part = run(1);
+        result.steps += part.steps;
+        result.status = part.status;
+        if (part.status != STATUS_STEP_LIMIT)
+            break;
+    }
+    return result;
 }
 
-/// Converts a hexadecimal string (e.g., "0x0010") to an integer, ignoring leading zeros.
-int MemoryUnit::HextoInt(std::string hex)
+/// Tells if a probe can watch 64-bit words, the trace and the write log store 32-bit values.
+template <class Probe>
+struct WideProbe : std::false_type
+{
+};
+template <>
+struct WideProbe<NoProbe> : std::true_type
+{
+};
+template <>
+struct WideProbe<Profiler> : std::true_type
+{
+};
+
+/// Selects the engine, the probe is a compile-time policy of both engines.
+template <class Probe>
+RunResult ControlUnit::runWith(Probe &probe, unsigned long long maxSteps)
 {
-    size_t i = 2;  // Skip "0x" prefix
-    while (i < hex.length() && hex[i] == '0')  // Skip leading zeros
-        i++;
-    int result = 0;
-    while (i < hex.length())  // Convert the remaining characters to an integer
+    if (NotValidMemory())
+        return RunResult{STATUS_NO_PROGRAM, 0};
+    if (hasWideWords() && !WideProbe<Probe>::value)
+        throw "The probe needs 32-bit words\n";
+    if (timeLimit <= 0)
+    {
+        RunResult result = runEngine(maxSteps, probe);
+        flush();  // The buffered output is written when the run stops
+        return result;
+    }
+
+    // Watchdog: runs slices of the step budget and checks the clock between them
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeLimit));
+    RunResult result{STATUS_STEP_LIMIT, 0};
+    while (true)
     {
-        result = result * 10 + (hex[i] - '0');  // Convert each character to a numeric value
-        i++;
+        unsigned long long slice = std::min(maxSteps - result.steps, WATCHDOG_SLICE);
+        RunResult part = runEngine(slice, probe);
+        result.steps += part.steps;
+        result.status = part.status;
+        if (part.status != STATUS_STEP_LIMIT || result.steps == maxSteps)
+            break;
+        if (std::chrono::steady_clock::now() >= deadline)
+        {
+            result.status = STATUS_TIMEOUT;
+            break;
+        }
     }
-    return result;  // Return the integer value
+    flush();
+    return result;
+}
+
+/// The 64-bit engines are only compiled for the probes that can watch them.
+template <class Probe>
+RunResult ControlUnit::runEngine(unsigned long long maxSteps, Probe &probe)
+{
+    if constexpr (WideProbe<Probe>::value)
+        if (hasWideWords())
+            return runWords<Probe, Word64>(maxSteps, probe);
+    return runWords<Probe, Word32>(maxSteps, probe);
 }
 
-/// Constructor for MemoryUnit, reads file content into memory.
-MemoryUnit::MemoryUnit(std::string filename)
+/// Every engine, arithmetic and word triple is a separate instance of the engine templates.
+template <class Probe, class Word>
+RunResult ControlUnit::runWords(unsigned long long maxSteps, Probe &probe)
+{
+    bool threaded = engine == ENGINE_THREADED;
+    switch (arithmetic)
+    {
+    case ARITH_CHECKED:
+        return threaded ? runThreaded<Probe, CheckedArithmetic, Word>(maxSteps, probe)
+                        : runSwitch<Probe, CheckedArithmetic, Word>(maxSteps, probe);
+    case ARITH_SATURATE:
+        return threaded ? runThreaded<Probe, SaturatingArithmetic, Word>(maxSteps, probe)
+                        : runSwitch<Probe, SaturatingArithmetic, Word>(maxSteps, probe);
+    default:
+        return threaded ? runThreaded<Probe, WrapArithmetic, Word>(maxSteps, probe)
+                        : runSwitch<Probe, WrapArithmetic, Word>(maxSteps, probe);
+    }
+}
+
+/// Fetch/decode/execute loop working directly on the memory cells.
+template <class Probe, class Arith, class Word>
+RunResult ControlUnit::runSwitch(unsigned long long maxSteps, Probe &probe)
+{
+    RunResult result{STATUS_STEP_LIMIT, 0};
+    while (result.steps < maxSteps)
+    {
+        if (!validAddress(PC))
+        {
+            result.status = STATUS_BAD_ADDRESS;  // The program ran out of the memory
+            return result;
+        }
+        int address = PC;
+        setMAR(PC);       // Fetch the cell at the current PC
+        readEnable();
+        IR = getMDR();
+        PC++;             // Increment program counter
+        Status status = step<Probe, Arith, Word>(IR, address, probe);  // Decode and execute the fetched cell
+        if (status != STATUS_RUNNING)
+        {
+            if (status == STATUS_HALTED)
+                result.steps++;
+            else
+                probe.failed(address, IR.op);  // The failing instruction is not a step
+            result.status = status;
+            return result;
+        }
+        result.steps++;
+    }
+    return result;
+}
+
+/// Executes a cell and throws the message of the status if it stops the program.
+void ControlUnit::execute(Cell instr)
+{
+    Status status = hasWideWords() ? stepWords<Word64>(instr) : stepWords<Word32>(instr);
+    if (status != STATUS_RUNNING)
+        throw statusMessage(status);
+}
+
+/// Selects the instance of step() for the arithmetic.
+template <class Word>
+Status ControlUnit::stepWords(Cell instr)
+{
+    NoProbe probe;
+    switch (arithmetic)
+    {
+    case ARITH_CHECKED:
+        return step<NoProbe, CheckedArithmetic, Word>(instr, PC, probe);
+    case ARITH_SATURATE:
+        return step<NoProbe, SaturatingArithmetic, Word>(instr, PC, probe);
+    default:
+        return step<NoProbe, WrapArithmetic, Word>(instr, PC, probe);
+    }
+}
+
+/// Decodes the opcode of the cell and executes it.
+template <class Probe, class Arith, class Word>
+Status ControlUnit::step(Cell instr, int address, Probe &probe)
+{
+    probe.executed(address, instr.op);
+    switch (instr.op)
+    {
+    case OP_LOAD:
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_ADDRESS;
+        probe.memoryRead(instr.operand);
+        Word::setAcc(*this, Word::read(*this, instr.operand));
+        probe.accumulator(Word::acc(*this));
+        break;
+    case OP_STORE:
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_ADDRESS;
+        probe.memoryWrite(instr.operand, Word::acc(*this));
+        Word::write(*this, instr.operand, Word::acc(*this));
+        break;
+    case OP_ADD:
+    {
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_ADDRESS;
+        probe.memoryRead(instr.operand);
+        typename Word::type acc = Word::acc(*this);
+        if (!Arith::add(acc, Word::read(*this, instr.operand)))
+            return STATUS_OVERFLOW;
+        Word::setAcc(*this, acc);
+        probe.accumulator(acc);
+        break;
+    }
+    case OP_SUB:
+    {
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_ADDRESS;
+        probe.memoryRead(instr.operand);
+        typename Word::type acc = Word::acc(*this);
+        if (!Arith::sub(acc, Word::read(*this, instr.operand)))
+            return STATUS_OVERFLOW;
+        Word::setAcc(*this, acc);
+        probe.accumulator(acc);
+        break;
+    }
+    case OP_READ:
+    {
+        int val = read();  // Read first, then store the value as a variable
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_ADDRESS;
+        probe.memoryWrite(instr.operand, val);
+        Word::write(*this, instr.operand, val);
+        break;
+    }
+    case OP_PRINT:
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_ADDRESS;
+        probe.memoryRead(instr.operand);
+        print(Word::read(*this, instr.operand));
+        break;
+    case OP_JUMP:
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_JUMP;  // Invalid jump address
+        probe.branch(address, instr.operand, true);
+        PC = instr.operand;
+        break;
+    case OP_BRANCHGT:
+        if (!validAddress(instr.operand))
+            return STATUS_BAD_JUMP;  // Invalid jump address
+        probe.branch(address, instr.operand, Word::acc(*this) > 0);
+        if (Word::acc(*this) > 0)  // Only jumps if the accumulator's value is greater than 0
+            PC = instr.operand;
+        break;
+    case OP_VAR:
+        return STATUS_VAR_EXECUTED;
+    case OP_EXIT:
+        return STATUS_HALTED;
+    default:
+        break;  // Empty cells are skipped
+    }
+    return STATUS_RUNNING;
+}
+
+/// Decodes the memory into the threaded code, the handlers are filled in by runThreaded.
+void ControlUnit::decode()
+{
+    size_t storage = getStorage();
+    code.resize(storage + 1);
+    for (size_t i = 0; i < storage; i++)
+    {
+        Cell cell = cellAt(static_cast<int>(i));
+        Opcode op = cell.op < OP_COUNT ? cell.op : OP_EMPTY;  // A damaged binary image can hold anything
+        bool addressed = op != OP_EMPTY && op != OP_VAR && op != OP_EXIT;
+        code[i] = ThreadedOp{nullptr, cell.operand, op, SUPER_NONE, addressed && !validAddress(cell.operand), false};
+    }
+    code[storage] = ThreadedOp{nullptr, 0, OP_COUNT, SUPER_NONE, false, false};  // Sentinel after the memory
+    if (fusion || loopAcceleration)
+    {
+        ProgramAnalysis analysis(*this);  // Tells where the code can be optimized
+        if (fusion)
+            fuse(analysis);
+        if (loopAcceleration)
+            findLoops(analysis);
+    }
+    codeWrites = getWrites();
+}
+
+/// Number of instructions covered by a superinstruction.
+static int superLength(Superinstruction super)
+{
+    switch (super)
+    {
+    case SUPER_LOAD_STORE:
+        return 2;
+    case SUPER_LOAD_ADD_STORE:
+    case SUPER_LOAD_SUB_STORE:
+        return 3;
+    case SUPER_DEC_BRANCH:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+/// Marks the first cell of common sequences as superinstructions.
+/* A sequence is only fused if it is a straight line: its cells are in one basic block
+ * of the analysis, so no jump lands inside it, every address it uses is valid and the
+ * program writes none of its cells. The cells after the first one keep their own decoding,
+ * so a jump into the middle or a step budget smaller than the sequence falls back to
+ * single instructions. Cells the analysis does not reach (e.g. after setPC) are not fused.
+ */
+void ControlUnit::fuse(const ProgramAnalysis &analysis)
+{
+    int storage = static_cast<int>(getStorage());
+    int i = 0;
+    while (i < storage)
+    {
+        Superinstruction super = SUPER_NONE;
+        if (code[i].op == OP_LOAD && i + 1 < storage)
+        {
+            Opcode second = code[i + 1].op;
+            Opcode third = i + 2 < storage ? code[i + 2].op : OP_EMPTY;
+            Opcode fourth = i + 3 < storage ? code[i + 3].op : OP_EMPTY;
+            if (second == OP_SUB && third == OP_STORE && fourth == OP_BRANCHGT)
+                super = SUPER_DEC_BRANCH;
+            else if (second == OP_ADD && third == OP_STORE)
+                super = SUPER_LOAD_ADD_STORE;
+            else if (second == OP_SUB && third == OP_STORE)
+                super = SUPER_LOAD_SUB_STORE;
+            else if (second == OP_STORE)
+                super = SUPER_LOAD_STORE;
+        }
+        int length = superLength(super);
+        bool safe = super != SUPER_NONE;
+        for (int k = 0; safe && k < length; k++)
+        {
+            if (analysis.getBlock(i + k) < 0 || analysis.getBlock(i + k) != analysis.getBlock(i))
+                safe = false;  // A jump lands inside the sequence
+            else if (!validAddress(code[i + k].operand))
+                safe = false;  // The single instructions have to report the error
+            else if (analysis.isSelfModifying(i + k))
+                safe = false;  // The program overwrites the sequence
+        }
+        if (safe)
+        {
+            code[i].super = super;
+            i += length;
+        }
+        else
+            i++;
+    }
+}
+
+/// Compiles every loop that a BRANCHGT closes, the ones LoopPlan accepts get SUPER_LOOP.
+/* The loop superinstruction replaces a fused sequence at the first cell, the other
+ * cells keep their decoding for the runs that can't use the LoopPlan.
+ * A loop is skipped if the analysis finds a cell of it that the program writes.
+ */
+void ControlUnit::findLoops(const ProgramAnalysis &analysis)
+{
+    int storage = static_cast<int>(getStorage());
+    loops.clear();
+    loopAt.assign(storage, -1);
+    size_t slots = 0;
+    for (int tail = 0; tail < storage; tail++)
+    {
+        int head = code[tail].operand;
+        if (code[tail].op != OP_BRANCHGT || code[tail].invalid || head > tail || loopAt[head] >= 0 ||
+            tail - head >= LOOP_MAX_LENGTH)
+            continue;
+        std::vector<Cell> body;
+        bool modified = false;
+        for (int i = head; i <= tail; i++)
+        {
+            body.push_back(Cell{code[i].operand, code[i].op});
+            modified = modified || analysis.isSelfModifying(i);
+        }
+        if (modified)
+            continue;
+        LoopPlan plan;
+        if (!LoopPlan::compile(body, head, storage, plan))
+            continue;
+        loopAt[head] = static_cast<int>(loops.size());
+        loops.push_back(plan);
+        code[head].super = SUPER_LOOP;
+        for (int i = head; i <= tail; i++)
+            code[i].looped = true;
+        slots = std::max(slots, plan.getSlots());
+    }
+    loopState.assign(2 * slots, 0);
+}
+
+/// Direct-threaded engine.
+/* The memory is decoded once into an array of (handler, operand) pairs with a sentinel
+ * after the last cell, every handler jumps straight to the handler of the next instruction.
+ * Every address operand is validated while decoding: an instruction with an address outside
+ * the memory gets a handler that only reports the error, so the other handlers, the jumps
+ * and the writes run without range checks. The operands never change, a write only creates
+ * a variable, and the sentinel stops a program that runs past the last cell.
+ * STORE and READ keep the decoded array in sync, writes from anywhere else cause a new decode.
+ * A write into a fused sequence turns it back into single instructions, a write into the body
+ * of a counted loop drops its LoopPlan.
+ * A counted loop runs as many whole iterations as the budget allows in one handler.
+ * Stops with the same statuses as runSwitch.
+ */
+template <class Probe, class Arith, class Word>
+RunResult ControlUnit::runThreaded(unsigned long long maxSteps, Probe &probe)
+{
+#if defined(__GNUC__)
+    static const void *const handlers[OP_COUNT + 1] = {
+        &&op_empty, &&op_load, &&op_store, &&op_add, &&op_sub, &&op_read,
+        &&op_print, &&op_jump, &&op_branchgt, &&op_var, &&op_exit, &&op_end};
+    static const void *const faultHandlers[OP_COUNT + 1] = {
+        &&op_empty, &&op_bad_address, &&op_bad_address, &&op_bad_address, &&op_bad_address, &&op_read_bad_address,
+        &&op_bad_address, &&op_bad_jump, &&op_bad_jump, &&op_var, &&op_exit, &&op_end};
+    static const void *const superHandlers[SUPER_COUNT] = {
+        nullptr, &&super_load_store, &&super_load_add_store, &&super_load_sub_store, &&super_dec_branch, &&super_loop};
+#define THREADED_HANDLER(o) \
+    ((o).super != SUPER_NONE ? superHandlers[(o).super] : (o).invalid ? faultHandlers[(o).op] : handlers[(o).op])
+#define THREADED_GOTO(ip) goto *(ip)->handler
+#define THREADED_SINGLE(ip) goto *handlers[(ip)->op]
+#define THREADED_TABLE handlers
+#else
+#define THREADED_HANDLER(o) nullptr
+#define THREADED_TABLE nullptr
+#define THREADED_GOTO(ip) goto dispatch
+#define THREADED_SINGLE(ip) goto dispatch_single
+#endif
+// Executes the next instruction or leaves the loop when the step budget is used up
+#define THREADED_NEXT()          \
+    do                           \
+    {                            \
+        if (left == 0)           \
+            goto done;           \
+        left--;                  \
+        ip = &code[pc++];        \
+        probe.executed(pc - 1, ip->op); \
+        THREADED_GOTO(ip);       \
+    } while (0)
+// Leaves the loop because the current instruction stopped the program, it is not a step
+#define THREADED_STOP(st)        \
+    do                           \
+    {                            \
+        status = st;             \
+        left++;                  \
+        probe.failed((int)(ip - code.data()), ip->op); \
+        goto done;               \
+    } while (0)
+// Starts a superinstruction of n cells, or runs its first cell alone if the budget is too small
+#define THREADED_SUPER(n)        \
+    do                           \
+    {                            \
+        if (left < (n) - 1)      \
+            THREADED_SINGLE(ip); \
+        left -= (n) - 1;         \
+        eliminated += (n) - 1;   \
+    } while (0)
+// Runs a superinstruction of n cells as single instructions, they stop at the failing one
+#define THREADED_UNFUSE(n)       \
+    do                           \
+    {                            \
+        left += (n) - 1;         \
+        eliminated -= (n) - 1;   \
+        THREADED_SINGLE(ip);     \
+    } while (0)
+// Writes a variable to a validated address and keeps the decoded code in sync
+#define THREADED_WRITE(address, value)                                              \
+    do                                                                              \
+    {                                                                               \
+        int a = (address);                                                          \
+        bool looped = code[a].looped;                                               \
+        probe.memoryWrite(a, value);                                                \
+        Word::store(*this, a, value);                                               \
+        code[a] = ThreadedOp{nullptr, (int)(value), OP_VAR, SUPER_NONE, false, looped}; \
+        code[a].handler = THREADED_HANDLER(code[a]);                                \
+        for (int h = a - 1; h >= 0 && h > a - 4; h--)                               \
+            if (code[h].super != SUPER_NONE && h + superLength(code[h].super) > a)  \
+            {                                                                       \
+                code[h].super = SUPER_NONE;  /* The fused sequence changed */       \
+                code[h].handler = THREADED_HANDLER(code[h]);                        \
+            }                                                                       \
+        if (looped)                                                                 \
+            for (const LoopPlan &changed : loops)                                   \
+            {                                                                       \
+                int head = changed.getHead();                                       \
+                if (head <= a && a <= changed.getTail() && loopAt[head] >= 0)       \
+                {                                                                   \
+                    loopAt[head] = -1;  /* The body changed, the plan is stale */   \
+                    code[head].super = SUPER_NONE;                                  \
+                    code[head].handler = THREADED_HANDLER(code[head]);              \
+                }                                                                   \
+            }                                                                       \
+        codeWrites = getWrites();                                                   \
+    } while (0)
+
+    if (!validAddress(PC))
+        return RunResult{STATUS_BAD_ADDRESS, 0};
+    if (code.empty() || codeWrites != getWrites())
+    {
+        decode();
+        codeTable = nullptr;
+    }
+    if (codeTable != THREADED_TABLE)  // Decoded or last run by another instance of the engine
+    {
+        for (ThreadedOp &op : code)
+            op.handler = THREADED_HANDLER(op);
+        codeTable = THREADED_TABLE;
+    }
+
+    // The loops only run in bulk when nothing watches the single instructions, LoopPlan computes with int
+    const bool bulk = std::is_same<Probe, NoProbe>::value && std::is_same<Arith, WrapArithmetic>::value &&
+                      std::is_same<Word, Word32>::value;
+    int pc = PC;
+    typename Word::type acc = Word::acc(*this);
+    unsigned long long left = maxSteps;
+    unsigned long long eliminated = 0;
+    Status status = STATUS_STEP_LIMIT;
+    const ThreadedOp *ip;
+    THREADED_NEXT();
+
+#if !defined(__GNUC__)
+dispatch:
+    switch (ip->super)
+    {
+    case SUPER_LOAD_STORE: goto super_load_store;
+    case SUPER_LOAD_ADD_STORE: goto super_load_add_store;
+    case SUPER_LOAD_SUB_STORE: goto super_load_sub_store;
+    case SUPER_DEC_BRANCH: goto super_dec_branch;
+    case SUPER_LOOP: goto super_loop;
+    default: break;
+    }
+dispatch_single:
+    if (ip->invalid)
+    {
+        switch (ip->op)
+        {
+        case OP_READ: goto op_read_bad_address;
+        case OP_JUMP:
+        case OP_BRANCHGT: goto op_bad_jump;
+        default: goto op_bad_address;
+        }
+    }
+    switch (ip->op)
+    {
+    case OP_LOAD: goto op_load;
+    case OP_STORE: goto op_store;
+    case OP_ADD: goto op_add;
+    case OP_SUB: goto op_sub;
+    case OP_READ: goto op_read;
+    case OP_PRINT: goto op_print;
+    case OP_JUMP: goto op_jump;
+    case OP_BRANCHGT: goto op_branchgt;
+    case OP_VAR: goto op_var;
+    case OP_EXIT: goto op_exit;
+    case OP_COUNT: goto op_end;
+    default: goto op_empty;
+    }
+#endif
+
+op_empty:
+    THREADED_NEXT();
+op_load:
+    probe.memoryRead(ip->operand);
+    acc = Word::at(*this, ip->operand);
+    probe.accumulator(acc);
+    THREADED_NEXT();
+op_store:
+    THREADED_WRITE(ip->operand, acc);
+    THREADED_NEXT();
+op_add:
+    probe.memoryRead(ip->operand);
+    if (!Arith::add(acc, Word::at(*this, ip->operand)))
+        THREADED_STOP(STATUS_OVERFLOW);
+    probe.accumulator(acc);
+    THREADED_NEXT();
+op_sub:
+    probe.memoryRead(ip->operand);
+    if (!Arith::sub(acc, Word::at(*this, ip->operand)))
+        THREADED_STOP(STATUS_OVERFLOW);
+    probe.accumulator(acc);
+    THREADED_NEXT();
+op_read:
+{
+    int val = read();
+    THREADED_WRITE(ip->operand, val);
+    THREADED_NEXT();
+}
+op_print:
+    probe.memoryRead(ip->operand);
+    print(Word::at(*this, ip->operand));
+    THREADED_NEXT();
+op_jump:
+    probe.branch(pc - 1, ip->operand, true);
+    pc = ip->operand;
+    THREADED_NEXT();
+op_branchgt:
+    probe.branch(pc - 1, ip->operand, acc > 0);
+    if (acc > 0)
+        pc = ip->operand;
+    THREADED_NEXT();
+op_var:
+    THREADED_STOP(STATUS_VAR_EXECUTED);
+op_exit:
+    status = STATUS_HALTED;  // EXIT counts as an executed instruction
+    goto done;
+op_end:
+    pc--;  // The program ran out of the memory, PC stays on the last address + 1
+    THREADED_STOP(STATUS_BAD_ADDRESS);
+
+// Instructions with an address outside the memory, found by decode()
+op_bad_address:
+    THREADED_STOP(STATUS_BAD_ADDRESS);
+op_read_bad_address:
+    read();  // The input is read before the address is used, like in runSwitch
+    THREADED_STOP(STATUS_BAD_ADDRESS);
+op_bad_jump:
+    THREADED_STOP(STATUS_BAD_JUMP);
+
+// Superinstructions, the addresses were checked by fuse(), the arithmetic is checked before any effect
+super_load_store:
+    THREADED_SUPER(2);
+    acc = Word::at(*this, ip[0].operand);
+    probe.memoryRead(ip[0].operand);
+    probe.accumulator(acc);
+    probe.executed(pc, ip[1].op);
+    THREADED_WRITE(ip[1].operand, acc);
+    pc += 1;
+    THREADED_NEXT();
+super_load_add_store:
+{
+    THREADED_SUPER(3);
+    typename Word::type result = Word::at(*this, ip[0].operand);
+    if (!Arith::add(result, Word::at(*this, ip[1].operand)))
+        THREADED_UNFUSE(3);
+    probe.memoryRead(ip[0].operand);
+    probe.accumulator(Word::at(*this, ip[0].operand));
+    probe.executed(pc, ip[1].op);
+    probe.memoryRead(ip[1].operand);
+    probe.accumulator(result);
+    probe.executed(pc + 1, ip[2].op);
+    acc = result;
+    THREADED_WRITE(ip[2].operand, acc);
+    pc += 2;
+    THREADED_NEXT();
+}
+super_load_sub_store:
+{
+    THREADED_SUPER(3);
+    typename Word::type result = Word::at(*this, ip[0].operand);
+    if (!Arith::sub(result, Word::at(*this, ip[1].operand)))
+        THREADED_UNFUSE(3);
+    probe.memoryRead(ip[0].operand);
+    probe.accumulator(Word::at(*this, ip[0].operand));
+    probe.executed(pc, ip[1].op);
+    probe.memoryRead(ip[1].operand);
+    probe.accumulator(result);
+    probe.executed(pc + 1, ip[2].op);
+    acc = result;
+    THREADED_WRITE(ip[2].operand, acc);
+    pc += 2;
+    THREADED_NEXT();
+}
+super_dec_branch:
+{
+    THREADED_SUPER(4);
+    typename Word::type result = Word::at(*this, ip[0].operand);
+    if (!Arith::sub(result, Word::at(*this, ip[1].operand)))
+        THREADED_UNFUSE(4);
+    probe.memoryRead(ip[0].operand);
+    probe.accumulator(Word::at(*this, ip[0].operand));
+    probe.executed(pc, ip[1].op);
+    probe.memoryRead(ip[1].operand);
+    probe.accumulator(result);
+    probe.executed(pc + 1, ip[2].op);
+    acc = result;
+    THREADED_WRITE(ip[2].operand, acc);
+    probe.executed(pc + 2, ip[3].op);
+    probe.branch(pc + 2, ip[3].operand, acc > 0);
+    pc += 3;
+    if (acc > 0)
+        pc = ip[3].operand;
+    THREADED_NEXT();
+}
+super_loop:
+{
+    const LoopPlan &plan = loops[loopAt[pc - 1]];
+    unsigned long long most = (left + 1) / plan.getLength();  // The first cell is already counted
+    if (!bulk || most == 0)
+        THREADED_SINGLE(ip);
+    int *state = loopState.data();
+    size_t slots = plan.getSlots();
+    state[0] = (int)acc;
+    for (size_t s = 1; s < slots; s++)
+        state[s] = cellAt(plan.getAddress(s)).operand;
+    bool exited;
+    unsigned long long iterations = plan.run(state, state + slots, most, exited);
+    for (const LoopUpdate &update : plan.getUpdates())
+        if (update.slot != 0)
+            THREADED_WRITE(plan.getAddress(update.slot), state[update.slot]);
+    acc = state[0];
+    left = left + 1 - iterations * plan.getLength();
+    eliminated += iterations * plan.getLength() - 1;
+    pc = exited ? plan.getTail() + 1 : plan.getHead();
+    THREADED_NEXT();
+}
+
+done:
+    PC = pc;
+    Word::setAcc(*this, acc);
+    eliminatedInstructions += eliminated;
+    return RunResult{status, maxSteps - left};
+#undef THREADED_HANDLER
+#undef THREADED_GOTO
+#undef THREADED_SINGLE
+#undef THREADED_NEXT
+#undef THREADED_STOP
+#undef THREADED_SUPER
+#undef THREADED_UNFUSE
+#undef THREADED_TABLE
+#undef THREADED_WRITE
+}
+
+Snapshot ControlUnit::snapshot()
+{
+    flush();
+    return Snapshot{getImage(), freezePages(), PC, getWideAcc(), getMAR(), getMDR(), IR, inputPosition(), getPrinted(),
+                    freezeHighWords(), hasWideWords()};
+}
+
+/// The input is rewound first, the state is not changed if that fails.
+void ControlUnit::restore(const Snapshot &state)
+{
+    if (state.input >= 0 && inputPosition() != state.input && !seekInput(state.input))
+        throw "Input can't be rewound\n";
+    restoreMachine(state);
+}
+
+void ControlUnit::restoreMachine(const Snapshot &state)
+{
+    flush();
+    setWideWords(false);
+    restorePages(state.image, state.pages);
+    if (state.wide)
+        restoreWideWords(state.high);  // The snapshot has the width of the machine it was made of
+    PC = state.PC;
+    setWideACC(state.ACC);
+    setMAR(state.MAR);
+    setMDR(state.MDR);
+    IR = state.IR;
+    setPrinted(state.printed);
+}
+
+/// Fetches a cell from memory and returns an instruction view of it.
+Instruction *ControlUnit::fetch(int address)
+{
+    if (!validAddress(address))
+        throw "Invalid memory address\n";
+    setMAR(address);  // Set the memory address register
+    readEnable();     // Enable reading from memory
+    delete view;
+    view = Instruction::create(getMDR());  // Wrap the cell stored in the MDR
+    return view;
+}
+
+/// Constructor for MemoryUnit, reads file content into a new image.
+MemoryUnit::MemoryUnit(std::string filename): MAR(0), MDR{0, OP_EMPTY}, storage(0), writes(0)
 {
     try
     {
@@ -79,62 +908,125 @@ MemoryUnit::MemoryUnit(std::string filename)
     }
 }
 
-/// Reads instructions from the file and populates the memory array.
+/// Constructor for MemoryUnit, shares an image that is already loaded.
+MemoryUnit::MemoryUnit(std::shared_ptr<const ProgramImage> image): MAR(0), MDR{0, OP_EMPTY}, storage(0), writes(0)
+{
+    attach(image);
+}
+
+/// Loads the file into a new image, the old content is kept if loading fails.
 void MemoryUnit::FileReader(std::string filename)
 {
-    std::ifstream file;
-    file.open("input\\" + filename);  // Open file from the "input" directory
-    if (!file){
-        memory = nullptr;  // If file fails to open, set memory to nullptr
-        throw "File open failed.\n";  // Throw an error message
-    }
+    attach(ProgramImage::load(filename));
+}
 
-    std::string op = "0x0000";
-    file >> op;
-    storage = HextoInt(op);  // Set storage size from the file content
-    memory = new Instruction *[storage];  // Allocate memory for instructions
-    for (size_t i = 0; i < storage; i++)
-        memory[i] = nullptr;  // Initialize all memory slots to nullptr
-
-    std::string position;
-    std::string instructionType;
-
-    // Read instructions and store them in memory
-    while (file >> position >> instructionType >> op)
-    {
-        if (instructionType == "STORE")
-            memory[HextoInt(position)] = STORE(HextoInt(op)).clone();
-        else if (instructionType == "READ")
-            memory[HextoInt(position)] = READ(HextoInt(op)).clone();
-        else if (instructionType == "ADD")
-            memory[HextoInt(position)] = ADD(HextoInt(op)).clone();
-        else if (instructionType == "SUB")
-            memory[HextoInt(position)] = SUB(HextoInt(op)).clone();
-        else if (instructionType == "BRANCHGT")
-            memory[HextoInt(position)] = BRANCHGT(HextoInt(op)).clone();
-        else if (instructionType == "JUMP")
-            memory[HextoInt(position)] = JUMP(HextoInt(op)).clone();
-        else if (instructionType == "PRINT")
-            memory[HextoInt(position)] = PRINT(HextoInt(op)).clone();
-        else if (instructionType == "LOAD")
-            memory[HextoInt(position)] = LOAD(HextoInt(op)).clone();
-        else if (instructionType == "VAR")
-            memory[HextoInt(position)] = VAR(HextoInt(op)).clone();
-        else if (instructionType == "EXIT")
-            memory[HextoInt(position)] = EXIT(HextoInt(op)).clone();
-    }
-    file.close();  // Close the file after reading
-}
-
-/// Destructor to clean up dynamically allocated memory.
-MemoryUnit::~MemoryUnit()
-{
-    if (memory != nullptr)
-    {
-        for (size_t i = 0; i < storage; i++)
+/// Points every page to the image.
+void MemoryUnit::attach(std::shared_ptr<const ProgramImage> program)
+{
+    image = program;
+    storage = image ? image->getStorage() : 0;
+    cells.restore(image ? image->getPages() : 0, image ? image->getPage(0) : nullptr, ProgramImage::PAGE_SIZE, nullptr);
+    if (wideWords)
+        restoreHighWords(nullptr);  // The values of the new program are sign extended
+    writes++;  // Decoded copies of the old memory are not valid any more
+}
+
+/// A page of high halves that was never written: every value is its sign extended low half.
+static const int ZERO_WORDS[ProgramImage::PAGE_SIZE] = {};
+
+void MemoryUnit::restoreHighWords(std::shared_ptr<const FrozenHighWords> snapshot)
+{
+    highWords.restore(image ? image->getPages() : 0, ZERO_WORDS, 0, snapshot);
+}
+
+/// Both directions only change the page table of the high halves.
+void MemoryUnit::setWideWords(bool on)
+{
+    if (on == wideWords)
+        return;
+    wideWords = on;
+    if (on)
+        restoreHighWords(nullptr);
+    else
+        highWords.restore(0, nullptr, 0, nullptr);
+}
+
+void MemoryUnit::restorePages(std::shared_ptr<const ProgramImage> program, std::shared_ptr<const FrozenPages> snapshot)
+{
+    if (program != image)
+        attach(program);
+    cells.restore(image ? image->getPages() : 0, image ? image->getPage(0) : nullptr, ProgramImage::PAGE_SIZE, snapshot);
+    if (wideWords)
+        restoreHighWords(nullptr);
+    writes++;  // Decoded copies of the old memory are not valid any more
+}
+
+/// Copies the base or frozen page and points the page table to the copy.
+template <class T>
+T *PageTable<T>::copyPage(size_t page)
+{
+    dirtyPages.push_back(page);
+    privatePages[page].reset(new T[ProgramImage::PAGE_SIZE]);
+    T *values = privatePages[page].get();
+    const T *shared = pages[page];
+    for (int i = 0; i < ProgramImage::PAGE_SIZE; i++)
+        values[i] = shared[i];
+    pages[page] = values;
+    return values;
+}
+
+template <class T>
+void PageTable<T>::restore(size_t count, const T *base, size_t stride, std::shared_ptr<const FrozenLayer<T>> snapshot)
+{
+    pages.assign(count, nullptr);
+    privatePages.clear();
+    privatePages.resize(count);
+    dirtyPages.clear();
+    frozen = snapshot;
+    if (frozen)
+        frozen->collect(pages);
+    for (size_t page = 0; page < count; page++)
+        if (pages[page] == nullptr)
+            pages[page] = base + page * stride;
+}
+
+/// The page table keeps pointing to the same values, they are owned by the frozen layer from now on.
+template <class T>
+std::shared_ptr<const FrozenLayer<T>> PageTable<T>::freeze()
+{
+    if (dirtyPages.empty())
+        return frozen;
+    std::sort(dirtyPages.begin(), dirtyPages.end());
+    std::vector<size_t> indices;
+    std::vector<std::shared_ptr<const T>> values;
+    for (size_t page : dirtyPages)
+        if (privatePages[page] != nullptr)
         {
-            delete memory[i];  // Delete each instruction in memory
+            indices.push_back(page);
+            values.push_back(std::shared_ptr<const T>(privatePages[page].release(), std::default_delete<T[]>()));
         }
-        delete[] memory;  // Delete the memory array itself
-    }
+    dirtyPages.clear();
+    if (!indices.empty())
+        frozen = FrozenLayer<T>::push(frozen, std::move(indices), std::move(values));
+    return frozen;
 }
+
+template <class T>
+size_t PageTable<T>::getPrivatePages() const
+{
+    size_t count = 0;
+    for (const std::unique_ptr<T[]> &page : privatePages)
+        if (page != nullptr)
+            count++;
+    return count;
+}
+
+// The cells and the high halves of the 64-bit words
+template class PageTable<Cell>;
+template class PageTable<int>;
+
+// The engines are compiled once for every probe and arithmetic
+template RunResult ControlUnit::runWith<NoProbe>(NoProbe &, unsigned long long);
+template RunResult ControlUnit::runWith<Profiler>(Profiler &, unsigned long long);
+template RunResult ControlUnit::runWith<TraceRecorder>(TraceRecorder &, unsigned long long);
+template RunResult ControlUnit::runWith<TimeTravel>(TimeTravel &, unsigned long long);
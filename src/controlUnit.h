@@ -1,118 +1,749 @@
 #ifndef CONTROLUNIT_H_INCLUDED
 #define CONTROLUNIT_H_INCLUDED
 
-#include "Instruction.h"
+#include "instruction.h"
+#include "programImage.h"
+#include "numberReader.h"
+#include "snapshot.h"
+#include "loopAccelerator.h"
+#include <climits>
 #include <iostream>
+#include <memory>
+#include <vector>
+
+/// PageTable class
+/* One plane of the paged memory, T is the element of the pages.
+ * The table points into read-only base pages, into the frozen layers of the snapshots, or into
+ * private pages: a page is copied into private memory the first time it is written (copy-on-write).
+ * freeze() hands the private pages over to a new frozen layer, they are copied again on their next write.
+ */
+template <class T>
+class PageTable{
+    std::vector<const T*> pages;                        /// Page table, points into a base, frozen or private page
+    std::vector<std::unique_ptr<T[]>> privatePages;     /// Pages that were written, nullptr while shared
+    std::shared_ptr<const FrozenLayer<T>> frozen;       /// Pages shared with snapshots, they own the frozen values
+    std::vector<size_t> dirtyPages;                     /// Pages copied since the last freeze
+
+    /// Copies a shared page into private memory.
+    /// @param page - index of the page
+    /// @return the private copy of the page
+    T* copyPage(size_t page);
+public:
+    /// Get an element without copying its page.
+    /// @param address - the address of the element, must be inside the table
+    /// @return the element at the address
+    const T& at(int address) const {
+        return pages[static_cast<size_t>(address) >> ProgramImage::PAGE_BITS][address & ProgramImage::PAGE_MASK];
+    }
+
+    /// Get an element to write, its page is copied on the first write.
+    /// @param address - the address of the element, must be inside the table
+    /// @return the element at the address in a private page
+    T& writable(int address){
+        size_t page = static_cast<size_t>(address) >> ProgramImage::PAGE_BITS;
+        T* values = privatePages[page].get();
+        if(values == nullptr)
+            values = copyPage(page);
+        return values[address & ProgramImage::PAGE_MASK];
+    }
+
+    /// Points every page to a frozen page or to its base page, every private page is dropped.
+    /// @param count - number of pages
+    /// @param base - the first base page, page i is base + i * stride
+    /// @param stride - distance of the base pages, 0 if every page has the same base
+    /// @param snapshot - frozen pages on top of the base, nullptr for none
+    void restore(size_t count, const T* base, size_t stride, std::shared_ptr<const FrozenLayer<T>> snapshot);
+
+    /// Makes the written pages read-only, so a snapshot can share them.
+    /// Only the pages written since the last call are touched, they become a new layer.
+    /// @return the frozen pages, nullptr if no page was written since the last restore
+    std::shared_ptr<const FrozenLayer<T>> freeze();
+
+    /// Get the number of private pages.
+    /// @return the number of pages copied because they were written
+    size_t getPrivatePages() const;
+};
 
 /// MemoryUnit class
-/* This class contains a heterogeneous collection that stores instructions.
- * The array contains instructions in one segment, followed by constants.
+/* The memory is an array of fixed-size cells (opcode + operand), split into pages.
+ * The cells contain instructions in one segment, followed by constants.
+ * The initial content is a shared, read-only ProgramImage: a page is copied
+ * into private memory the first time it is written (copy-on-write).
+ * A snapshot freezes the private pages: they are shared with the snapshot
+ * and copied again on their next write.
+ * With 64-bit words a second PageTable holds the high halves of the variables, the cells hold
+ * the low halves. A high half is stored as the difference from the sign extension of the low
+ * half, so a page that was never written is a shared page of zeros, and the 32-bit engines,
+ * which never run with 64-bit words, do not touch it.
  */
 class MemoryUnit{
     int MAR;                    /// Memory Address Register
-    Instruction* MDR;           /// Memory Data Register
-    Instruction** memory;       /// Memory, stores instructions
+    Cell MDR;                   /// Memory Data Register
+    std::shared_ptr<const ProgramImage> image;  /// The loaded program, shared with other MemoryUnits
+    PageTable<Cell> cells;      /// The cells, the base pages are the pages of the image
+    PageTable<int> highWords;   /// High halves of the 64-bit words, no pages with 32-bit words
     size_t storage;             /// Memory size
+    unsigned long long writes;  /// Number of writes, lets decoded copies of the memory detect changes
+    bool wideWords=false;       /// The variables are 64-bit words
+
+    /// Points the high halves to the frozen pages, or to zeros where there is none.
+    /// @param snapshot - frozen high halves, nullptr for none
+    void restoreHighWords(std::shared_ptr<const FrozenHighWords> snapshot);
 public:
     /// Constructor.
-    /// Reads data from a file and stores it in dynamically allocated memory.
+    /// Reads data from a file into a new program image.
     /// @param filename - the file from which to read the data
     MemoryUnit(std::string filename);
 
+    /// Constructor.
+    /// Uses an already loaded program image, without copying it.
+    /// @param image - the program, nullptr gives an invalid memory
+    MemoryUnit(std::shared_ptr<const ProgramImage> image);
+
     /// Strips leading zeros from a string and converts it to an integer.
     /// @param hex - the string to be converted to an integer
     /// @return the integer after removing leading zeros
-    int HextoInt(std::string hex);
+    int HextoInt(std::string hex){ return ProgramImage::HextoInt(hex); }
 
     /// Set MAR.
     /// @param address - the address to read or write
     void setMAR(int address){ MAR=address; }
 
+    /// Get MAR.
+    /// @return the current value of MAR
+    int getMAR(){ return MAR; }
+
     /// Set MDR.
     /// @param mdr - temporarily stores the current memory operation
-    void setMDR(Instruction* mdr){ MDR=mdr; }
+    void setMDR(Cell mdr){ MDR=mdr; }
 
     /// Get MDR.
     /// @return the current value of MDR
-    Instruction* getMDR(){ return MDR; }
+    Cell getMDR(){ return MDR; }
 
-    /// Reads the instruction at the MAR address into the MDR.
-    void readEnable(){ MDR=memory[MAR]; }
+    /// Reads the cell at the MAR address into the MDR.
+    void readEnable(){ MDR=cellAt(MAR); }
 
     /// Writes the MDR content to the MAR address.
-    void writeEnable(){ delete memory[MAR]; memory[MAR] = MDR; }
+    /// The page is copied from the image on its first write. With 64-bit words the high half
+    /// of the cell is not changed, storeWide() and writeWord() write both halves.
+    void writeEnable(){
+        cells.writable(MAR) = MDR;
+        writes++;
+    }
+
+    /// Checks if an address is inside the memory.
+    /// @param address - the address to check
+    /// @return true if the address can be read or written
+    bool validAddress(int address){ return address >= 0 && static_cast<size_t>(address) < storage; }
+
+    /// Reads the operand of the cell at the given address.
+    /// Throws an exception if the address is outside the memory.
+    /// @param address - the address to read
+    /// @return the operand (constant) stored at the address
+    int readWord(int address){
+        if(!validAddress(address))
+            throw "Invalid memory address\n";
+        setMAR(address);
+        readEnable();
+        return MDR.operand;
+    }
+
+    /// Stores a value as a variable at the given address.
+    /// Throws an exception if the address is outside the memory.
+    /// @param address - the address to write
+    /// @param value - the value to store
+    void writeWord(int address, int value){
+        if(!validAddress(address))
+            throw "Invalid memory address\n";
+        if(wideWords){
+            storeWide(address, value);
+            return;
+        }
+        setMAR(address);
+        setMDR(Cell{value, OP_VAR});
+        writeEnable();
+    }
+
+    /// Reads the 64-bit value of the variable at the given address.
+    /// Throws an exception if the address is outside the memory.
+    /// @param address - the address to read
+    /// @return the value, the operand of the cell with 32-bit words
+    long long readWide(int address){
+        if(!validAddress(address))
+            throw "Invalid memory address\n";
+        setMAR(address);
+        readEnable();
+        return wideWords ? wideAt(address) : MDR.operand;
+    }
+
+    /// Stores a 64-bit value as a variable at the given address.
+    /// Throws an exception if the address is outside the memory.
+    /// @param address - the address to write
+    /// @param value - the value to store, truncated to 32 bits with 32-bit words
+    void writeWide(int address, long long value){
+        if(!validAddress(address))
+            throw "Invalid memory address\n";
+        if(wideWords)
+            storeWide(address, value);
+        else
+            writeWord(address, (int)value);
+    }
+
+    /// Stores a 64-bit value as a variable at a valid address, 64-bit words must be on.
+    /// The cell gets the low half, the high half is stored relative to its sign extension.
+    /// @param address - the address to write, it is not checked
+    /// @param value - the value to store
+    void storeWide(int address, long long value){
+        int low = (int)value;
+        setMAR(address);
+        setMDR(Cell{low, OP_VAR});
+        writeEnable();
+        highWords.writable(address) = (int)(((unsigned long long)value - (unsigned long long)(long long)low) >> 32);
+    }
+
+    /// Get the 64-bit value of a cell without changing MAR and MDR, 64-bit words must be on.
+    /// @param address - the address of the cell, must be valid
+    /// @return the sign extended operand plus the high half
+    long long wideAt(int address){
+        return (long long)((unsigned long long)(long long)cellAt(address).operand +
+                           ((unsigned long long)(unsigned)highWords.at(address) << 32));
+    }
+
+    /// Turns the 64-bit values of the variables on or off.
+    /// Turning them on sign extends the cells, turning them off keeps the low 32 bits.
+    /// @param on - true for 64-bit words
+    void setWideWords(bool on);
+
+    /// Checks if the variables are 64-bit words.
+    /// @return true with 64-bit words
+    bool hasWideWords(){ return wideWords; }
+
+    /// Makes the written high halves read-only, like freezePages().
+    /// @return the frozen high halves, nullptr if none was written or with 32-bit words
+    std::shared_ptr<const FrozenHighWords> freezeHighWords(){ return wideWords ? highWords.freeze() : nullptr; }
+
+    /// Turns on the 64-bit words with the frozen high halves, e.g. of a snapshot.
+    /// @param snapshot - the frozen high halves, nullptr if none was written
+    void restoreWideWords(std::shared_ptr<const FrozenHighWords> snapshot){ wideWords = true; restoreHighWords(snapshot); }
 
     /// Get storage.
     /// @return the current value of storage
     size_t getStorage(){ return storage;}
 
-    /// Reads data from the specified file and stores it in the memory.
+    /// Get the write counter.
+    /// @return the number of writes since the memory was loaded
+    unsigned long long getWrites(){ return writes; }
+
+    /// Get a cell without changing MAR and MDR.
+    /// @param address - the address of the cell, must be valid
+    /// @return the cell at the address
+    Cell cellAt(int address){ return cells.at(address); }
+
+    /// Get the program image.
+    /// @return the shared image the memory was started from
+    std::shared_ptr<const ProgramImage> getImage(){ return image; }
+
+    /// Get the number of private pages.
+    /// @return the number of pages copied from the image because they were written
+    size_t getPrivatePages(){ return cells.getPrivatePages(); }
+
+    /// Makes the written pages read-only, so a snapshot can share them.
+    /// Only the pages written since the last call are touched, they become a new layer.
+    /// @return the frozen pages, nullptr if no page was written since the program was loaded
+    std::shared_ptr<const FrozenPages> freezePages(){ return cells.freeze(); }
+
+    /// Replaces the memory with frozen pages, without copying them.
+    /// @param program - the image of the pages
+    /// @param snapshot - the frozen pages, nullptr if every page is the page of the image
+    void restorePages(std::shared_ptr<const ProgramImage> program, std::shared_ptr<const FrozenPages> snapshot);
+
+    /// Reads data from the specified file and replaces the memory with it.
+    /// Throws an exception if the file can't be opened.
     /// @param filename - the name of the file to read from
     void FileReader(std::string filename);
 
-    /// Checks if the memory has been allocated properly.
-    /// @return true if the memory has not been allocated (nullptr), false if memory is allocated
+    /// Uses a program image as the content of the memory, every private page is dropped.
+    /// @param program - the image to use, nullptr gives an invalid memory
+    void attach(std::shared_ptr<const ProgramImage> program);
+
+    /// Checks if the memory has been loaded properly.
+    /// @return true if there is no program in the memory
     bool NotValidMemory(){
-        if(memory == nullptr){
+        if(image == nullptr){
             return true;
         }
         return false;
     }
+};
+
+/// WordWidth enum
+/* The type of the accumulator and the variables. Instructions and addresses are 32-bit in both. */
+enum WordWidth{
+    WORD_INT32,         /// int, the values fit in the cells, the default
+    WORD_INT64          /// long long, e.g. for Fibonacci numbers past the 46th
+};
+
+/// Arithmetic enum
+/* How ADD and SUB treat a result that does not fit in a memory word (int or long long). */
+enum Arithmetic{
+    ARITH_WRAP,         /// Two's complement wrap-around, the default
+    ARITH_CHECKED,      /// The instruction stops the program with STATUS_OVERFLOW
+    ARITH_SATURATE      /// The result is clamped to INT_MIN or INT_MAX
+};
+
+/* Arithmetic policies of the engines, one for every Arithmetic value.
+ * add and sub return false if the instruction has to stop the program, the accumulator is not
+ * changed then. The engines are templates on the policy: a policy that never fails compiles
+ * to a loop without overflow checks. Every policy has an overload for both word types.
+ */
+
+/// WrapArithmetic struct
+struct WrapArithmetic{
+    static bool add(int& acc, int value){ acc = (int)((unsigned)acc + (unsigned)value); return true; }
+    static bool sub(int& acc, int value){ acc = (int)((unsigned)acc - (unsigned)value); return true; }
+    static bool add(long long& acc, long long value){ acc = (long long)((unsigned long long)acc + (unsigned long long)value); return true; }
+    static bool sub(long long& acc, long long value){ acc = (long long)((unsigned long long)acc - (unsigned long long)value); return true; }
+};
+
+/// CheckedArithmetic struct
+struct CheckedArithmetic{
+    static bool add(int& acc, int value){ return fits((long long)acc + value, acc); }
+    static bool sub(int& acc, int value){ return fits((long long)acc - value, acc); }
+
+    static bool add(long long& acc, long long value){
+        if(value > 0 ? acc > LLONG_MAX - value : acc < LLONG_MIN - value)
+            return false;
+        acc += value;
+        return true;
+    }
+
+    static bool sub(long long& acc, long long value){
+        if(value < 0 ? acc > LLONG_MAX + value : acc < LLONG_MIN + value)
+            return false;
+        acc -= value;
+        return true;
+    }
+
+    /// Stores an exact result if it is a valid word.
+    /// @param result - the exact result
+    /// @param acc - receives the result if it fits
+    /// @return false on overflow
+    static bool fits(long long result, int& acc){
+        if(result < INT_MIN || result > INT_MAX)
+            return false;
+        acc = (int)result;
+        return true;
+    }
+};
+
+/// SaturatingArithmetic struct
+struct SaturatingArithmetic{
+    static bool add(int& acc, int value){ acc = clamp((long long)acc + value); return true; }
+    static bool sub(int& acc, int value){ acc = clamp((long long)acc - value); return true; }
+
+    static bool add(long long& acc, long long value){
+        if(!CheckedArithmetic::add(acc, value))
+            acc = value > 0 ? LLONG_MAX : LLONG_MIN;
+        return true;
+    }
+
+    static bool sub(long long& acc, long long value){
+        if(!CheckedArithmetic::sub(acc, value))
+            acc = value < 0 ? LLONG_MAX : LLONG_MIN;
+        return true;
+    }
 
-    /// Deletes dynamically allocated memory.
-    ~MemoryUnit();
+    /// Clamps an exact result to the range of a word.
+    /// @param result - the exact result
+    /// @return the closest int
+    static int clamp(long long result){ return result < INT_MIN ? INT_MIN : result > INT_MAX ? INT_MAX : (int)result; }
 };
 
 /// ProcessingUnit class
 class ProcessingUnit{
-    int ACC;     /// Accumulator, temporarily stores calculated results and loaded constants
+    long long ACC=0;    /// Accumulator, temporarily stores calculated results and loaded constants
 public:
     /// Set ACC.
     /// @param acc - the current constant
     void setACC(int acc){ ACC = acc; }
 
     /// Get ACC.
+    /// @return the current value of ACC, the low 32 bits with 64-bit words
+    int getAcc(){ return (int)ACC;}
+
+    /// Set ACC to a 64-bit value.
+    /// @param acc - the current constant
+    void setWideACC(long long acc){ ACC = acc; }
+
+    /// Get ACC as a 64-bit value.
     /// @return the current value of ACC
-    int getAcc(){ return ACC;}
+    long long getWideAcc(){ return ACC; }
 
     /// Adds the given value to the ACC.
     /// @param value - value to add
-    void add(int value){ ACC = ACC + value; }
+    void add(int value){ int acc = getAcc(); WrapArithmetic::add(acc, value); ACC = acc; }
 
     /// Subtracts the given value from the ACC.
     /// @param value - value to subtract
-    void sub(int value){ ACC = ACC - value; }
+    void sub(int value){ int acc = getAcc(); WrapArithmetic::sub(acc, value); ACC = acc; }
+};
+
+/* Word policies of the engines, one for every WordWidth value. They read and write the
+ * accumulator and the variables with the type of the word, so every width has its own
+ * compiled engines and a 32-bit run does not touch the 64-bit values.
+ * read and write use MAR and MDR and check the address, at and store do neither.
+ */
+
+/// Word32 struct
+struct Word32{
+    typedef int type;
+    static int acc(ProcessingUnit& unit){ return unit.getAcc(); }
+    static void setAcc(ProcessingUnit& unit, int value){ unit.setACC(value); }
+    static int at(MemoryUnit& memory, int address){ return memory.cellAt(address).operand; }
+    static int read(MemoryUnit& memory, int address){ return memory.readWord(address); }
+    static void write(MemoryUnit& memory, int address, int value){ memory.writeWord(address, value); }
+    static void store(MemoryUnit& memory, int address, int value){
+        memory.setMAR(address);
+        memory.setMDR(Cell{value, OP_VAR});
+        memory.writeEnable();
+    }
+};
+
+/// Word64 struct
+struct Word64{
+    typedef long long type;
+    static long long acc(ProcessingUnit& unit){ return unit.getWideAcc(); }
+    static void setAcc(ProcessingUnit& unit, long long value){ unit.setWideACC(value); }
+    static long long at(MemoryUnit& memory, int address){ return memory.wideAt(address); }
+    static long long read(MemoryUnit& memory, int address){ return memory.readWide(address); }
+    static void write(MemoryUnit& memory, int address, long long value){ memory.writeWide(address, value); }
+    static void store(MemoryUnit& memory, int address, long long value){ memory.storeWide(address, value); }
 };
 
+/// Size of the output buffer of the IOUnit.
+const size_t OUTPUT_BUFFER_SIZE = 4096;
+
 /// IOUnit class
+/* By default every PRINT is written and flushed at once. In buffered mode the numbers are
+ * formatted into a local buffer, which is written out when it is full, before a READ from
+ * the console and when the ControlUnit stops running.
+ * The input is either a stream or a NumberReader for large inputs.
+ */
 class IOUnit{
     std::ostream& os;   /// Reference to an output stream to write data to
-    std::istream& is;   /// Reference to an input stream to read data from
+    std::istream* is;   /// The input stream to read data from, nullptr if the reader is used
+    NumberReader* reader;   /// Fast input source to read data from, nullptr if the stream is used
+    bool console;       /// The output is the console: the numbers get a "Result: " prefix
+    bool interactive;   /// The input is the console: READ prompts for the number
+    bool buffered=false;                /// PRINT only writes into the buffer
+    unsigned long long printed=0;       /// Number of values written by PRINT
+    unsigned long long quiet=0;         /// PRINTs up to this count were written before, they are only counted
+    size_t used=0;                      /// Number of characters in the buffer
+    char buffer[OUTPUT_BUFFER_SIZE];    /// Formatted output that was not written yet
 public:
     /// Constructor.
     /// @param os - output stream
     /// @param is - input stream
-    IOUnit(std::ostream& os, std::istream& is): os(os), is(is){}
+    IOUnit(std::ostream& os, std::istream& is)
+        : os(os), is(&is), reader(nullptr), console(&os == &std::cout), interactive(&is == &std::cin){}
+
+    /// Constructor.
+    /// @param os - output stream
+    /// @param reader - input source, it is never interactive
+    IOUnit(std::ostream& os, NumberReader& reader)
+        : os(os), is(nullptr), reader(&reader), console(&os == &std::cout), interactive(false){}
+
+    /// Writes out the buffer.
+    ~IOUnit(){ flush(); }
+
+    /// Turns the buffered output on or off. Turning it off writes out the buffer.
+    /// @param on - true to buffer the output of PRINT
+    void setBuffered(bool on){ if (!on) flush(); buffered = on; }
+
+    /// Writes the buffered output to the output stream and flushes the stream.
+    /// Does nothing if the buffer is empty.
+    void flush();
 
     /// Prints a constant to the output stream.
     /// @param var - the constant to be printed
-    void print(int var);
+    void print(long long var);
+
+    /// Get the number of printed values.
+    /// @return the number of PRINTs since the construction or the restored snapshot
+    unsigned long long getPrinted(){ return printed; }
+
+    /// Set the number of printed values.
+    /// @param count - the restored counter
+    void setPrinted(unsigned long long count){ printed = count; }
+
+    /// Marks the values that were already written, for a program that runs a part again
+    /// after a restored snapshot. Those PRINTs are counted but not written a second time.
+    /// @param count - number of the values written so far
+    void setQuiet(unsigned long long count){ quiet = count; }
+
+    /// Get the position of the input.
+    /// @return the offset of the next character, -1 if the input can't tell it (e.g. the console)
+    long long inputPosition();
+
+    /// Continues reading the input at a position.
+    /// @param position - an offset returned by inputPosition()
+    /// @return false if the input can't be rewound
+    bool seekInput(long long position);
 
     /// Reads an integer from the input stream.
     /// @return the read integer
     int read();
 };
 
+/// Engine enum
+/* The ControlUnit can execute the program in two ways, the engine is chosen at construction. */
+enum Engine{
+    ENGINE_SWITCH,      /// Fetches every cell from memory and decodes it with a switch
+    ENGINE_THREADED     /// Runs a pre-decoded, direct-threaded copy of the program
+};
+
+/// Status enum
+/* Result of ControlUnit::run, tells why the execution stopped. */
+enum Status{
+    STATUS_RUNNING,         /// Only used inside the engines: the instruction finished normally
+    STATUS_HALTED,          /// An EXIT instruction was executed
+    STATUS_STEP_LIMIT,      /// The step budget ran out, the program can be continued
+    STATUS_BAD_JUMP,        /// JUMP or BRANCHGT to an address outside the memory
+    STATUS_BAD_ADDRESS,     /// Memory access or program counter outside the memory
+    STATUS_VAR_EXECUTED,    /// Tried to execute a variable
+    STATUS_NO_PROGRAM,      /// The memory could not be loaded from the file
+    STATUS_TIMEOUT,         /// The time limit ran out, the program can be continued
+    STATUS_OVERFLOW         /// ADD or SUB overflowed with ARITH_CHECKED
+};
+
+/// Gives the message that belongs to a status.
+/// These are the same texts that cycle() and the Instruction classes throw.
+/// @param status - the status
+/// @return the message, ending in a newline
+const char* statusMessage(Status status);
+
+/// RunResult struct
+struct RunResult{
+    Status status;              /// Why the execution stopped
+    unsigned long long steps;   /// Number of executed instructions, including the final EXIT
+};
+
+/// Superinstruction enum
+/* Common instruction sequences that the threaded engine can execute in one step (fusion). */
+enum Superinstruction : unsigned char{
+    SUPER_NONE,             /// Not fused, a single instruction
+    SUPER_LOAD_STORE,       /// LOAD x; STORE z
+    SUPER_LOAD_ADD_STORE,   /// LOAD x; ADD y; STORE z
+    SUPER_LOAD_SUB_STORE,   /// LOAD x; SUB y; STORE z
+    SUPER_DEC_BRANCH,       /// LOAD x; SUB y; STORE z; BRANCHGT t
+    SUPER_LOOP,             /// A counted loop, whole iterations run in bulk by a LoopPlan
+    SUPER_COUNT             /// Number of superinstructions, not a real one
+};
+
+/// Number of instructions between two checks of the clock when a run has a time limit.
+const unsigned long long WATCHDOG_SLICE = 65536;
+
+/// NoProbe struct
+/* Instrumentation policy of the engines that does nothing.
+ * The engines are templates on the probe, so an uninstrumented run compiles to the same code
+ * as before: every call below is inlined away. The Profiler has the same member functions.
+ */
+struct NoProbe{
+    void executed(int, Opcode){}    /// An instruction at the address was dispatched
+    void failed(int, Opcode){}      /// The dispatched instruction stopped the program without completing
+    void branch(int, int, bool){}   /// The JUMP or BRANCHGT at the address to the target was taken or not
+    void memoryRead(int){}          /// A data word was read
+    void memoryWrite(int, int){}    /// A value was written to the address
+    void accumulator(int){}         /// LOAD, ADD or SUB set the accumulator to the value
+};
+
+class Profiler;
+class ProgramAnalysis;
+
+/// ThreadedOp struct
+/* One pre-decoded instruction of the threaded engine. */
+struct ThreadedOp{
+    const void* handler;    /// Address of the handler that executes the instruction (GCC/Clang)
+    int operand;            /// Address or constant
+    Opcode op;              /// Opcode, used for dispatch when computed goto is not available
+    Superinstruction super; /// The fused sequence that starts here, the operands are in the next cells
+    bool invalid;           /// The address operand is outside the memory, the handler reports the error
+    bool looped;            /// The cell is in the body of a counted loop of a LoopPlan
+};
+
 /// ControlUnit class
 class ControlUnit: public ProcessingUnit, public MemoryUnit, public IOUnit{
-    int PC=0;               /// Program Counter, indicates the next instruction address
-    Instruction* IR=0;      /// Stores the current instruction to be executed
+    int PC=0;                   /// Program Counter, indicates the next instruction address
+    Cell IR{0, OP_EMPTY};       /// Stores the current instruction to be executed
+    Instruction* view=nullptr;  /// Instruction view of the last fetched cell
+    Engine engine;              /// The engine that executes cycle()
+    std::vector<ThreadedOp> code;           /// Pre-decoded program of the threaded engine
+    unsigned long long codeWrites=0;        /// Write counter of the memory when code was decoded
+    const void* codeTable=nullptr;          /// Handler table of the engine instance the code points into
+    bool fusion=false;                      /// Fuse common sequences into superinstructions
+    bool loopAcceleration=false;            /// Run counted loops in bulk
+    std::vector<LoopPlan> loops;            /// The counted loops of the decoded code
+    std::vector<int> loopAt;                /// Index of the loop that starts at every address, -1 for none
+    std::vector<int> loopState;             /// Slots of the running loop and room for their next values
+    unsigned long long eliminatedInstructions=0;    /// Dispatches saved by superinstructions
+    double timeLimit=0;                     /// Wall-clock limit of one run in seconds, 0 for none
+    Arithmetic arithmetic=ARITH_WRAP;       /// Overflow behaviour of ADD and SUB
+
+    /// Decodes the memory into the code of the threaded engine.
+    void decode();
+
+    /// Finds the sequences of the decoded code that can run as superinstructions.
+    /// @param analysis - the analysis of the memory that was decoded
+    void fuse(const ProgramAnalysis& analysis);
+
+    /// Finds the counted loops of the decoded code and marks their first cells.
+    /// @param analysis - the analysis of the memory that was decoded
+    void findLoops(const ProgramAnalysis& analysis);
+
+    /// Executes at most maxSteps instructions with the engine, the word width and the arithmetic of the ControlUnit.
+    /// @param maxSteps - number of instructions to execute
+    /// @param probe - instrumentation policy
+    /// @return the status and the number of executed instructions
+    template <class Probe>
+    RunResult runEngine(unsigned long long maxSteps, Probe& probe);
+
+    /// Executes at most maxSteps instructions with the engine and the arithmetic of the ControlUnit.
+    /// @param maxSteps - number of instructions to execute
+    /// @param probe - instrumentation policy
+    /// @return the status and the number of executed instructions
+    template <class Probe, class Word>
+    RunResult runWords(unsigned long long maxSteps, Probe& probe);
+
+    /// Executes at most maxSteps instructions by fetching and decoding the memory cells.
+    /// @param maxSteps - number of instructions to execute
+    /// @param probe - instrumentation policy
+    /// @return the status and the number of executed instructions
+    template <class Probe, class Arith, class Word>
+    RunResult runSwitch(unsigned long long maxSteps, Probe& probe);
+
+    /// Executes at most maxSteps instructions with the threaded engine.
+    /// @param maxSteps - number of instructions to execute
+    /// @param probe - instrumentation policy
+    /// @return the status and the number of executed instructions
+    template <class Probe, class Arith, class Word>
+    RunResult runThreaded(unsigned long long maxSteps, Probe& probe);
+
+    /// Executes a single instruction cell on the current state.
+    /// @param instr - the instruction to execute
+    /// @param address - where the instruction was fetched from
+    /// @param probe - instrumentation policy
+    /// @return STATUS_RUNNING if the program can continue
+    template <class Probe, class Arith, class Word>
+    Status step(Cell instr, int address, Probe& probe);
+
+    /// Executes a single instruction cell with the arithmetic of the ControlUnit.
+    /// @param instr - the instruction to execute
+    /// @return STATUS_RUNNING if the program can continue
+    template <class Word>
+    Status stepWords(Cell instr);
+
+    /// Sets the registers and the memory of a snapshot, the input is not touched.
+    /// @param state - the snapshot to restore
+    void restoreMachine(const Snapshot& state);
 public:
     /// Constructor.
     /// @param filename - the file to read
     /// @param os - the stream to write to
     /// @param is - the stream to read from
-    ControlUnit(std::string filename, std::ostream& os=std::cout, std::istream& is=std::cin):MemoryUnit(filename), IOUnit(os, is){}
+    /// @param engine - the engine that executes the program
+    ControlUnit(std::string filename, std::ostream& os=std::cout, std::istream& is=std::cin, Engine engine=ENGINE_SWITCH)
+        :MemoryUnit(filename), IOUnit(os, is), engine(engine){}
+
+    /// Constructor.
+    /// Runs a program image that may be shared with other ControlUnits.
+    /// @param image - the loaded program
+    /// @param os - the stream to write to
+    /// @param is - the stream to read from
+    /// @param engine - the engine that executes the program
+    ControlUnit(std::shared_ptr<const ProgramImage> image, std::ostream& os=std::cout, std::istream& is=std::cin, Engine engine=ENGINE_SWITCH)
+        :MemoryUnit(image), IOUnit(os, is), engine(engine){}
+
+    /// Constructor.
+    /// READ takes the numbers from a NumberReader instead of a stream.
+    /// @param filename - the file to read
+    /// @param os - the stream to write to
+    /// @param reader - the input source, it must live as long as the ControlUnit
+    /// @param engine - the engine that executes the program
+    ControlUnit(std::string filename, std::ostream& os, NumberReader& reader, Engine engine=ENGINE_SWITCH)
+        :MemoryUnit(filename), IOUnit(os, reader), engine(engine){}
+
+    /// Constructor.
+    /// Runs a shared program image, READ takes the numbers from a NumberReader.
+    /// @param image - the loaded program
+    /// @param os - the stream to write to
+    /// @param reader - the input source, it must live as long as the ControlUnit
+    /// @param engine - the engine that executes the program
+    ControlUnit(std::shared_ptr<const ProgramImage> image, std::ostream& os, NumberReader& reader, Engine engine=ENGINE_SWITCH)
+        :MemoryUnit(image), IOUnit(os, reader), engine(engine){}
+
+    /// Constructor.
+    /// Continues a snapshot with other streams: a fork of the machine.
+    /// The memory is shared with the snapshot until it is written.
+    /// @param state - the snapshot to continue
+    /// @param os - the stream to write to
+    /// @param is - the stream to read from, it is read from its current position
+    /// @param engine - the engine that executes the program
+    ControlUnit(const Snapshot& state, std::ostream& os, std::istream& is, Engine engine=ENGINE_SWITCH)
+        :MemoryUnit(state.image), IOUnit(os, is), engine(engine){ restoreMachine(state); }
+
+    /// Get the engine.
+    /// @return the engine chosen at construction
+    Engine getEngine(){ return engine; }
+
+    /// Turns the superinstruction fusion of the threaded engine on or off.
+    /// The program is decoded again before the next run.
+    /// @param on - true to fuse common instruction sequences
+    void setFusion(bool on){ fusion = on; code.clear(); }
+
+    /// Turns the loop acceleration of the threaded engine on or off.
+    /// A counted loop without I/O that does not modify itself runs whole iterations at once,
+    /// with the same result, steps and step limit as the single instructions. The runs with
+    /// a probe or with a checked or saturating arithmetic execute every instruction.
+    /// The program is decoded again before the next run.
+    /// @param on - true to accelerate the loops
+    void setLoopAcceleration(bool on){ loopAcceleration = on; code.clear(); }
+
+    /// Get the number of instructions that were executed as part of a superinstruction
+    /// without a dispatch of their own.
+    /// @return the number of eliminated dispatches
+    unsigned long long getEliminatedInstructions(){ return eliminatedInstructions; }
+
+    /// Limits the wall-clock time of every run.
+    /// The clock is checked once per WATCHDOG_SLICE instructions, so the engines run at full speed.
+    /// A waiting READ is not interrupted.
+    /// @param seconds - time limit of one run, 0 for no limit
+    void setTimeLimit(double seconds){ timeLimit = seconds; }
+
+    /// Get the time limit.
+    /// @return the time limit of one run in seconds, 0 if there is none
+    double getTimeLimit(){ return timeLimit; }
+
+    /// Chooses what ADD and SUB do when the result does not fit in a word.
+    /// Every choice has its own compiled engines, ARITH_WRAP runs without overflow checks.
+    /// @param mode - the overflow behaviour
+    void setArithmetic(Arithmetic mode){ arithmetic = mode; }
+
+    /// Get the overflow behaviour.
+    /// @return the arithmetic of ADD and SUB
+    Arithmetic getArithmetic(){ return arithmetic; }
+
+    /// Chooses the type of the accumulator and the variables.
+    /// Every width has its own compiled engines, the overflow of ADD and SUB depends on the width.
+    /// READ still takes int numbers. The JIT and the native code run 64-bit words with run(),
+    /// the trace recorder and the time travel debugger need 32-bit words.
+    /// Going back to 32-bit words keeps the low 32 bits of every value.
+    /// @param width - the word type
+    void setWordWidth(WordWidth width){ setWideWords(width == WORD_INT64); setWideACC(width == WORD_INT64 ? getWideAcc() : getAcc()); }
+
+    /// Get the word type.
+    /// @return the type of the accumulator and the variables
+    WordWidth getWordWidth(){ return hasWideWords() ? WORD_INT64 : WORD_INT32; }
 
     /// Set PC.
     /// @param val - the next instruction address
@@ -123,12 +754,62 @@ public:
     int getPC() {return PC;}
 
     /// Fetches the instruction based on the program counter and executes it.
+    /// Throws the status message on EXIT and on errors.
     void cycle();
 
+    /// Runs the program until it halts, fails, executes maxSteps instructions or runs out of time.
+    /// The state stays consistent, a program stopped by the step or the time limit can be continued.
+    /// @param maxSteps - maximum number of instructions to execute
+    /// @return the status and the number of executed instructions
+    RunResult run(unsigned long long maxSteps=~0ULL);
+
+    /// Runs the program like run(), and counts every executed instruction in the profiler.
+    /// The profiler dumps its report when the program halts.
+    /// @param profiler - collects the counters, they are kept between runs of the same memory
+    /// @param maxSteps - maximum number of instructions to execute
+    /// @return the status and the number of executed instructions
+    RunResult run(Profiler& profiler, unsigned long long maxSteps=~0ULL);
+
+    /// Runs the program with the engine chosen at construction and the given probe.
+    /// Instantiated for NoProbe, Profiler, TraceRecorder and TimeTravel.
+    /// Throws an exception if a TraceRecorder or a TimeTravel watches 64-bit words.
+    /// @param probe - instrumentation policy
+    /// @param maxSteps - maximum number of instructions to execute
+    /// @return the status and the number of executed instructions
+    template <class Probe>
+    RunResult runWith(Probe& probe, unsigned long long maxSteps);
+
+    /// Runs the program like run(), but stops before the first READ instruction.
+    /// Executes one instruction per engine call, it is meant for the prologue of a program.
+    /// @param maxSteps - maximum number of instructions to execute
+    /// @return STATUS_STEP_LIMIT if the next instruction is a READ or the budget ran out
+    RunResult runUntilRead(unsigned long long maxSteps=~0ULL);
+
+    /// Executes a single instruction cell on the current state.
+    /// Throws an exception on EXIT and on errors.
+    /// @param instr - the instruction to execute
+    void execute(Cell instr);
+
+    /// Saves the complete state: registers, memory and the position of the input.
+    /// The buffered output is written first. Only the pages written since the previous
+    /// snapshot are frozen, nothing is copied.
+    /// @return the snapshot
+    Snapshot snapshot();
+
+    /// Restores a snapshot of this program, also one made by another ControlUnit.
+    /// The input is rewound to the saved position if it moved since.
+    /// Throws an exception if the input can't be rewound.
+    /// @param state - the snapshot to restore
+    void restore(const Snapshot& state);
+
     /// Fetches the instruction from memory using the given address.
+    /// The returned view is owned by the ControlUnit and is valid until the next fetch.
     /// @param address - the instruction address
-    /// @return a pointer to the instruction
+    /// @return a pointer to the instruction, nullptr for an empty cell
     Instruction* fetch(int address);
+
+    /// Deletes the instruction view.
+    ~ControlUnit(){ delete view; }
 };
 
 #endif // CONTROLUNIT_H_INCLUDED
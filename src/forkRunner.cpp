@@ -0,0 +1,45 @@
+#include "forkRunner.h"
+#include "workPool.h"
+#include <sstream>
+
+/// The prologue reads nothing, its input stays empty.
+ForkRunner::ForkRunner(std::shared_ptr<const ProgramImage> image, unsigned threads, unsigned long long maxSteps)
+    : prologue{STATUS_NO_PROGRAM, 0}, threads(poolThreads(threads)), maxSteps(maxSteps)
+{
+    std::istringstream input;
+    std::ostringstream output;
+    ControlUnit CU(image, output, input, ENGINE_THREADED);
+    prologue = CU.runUntilRead(maxSteps);
+    prefix = CU.snapshot();
+    prologueOutput = output.str();
+}
+
+/// A program that stopped before reading anything gives the same result for every input.
+std::vector<ForkResult> ForkRunner::run(const std::vector<std::string> &inputs) const
+{
+    std::vector<ForkResult> results(inputs.size());
+    parallelFor(inputs.size(), threads, [&](size_t fork)
+    {
+        ForkResult &result = results[fork];
+        result.input = inputs[fork];
+        if (prologue.status != STATUS_STEP_LIMIT)
+        {
+            result.status = prologue.status;
+            result.steps = prologue.steps;
+            result.output = prologueOutput;
+            return;
+        }
+        std::istringstream input(inputs[fork]);
+        std::ostringstream output;
+        output << prologueOutput;
+        ControlUnit CU(prefix, output, input, ENGINE_THREADED);
+        CU.setFusion(true);
+        CU.setLoopAcceleration(true);
+        CU.setBuffered(true);
+        RunResult run = CU.run(maxSteps - prologue.steps);
+        result.status = run.status;
+        result.steps = prologue.steps + run.steps;
+        result.output = output.str();
+    });
+    return results;
+}
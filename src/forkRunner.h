@@ -0,0 +1,51 @@
+#ifndef FORKRUNNER_H_INCLUDED
+#define FORKRUNNER_H_INCLUDED
+
+#include "controlUnit.h"
+#include <string>
+#include <vector>
+
+/// ForkResult struct
+struct ForkResult{
+    std::string input;              /// Text read by the READ instructions of this fork
+    Status status;                  /// Why the program stopped
+    unsigned long long steps;       /// Executed instructions, including the shared prologue
+    std::string output;             /// Text written by the program, including the prologue
+};
+
+/// ForkRunner class
+/* Runs one program with many inputs without repeating their common part.
+ * The program runs once up to its first READ, then the machine is forked:
+ * every input continues from that snapshot on its own ControlUnit, in parallel.
+ * The forks share the program image and the snapshot pages, a fork copies only the pages it writes.
+ * The results are the same as the results of separate runs from the start.
+ */
+class ForkRunner{
+    Snapshot prefix;                /// State before the first READ
+    RunResult prologue;             /// Result of the run up to the first READ
+    std::string prologueOutput;     /// Text written before the first READ
+    unsigned threads;               /// Number of worker threads
+    unsigned long long maxSteps;    /// Step budget of a whole run, including the prologue
+public:
+    /// Constructor.
+    /// Runs the prologue of the program with the threaded engine.
+    /// @param image - the program, nullptr gives STATUS_NO_PROGRAM for every input
+    /// @param threads - number of worker threads, 0 uses every core
+    /// @param maxSteps - step budget of a whole run, including the prologue
+    ForkRunner(std::shared_ptr<const ProgramImage> image, unsigned threads=0, unsigned long long maxSteps=100000000ULL);
+
+    /// Get the result of the prologue.
+    /// @return STATUS_STEP_LIMIT if the program stopped before a READ, the end of the program otherwise
+    const RunResult& getPrologue() const { return prologue; }
+
+    /// Get the state before the first READ.
+    /// @return the snapshot every fork starts from
+    const Snapshot& getPrefix() const { return prefix; }
+
+    /// Runs a fork for every input in parallel.
+    /// @param inputs - text read by the READ instructions, one per fork
+    /// @return the results in the order of the inputs
+    std::vector<ForkResult> run(const std::vector<std::string>& inputs) const;
+};
+
+#endif // FORKRUNNER_H_INCLUDED
@@ -1,11 +1,32 @@
 #include "instruction.h"
 #include "controlUnit.h"
 
+const char* opcodeName(Opcode op){
+    static const char* const names[OP_COUNT] = {
+        "EMPTY", "LOAD", "STORE", "ADD", "SUB", "READ", "PRINT", "JUMP", "BRANCHGT", "VAR", "EXIT"};
+    return op < OP_COUNT ? names[op] : "?";
+}
+
+Instruction* Instruction::create(Cell cell){
+    // Builds the matching derived class for the cell's opcode.
+    switch(cell.op){
+        case OP_LOAD:     return new LOAD(cell.operand);
+        case OP_STORE:    return new STORE(cell.operand);
+        case OP_ADD:      return new ADD(cell.operand);
+        case OP_SUB:      return new SUB(cell.operand);
+        case OP_READ:     return new READ(cell.operand);
+        case OP_PRINT:    return new PRINT(cell.operand);
+        case OP_JUMP:     return new JUMP(cell.operand);
+        case OP_BRANCHGT: return new BRANCHGT(cell.operand);
+        case OP_VAR:      return new VAR(cell.operand);
+        case OP_EXIT:     return new EXIT(cell.operand);
+        default:          return nullptr;
+    }
+}
+
 void LOAD::executeby(ControlUnit& CU){
-    // Fetches the instruction from memory using the operand address
-    // and loads its operand into the accumulator.
-    Instruction* var = CU.fetch(getOperand());
-    CU.setACC(var->getOperand());
+    // Loads the operand of the cell at the operand address into the accumulator.
+    CU.execute(toCell());
 }
 
 Instruction* LOAD::clone(){
@@ -14,11 +35,7 @@ Instruction* LOAD::clone(){
 
 void STORE::executeby(ControlUnit& CU){
     // Stores the value from the accumulator into memory at the operand address.
-    CU.setMAR(getOperand());
-    int val = CU.getAcc();
-    VAR var(val);
-    CU.setMDR(var.clone());
-    CU.writeEnable(); // Enables the memory write operation
+    CU.execute(toCell());
 }
 
 Instruction* STORE::clone(){
@@ -27,8 +44,7 @@ Instruction* STORE::clone(){
 
 void ADD::executeby(ControlUnit& CU){
     // Adds the value from memory at the operand address to the accumulator.
-    Instruction* var = CU.fetch(getOperand());
-    CU.add(var->getOperand());
+    CU.execute(toCell());
 }
 
 Instruction* ADD::clone(){
@@ -37,8 +53,7 @@ Instruction* ADD::clone(){
 
 void SUB::executeby(ControlUnit& CU){
     // Subtracts the value from memory at the operand address from the accumulator.
-    Instruction* var = CU.fetch(getOperand());
-    CU.sub(var->getOperand());
+    CU.execute(toCell());
 }
 
 Instruction* SUB::clone(){
@@ -47,11 +62,7 @@ Instruction* SUB::clone(){
 
 void READ::executeby(ControlUnit& CU){
     // Reads a value from input and stores it at the operand address in memory.
-    int val = CU.read();
-    VAR var(val);
-    CU.setMAR(getOperand());
-    CU.setMDR(var.clone());
-    CU.writeEnable(); // Enables the memory write operation
+    CU.execute(toCell());
 }
 
 Instruction* READ::clone(){
@@ -60,8 +71,7 @@ Instruction* READ::clone(){
 
 void PRINT::executeby(ControlUnit& CU){
     // Prints the value stored in memory at the operand address.
-    Instruction* var = CU.fetch(getOperand());
-    CU.print(var->getOperand());
+    CU.execute(toCell());
 }
 
 Instruction* PRINT::clone(){
@@ -69,10 +79,8 @@ Instruction* PRINT::clone(){
 }
 
 void JUMP::executeby(ControlUnit& CU){
-    // Checks if the operand is within valid memory bounds and sets the Program Counter (PC).
-    if(getOperand() < 0 || static_cast<size_t>(getOperand()) >= CU.getStorage())
-        throw "Can't jump here\n"; // Invalid jump address
-    CU.setPC(getOperand());
+    // Sets the Program Counter (PC), throws if the operand is outside the memory.
+    CU.execute(toCell());
 }
 
 Instruction* JUMP::clone(){
@@ -80,21 +88,28 @@ Instruction* JUMP::clone(){
 }
 
 void BRANCHGT::executeby(ControlUnit& CU){
-    // Checks if the operand is within valid memory bounds and conditionally jumps if the accumulator > 0.
-    if(getOperand() < 0 || static_cast<size_t>(getOperand()) >= CU.getStorage())
-        throw "Can't jump here\n"; // Invalid jump address
-    if(CU.getAcc() > 0)  // Only jumps if the accumulator's value is greater than 0
-        CU.setPC(getOperand());
+    // Conditionally jumps if the accumulator > 0, throws if the operand is outside the memory.
+    CU.execute(toCell());
 }
 
 Instruction* BRANCHGT::clone(){
     return new BRANCHGT(*this);
 }
 
+void VAR::executeby(ControlUnit& CU){
+    // A variable can't be executed, the ControlUnit throws.
+    CU.execute(toCell());
+}
+
 Instruction* VAR::clone(){
     return new VAR(*this);
 }
 
+void EXIT::executeby(ControlUnit& CU){
+    // Terminates the program, the ControlUnit throws.
+    CU.execute(toCell());
+}
+
 Instruction* EXIT::clone(){
     return new EXIT(*this);
 }
@@ -5,23 +5,70 @@
 
 class ControlUnit;
 
+/// Opcode enum
+/* The memory stores every instruction as a fixed-size Cell (opcode + operand).
+ * OP_EMPTY marks a cell that was never written, it behaves like a no-op when executed.
+ */
+enum Opcode : unsigned char{
+    OP_EMPTY = 0,
+    OP_LOAD,
+    OP_STORE,
+    OP_ADD,
+    OP_SUB,
+    OP_READ,
+    OP_PRINT,
+    OP_JUMP,
+    OP_BRANCHGT,
+    OP_VAR,
+    OP_EXIT,
+    OP_COUNT            /// Number of opcodes, not a real instruction
+};
+
+/// Cell struct
+/* One memory cell of the compact memory representation. */
+struct Cell{
+    int operand;        /// Address or constant value
+    Opcode op;          /// What kind of instruction is stored in the cell
+};
+
+/// Gives the mnemonic of an opcode, as it is written in the program files.
+/// @param op - the opcode
+/// @return the name, "EMPTY" for an empty cell
+const char* opcodeName(Opcode op);
+
 /* To write specific code, the derived classes of Instruction should be used.
- * Each derived class has a specific task,
- * and these tasks are implemented in the executeby functions.
+ * Each derived class has a specific task.
+ * The ControlUnit executes Cells directly from its memory, the Instruction classes
+ * are only a compatibility view of a Cell: their executeby functions forward to the ControlUnit.
 */
 
 /// Abstract Instruction class
 class Instruction{
     int operand;        /// The instruction's address or constant value in case of VAR instruction.
+    Opcode op;          /// The opcode of the instruction
 public:
     /// Constructor.
+    /// @param op - opcode of the instruction
     /// @param operand - address or constant
-    Instruction(int operand):operand(operand){}
+    Instruction(Opcode op, int operand):operand(operand), op(op){}
 
     /// Get the operand.
     /// @return instruction's address or constant
     int getOperand(){return operand;}
 
+    /// Get the opcode.
+    /// @return the opcode of the instruction
+    Opcode getOpcode(){return op;}
+
+    /// Converts the instruction to a memory cell.
+    /// @return the cell holding the opcode and the operand
+    Cell toCell(){ return Cell{operand, op}; }
+
+    /// Creates a dynamic instruction view of a memory cell.
+    /// @param cell - the cell to convert
+    /// @return pointer to the created instance, nullptr for an empty cell
+    static Instruction* create(Cell cell);
+
     /// Executes the appropriate instruction.
     /// @param CU - Control Unit to execute the instruction
     virtual void executeby(ControlUnit& CU) = 0;
@@ -39,7 +86,7 @@ class LOAD: public Instruction{
 public:
     /// Constructor.
     /// @param operand - the address from which the data will be loaded
-    LOAD(int operand): Instruction(operand){}
+    LOAD(int operand): Instruction(OP_LOAD, operand){}
 
     /// Fetches the operand at the operand address from the Control Unit,
     /// then loads it into the accumulator.
@@ -59,10 +106,10 @@ class STORE: public Instruction{
 public:
     /// Constructor.
     /// @param operand - the address where the data will be stored
-    STORE(int operand): Instruction(operand){}
+    STORE(int operand): Instruction(OP_STORE, operand){}
 
-    /// Fetches the value from the accumulator, creates a VAR object,
-    /// and stores it at the operand address.
+    /// Fetches the value from the accumulator and stores it
+    /// as a variable at the operand address.
     /// @param CU - Control Unit
     void executeby(ControlUnit& CU);
 
@@ -79,7 +126,7 @@ class ADD: public Instruction{
 public:
     /// Constructor.
     /// @param operand - the address of the constant to be added to the accumulator
-    ADD(int operand): Instruction(operand){}
+    ADD(int operand): Instruction(OP_ADD, operand){}
 
     /// Adds the constant at the operand address to the accumulator.
     /// @param CU - Control Unit
@@ -98,7 +145,7 @@ class SUB: public Instruction{
 public:
     /// Constructor.
     /// @param operand - the address of the constant to be subtracted from the accumulator
-    SUB(int operand): Instruction(operand){}
+    SUB(int operand): Instruction(OP_SUB, operand){}
 
     /// Subtracts the constant at the operand address from the accumulator.
     /// @param CU - Control Unit
@@ -117,7 +164,7 @@ class READ: public Instruction{
 public:
     /// Constructor
     /// @param operand - address where the data will be saved
-    READ(int operand): Instruction(operand){}
+    READ(int operand): Instruction(OP_READ, operand){}
 
     /// Reads the input value and stores it as a constant at the operand address.
     /// @param CU - Control Unit
@@ -136,7 +183,7 @@ class PRINT: public Instruction{
 public:
     /// Constructor
     /// @param operand - address whose value needs to be printed
-    PRINT(int operand): Instruction(operand){}
+    PRINT(int operand): Instruction(OP_PRINT, operand){}
 
     /// Fetches the data at the operand address and prints its value.
     /// @param CU - Control Unit
@@ -155,7 +202,7 @@ class JUMP: public Instruction{
 public:
     /// Constructor.
     /// @param operand - address of the next instruction to be executed
-    JUMP(int operand): Instruction(operand){}
+    JUMP(int operand): Instruction(OP_JUMP, operand){}
 
     /// Sets the Program Counter (PC) to the operand's value.
     /// Throws an exception if the jump target is outside the memory range.
@@ -175,7 +222,7 @@ class BRANCHGT: public Instruction{
 public:
     /// Constructor.
     /// @param operand - address of the next instruction to be executed
-    BRANCHGT(int operand): Instruction(operand){}
+    BRANCHGT(int operand): Instruction(OP_BRANCHGT, operand){}
 
     /// If the accumulator's value is greater than zero, sets the Program Counter (PC)
     /// to the operand's value.
@@ -197,11 +244,11 @@ class VAR: public Instruction{
 public:
     /// Constructor
     /// @param operand - constant value
-    VAR(int operand): Instruction(operand){}
+    VAR(int operand): Instruction(OP_VAR, operand){}
 
     /// Cannot execute a variable instruction. Throws an exception.
     /// @param CU - Control Unit
-    void executeby(ControlUnit& CU){ throw "Tried to execute a variable!\n";}
+    void executeby(ControlUnit& CU);
 
     /// Creates a dynamic instance of VAR.
     /// @return pointer to the created instance
@@ -216,11 +263,11 @@ class EXIT: public Instruction{
 public:
     /// Constructor
     /// @param operand - constant value
-    EXIT(int operand): Instruction(operand){}
+    EXIT(int operand): Instruction(OP_EXIT, operand){}
 
     /// Terminates the program. Throws an exception.
     /// @param CU - Control Unit
-    void executeby(ControlUnit& CU){ throw "Code exited\n";}
+    void executeby(ControlUnit& CU);
 
     /// Creates a dynamic instance of EXIT.
     /// @return pointer to the created instance
@@ -0,0 +1,479 @@
+#include "jit.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_X86_64
+#endif
+
+// The templates address the context through rbx with these offsets
+static_assert(offsetof(JitContext, memory) == 0, "JitContext layout");
+static_assert(offsetof(JitContext, compiled) == 8, "JitContext layout");
+static_assert(offsetof(JitContext, entries) == 16, "JitContext layout");
+static_assert(offsetof(JitContext, left) == 24, "JitContext layout");
+static_assert(offsetof(JitContext, acc) == 32, "JitContext layout");
+static_assert(offsetof(JitContext, pc) == 36, "JitContext layout");
+static_assert(offsetof(JitContext, address) == 40, "JitContext layout");
+static_assert(offsetof(JitContext, io) == 48, "JitContext layout");
+static_assert(offsetof(JitContext, read) == 56, "JitContext layout");
+static_assert(offsetof(JitContext, print) == 64, "JitContext layout");
+static_assert(sizeof(Cell) == 8 && offsetof(Cell, op) == 4, "Cell layout");
+
+/// READ of the machine code.
+static int jitRead(void *io)
+{
+    return static_cast<ControlUnit *>(io)->read();
+}
+
+/// PRINT of the machine code.
+static void jitPrint(void *io, int value)
+{
+    static_cast<ControlUnit *>(io)->print(value);
+}
+
+/* Register use of the machine code, every register survives the calls of READ and PRINT:
+ *   rbx - the JitContext          rbp - the accumulator (ebp)
+ *   r12 - the memory              r13 - the compiled counts
+ *   r14 - the step budget         r15 - the entry table
+ * The host calls the entry code with the context and the block, it saves the registers,
+ * loads them from the context and jumps to the block. Every exit stores the PC, puts the
+ * JitExit into eax and jumps to the common epilogue, which stores the accumulator and the
+ * budget and returns to the host.
+ */
+static const unsigned char JIT_ENTRY[] = {
+    0x53,                           // push rbx
+    0x55,                           // push rbp
+    0x41, 0x54,                     // push r12
+    0x41, 0x55,                     // push r13
+    0x41, 0x56,                     // push r14
+    0x41, 0x57,                     // push r15
+    0x48, 0x83, 0xEC, 0x08,         // sub rsp, 8 (the calls need a 16 byte aligned stack)
+    0x48, 0x89, 0xFB,               // mov rbx, rdi
+    0x4C, 0x8B, 0x63, 0x00,         // mov r12, [rbx + memory]
+    0x4C, 0x8B, 0x6B, 0x08,         // mov r13, [rbx + compiled]
+    0x4C, 0x8B, 0x7B, 0x10,         // mov r15, [rbx + entries]
+    0x4C, 0x8B, 0x73, 0x18,         // mov r14, [rbx + left]
+    0x8B, 0x6B, 0x20,               // mov ebp, [rbx + acc]
+    0xFF, 0xE6};                    // jmp rsi
+static const unsigned char JIT_EPILOGUE[] = {
+    0x89, 0x6B, 0x20,               // mov [rbx + acc], ebp
+    0x4C, 0x89, 0x73, 0x18,         // mov [rbx + left], r14
+    0x48, 0x83, 0xC4, 0x08,         // add rsp, 8
+    0x41, 0x5F,                     // pop r15
+    0x41, 0x5E,                     // pop r14
+    0x41, 0x5D,                     // pop r13
+    0x41, 0x5C,                     // pop r12
+    0x5D,                           // pop rbp
+    0x5B,                           // pop rbx
+    0xC3};                          // ret
+
+/// Entry code of the machine code.
+typedef int (*JitEntry)(JitContext *, const void *);
+
+/// JitEmitter struct
+/* The machine code of a block, built before it is copied to its place in the executable memory. */
+struct JitEmitter{
+    std::vector<unsigned char> bytes;   /// The code
+    const unsigned char *origin;        /// Where the first byte will be
+    const unsigned char *epilogue;      /// The common exit
+    int storage;                        /// Memory size, for the jump targets
+
+    void put(std::initializer_list<unsigned char> list){ bytes.insert(bytes.end(), list); }
+    void u32(unsigned value){
+        for (int i = 0; i < 4; i++)
+            bytes.push_back((unsigned char)(value >> (8 * i)));
+    }
+    /// Operand of an instruction on r12 or r13: the offset of a cell or its opcode.
+    void disp(long long value){ u32((unsigned)value); }
+
+    /// Returns to the host, 17 bytes.
+    void leave(int pc, JitExit reason){
+        put({0xC7, 0x43, 0x24});    // mov dword [rbx + pc], pc
+        u32((unsigned)pc);
+        put({0xB8});                // mov eax, reason
+        u32((unsigned)reason);
+        put({0xE9});                // jmp epilogue
+        u32((unsigned)(epilogue - (origin + bytes.size() + 4)));
+    }
+
+    /// Size of the code of goTo().
+    int goToSize(int target) const { return target >= 0 && target < storage ? 31 : 17; }
+
+    /// Continues at the compiled block of the target, or returns to the host if it has none.
+    void goTo(int target){
+        if (target >= 0 && target < storage)
+        {
+            put({0x49, 0x8B, 0x87});    // mov rax, [r15 + target * 8]
+            disp(target * 8LL);
+            put({0x48, 0x85, 0xC0});    // test rax, rax
+            put({0x74, 0x02});          // je +2
+            put({0xFF, 0xE0});          // jmp rax
+        }
+        leave(target, JIT_EXIT_CONTINUE);
+    }
+
+    /// Marks a written cell as a variable and leaves if the cell is compiled.
+    /// @param address - the written cell
+    /// @param next - the address after the writing instruction
+    /// @param rest - the steps of the block after the writing instruction
+    void written(int address, int next, int rest){
+        put({0x41, 0xC6, 0x84, 0x24});  // mov byte [r12 + address * 8 + 4], OP_VAR
+        disp(address * 8LL + 4);
+        put({OP_VAR});
+        put({0x41, 0x80, 0xBD});        // cmp byte [r13 + address], 0
+        disp(address);
+        put({0x00});
+        put({0x74, 0x1F});              // je +31
+        put({0x49, 0x81, 0xC6});        // add r14, rest (the budget of the cells that don't run)
+        u32((unsigned)rest);
+        put({0xC7, 0x43, 0x28});        // mov dword [rbx + address], address
+        u32((unsigned)address);
+        leave(next, JIT_EXIT_WRITE);
+    }
+};
+
+JitRunner::JitRunner(ControlUnit &CU, unsigned hotCount, size_t codeSize)
+    : CU(CU), hotCount(std::max(hotCount, 1u)), codeSize(codeSize)
+{
+    size_t storage = CU.getStorage();
+    for (size_t i = 0; i < storage; i++)
+        memory.push_back(CU.cellAt(static_cast<int>(i)));
+    compiled.assign(storage, 0);
+    entries.assign(storage, nullptr);
+    counters.assign(storage, 0);
+#ifdef JIT_X86_64
+    if (storage >= (1u << 27))
+        return;  // The offsets of the cells are 32 bit displacements
+    if (codeSize < sizeof(JIT_ENTRY) + sizeof(JIT_EPILOGUE))
+        return;
+    void *region = mmap(nullptr, codeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return;
+    code = static_cast<unsigned char *>(region);
+    std::memcpy(code, JIT_ENTRY, sizeof(JIT_ENTRY));
+    std::memcpy(code + sizeof(JIT_ENTRY), JIT_EPILOGUE, sizeof(JIT_EPILOGUE));
+    epilogue = code + sizeof(JIT_ENTRY);
+    used = sizeof(JIT_ENTRY) + sizeof(JIT_EPILOGUE);
+    if (mprotect(code, codeSize, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, codeSize);
+        code = nullptr;
+    }
+#endif
+}
+
+JitRunner::~JitRunner()
+{
+#ifdef JIT_X86_64
+    if (code != nullptr)
+        munmap(code, codeSize);
+#endif
+}
+
+bool JitRunner::isSupported()
+{
+#ifdef JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// A block ends after a jump or EXIT, or before a cell that can't run without an error.
+/* The block takes its steps from the budget at its start, or returns to the host if they
+ * don't fit: the host runs the last instructions of the budget one by one.
+ */
+void JitRunner::compile(int first)
+{
+#ifdef JIT_X86_64
+    if (code == nullptr)
+        return;
+    int storage = static_cast<int>(memory.size());
+    int last = first - 1;
+    for (int a = first; a < storage && a - first < JIT_MAX_BLOCK; a++)
+    {
+        Cell cell = memory[a];
+        bool inside = cell.operand >= 0 && cell.operand < storage;
+        bool runs = cell.op == OP_EMPTY || cell.op == OP_EXIT || (cell.op >= OP_LOAD && cell.op <= OP_BRANCHGT && inside);
+        if (!runs || compiled[a] == 255)
+            break;
+        last = a;
+        if (cell.op == OP_JUMP || cell.op == OP_BRANCHGT || cell.op == OP_EXIT)
+            break;
+    }
+    if (last < first)
+        return;
+
+    JitEmitter e{{}, code + used, static_cast<const unsigned char *>(epilogue), storage};
+    int length = last - first + 1;
+    e.put({0x49, 0x81, 0xFE});  // cmp r14, length
+    e.u32((unsigned)length);
+    e.put({0x73, 0x11});        // jae +17
+    e.leave(first, JIT_EXIT_CONTINUE);
+    e.put({0x49, 0x81, 0xEE});  // sub r14, length
+    e.u32((unsigned)length);
+    bool ends = false;
+    for (int a = first; a <= last; a++)
+    {
+        int x = memory[a].operand;
+        switch (memory[a].op)
+        {
+        case OP_LOAD:
+            e.put({0x41, 0x8B, 0xAC, 0x24});    // mov ebp, [r12 + x * 8]
+            e.disp(x * 8LL);
+            break;
+        case OP_ADD:
+            e.put({0x41, 0x03, 0xAC, 0x24});    // add ebp, [r12 + x * 8]
+            e.disp(x * 8LL);
+            break;
+        case OP_SUB:
+            e.put({0x41, 0x2B, 0xAC, 0x24});    // sub ebp, [r12 + x * 8]
+            e.disp(x * 8LL);
+            break;
+        case OP_STORE:
+            e.put({0x41, 0x89, 0xAC, 0x24});    // mov [r12 + x * 8], ebp
+            e.disp(x * 8LL);
+            e.written(x, a + 1, last - a);
+            break;
+        case OP_READ:
+            e.put({0x48, 0x8B, 0x7B, 0x30});    // mov rdi, [rbx + io]
+            e.put({0xFF, 0x53, 0x38});          // call [rbx + read]
+            e.put({0x41, 0x89, 0x84, 0x24});    // mov [r12 + x * 8], eax
+            e.disp(x * 8LL);
+            e.written(x, a + 1, last - a);
+            break;
+        case OP_PRINT:
+            e.put({0x48, 0x8B, 0x7B, 0x30});    // mov rdi, [rbx + io]
+            e.put({0x41, 0x8B, 0xB4, 0x24});    // mov esi, [r12 + x * 8]
+            e.disp(x * 8LL);
+            e.put({0xFF, 0x53, 0x40});          // call [rbx + print]
+            break;
+        case OP_JUMP:
+            e.goTo(x);
+            ends = true;
+            break;
+        case OP_BRANCHGT:
+            e.put({0x85, 0xED});                // test ebp, ebp
+            e.put({0x7E, (unsigned char)e.goToSize(x)});  // jle over the taken branch
+            e.goTo(x);
+            e.goTo(a + 1);
+            ends = true;
+            break;
+        case OP_EXIT:
+            e.leave(a + 1, JIT_EXIT_HALT);
+            ends = true;
+            break;
+        default:
+            break;  // Empty cells are skipped
+        }
+    }
+    if (!ends)
+        e.goTo(last + 1);
+    if (used + e.bytes.size() > codeSize)
+    {
+        if (blocks.empty())
+            return;  // The block does not fit in the empty memory either, it stays on tier 0
+        resetCode();
+        compile(first);  // The jumps of the code are relative to where it is written
+        return;
+    }
+
+    if (mprotect(code, codeSize, PROT_READ | PROT_WRITE) != 0)
+        return;
+    std::memcpy(code + used, e.bytes.data(), e.bytes.size());
+    mprotect(code, codeSize, PROT_READ | PROT_EXEC);
+    entries[first] = code + used;
+    used += e.bytes.size();
+    for (int a = first; a <= last; a++)
+        compiled[a]++;
+    blocks.push_back(JitBlock{first, last, true});
+    compilations++;
+#else
+    (void)first;
+#endif
+}
+
+void JitRunner::invalidate(int address)
+{
+    for (JitBlock &block : blocks)
+        if (block.valid && block.first <= address && address <= block.last)
+        {
+            block.valid = false;
+            entries[block.first] = nullptr;
+            for (int a = block.first; a <= block.last; a++)
+                compiled[a]--;
+            counters[block.first] = 0;  // It can be compiled again from the new cells
+            invalidations++;
+        }
+}
+
+/// Only called by the host, no machine code runs while the memory is reused.
+void JitRunner::resetCode()
+{
+    std::fill(entries.begin(), entries.end(), nullptr);
+    std::fill(compiled.begin(), compiled.end(), 0);
+    std::fill(counters.begin(), counters.end(), 0);  // The hot blocks are compiled again
+    blocks.clear();
+    used = sizeof(JIT_ENTRY) + sizeof(JIT_EPILOGUE);
+    codeResets++;
+}
+
+/// Tier 0 executes one instruction at a time on the memory of the run.
+/* The memory is copied from the ControlUnit at the start and the changed cells are copied
+ * back at the end. The blocks whose cells were changed between two runs are invalidated.
+ * An instruction that would fail is left to ControlUnit::run(), it stops right there.
+ * The budget is used down to the end of the slice, where the clock is read if there is a time limit.
+ */
+RunResult JitRunner::run(unsigned long long maxSteps)
+{
+    if (code == nullptr || CU.NotValidMemory() || CU.getArithmetic() != ARITH_WRAP || CU.getWordWidth() != WORD_INT32)
+        return CU.run(maxSteps);
+    int storage = static_cast<int>(memory.size());
+    for (int i = 0; i < storage; i++)
+    {
+        Cell cell = CU.cellAt(i);
+        bool changed = cell.op != memory[i].op || cell.operand != memory[i].operand;
+        memory[i] = cell;
+        if (changed && compiled[i] != 0)
+            invalidate(i);
+    }
+
+    int pc = CU.getPC();
+    int acc = CU.getAcc();
+    unsigned long long left = maxSteps;
+    bool watchdog = CU.getTimeLimit() > 0;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(CU.getTimeLimit()));
+    unsigned long long slice = watchdog && left > WATCHDOG_SLICE ? left - WATCHDOG_SLICE : 0;  // Budget left at the end of the slice
+    Status status = STATUS_STEP_LIMIT;
+    bool entered = true;    // The execution comes from a jump, a branch or the start
+    bool handOver = false;  // The instruction at pc fails
+    bool tight = false;     // The block at pc does not fit in the budget, tier 0 goes on
+    JitEntry enter = reinterpret_cast<JitEntry>(code);
+    JitContext context{memory.data(), compiled.data(), entries.data(), 0, 0, 0, 0, &CU, jitRead, jitPrint};
+    while (left > 0 && status == STATUS_STEP_LIMIT && !handOver)
+    {
+        if (left == slice)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                status = STATUS_TIMEOUT;
+                break;
+            }
+            slice = left > WATCHDOG_SLICE ? left - WATCHDOG_SLICE : 0;
+        }
+        if (pc < 0 || pc >= storage)
+        {
+            handOver = true;
+            break;
+        }
+        if (entries[pc] != nullptr && !tight)
+        {
+            context.left = left - slice;
+            context.acc = acc;
+            context.pc = pc;
+            int exit = enter(&context, entries[pc]);
+            left = slice + context.left;
+            acc = context.acc;
+            pc = context.pc;
+            if (exit == JIT_EXIT_HALT)
+                status = STATUS_HALTED;
+            else if (exit == JIT_EXIT_WRITE)
+                invalidate(context.address);
+            tight = exit == JIT_EXIT_CONTINUE && pc >= 0 && pc < storage && entries[pc] != nullptr;
+            entered = true;
+            continue;
+        }
+        if (entered && counters[pc] < hotCount && ++counters[pc] == hotCount)
+        {
+            compile(pc);
+            if (entries[pc] != nullptr)
+                continue;
+        }
+        entered = false;
+        tight = false;
+
+        Cell cell = memory[pc];
+        int x = cell.operand;
+        bool inside = x >= 0 && x < storage;
+        int next = pc + 1;
+        switch (cell.op)
+        {
+        case OP_EMPTY:
+            break;
+        case OP_LOAD:
+            handOver = !inside;
+            if (inside)
+                acc = memory[x].operand;
+            break;
+        case OP_STORE:
+            handOver = !inside;
+            if (inside)
+                write(x, acc);
+            break;
+        case OP_ADD:
+            handOver = !inside;
+            if (inside)
+                acc = (int)((unsigned)acc + (unsigned)memory[x].operand);
+            break;
+        case OP_SUB:
+            handOver = !inside;
+            if (inside)
+                acc = (int)((unsigned)acc - (unsigned)memory[x].operand);
+            break;
+        case OP_READ:
+            handOver = !inside;  // The ControlUnit reads the number before it fails
+            if (inside)
+                write(x, CU.read());
+            break;
+        case OP_PRINT:
+            handOver = !inside;
+            if (inside)
+                CU.print(memory[x].operand);
+            break;
+        case OP_JUMP:
+        case OP_BRANCHGT:
+            handOver = !inside;
+            if (cell.op == OP_JUMP || acc > 0)
+                next = x;
+            entered = true;
+            break;
+        case OP_EXIT:
+            status = STATUS_HALTED;
+            break;
+        default:
+            handOver = true;  // A variable or a damaged cell
+            break;
+        }
+        if (!handOver)
+        {
+            pc = next;
+            left--;
+        }
+    }
+
+    for (int i = 0; i < storage; i++)
+    {
+        Cell cell = CU.cellAt(i);
+        if (cell.op != memory[i].op || cell.operand != memory[i].operand)
+        {
+            CU.setMAR(i);
+            CU.setMDR(memory[i]);
+            CU.writeEnable();
+        }
+    }
+    CU.setPC(pc);
+    CU.setACC(acc);
+    RunResult result{status, maxSteps - left};
+    if (handOver)
+    {
+        RunResult rest = CU.run(left);  // Stops at the failing instruction
+        result.status = rest.status;
+        result.steps += rest.steps;
+    }
+    else
+        CU.flush();  // The buffered output is written when the run stops
+    return result;
+}
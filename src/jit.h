@@ -0,0 +1,134 @@
+#ifndef JIT_H_INCLUDED
+#define JIT_H_INCLUDED
+
+#include "controlUnit.h"
+#include <vector>
+
+/// Number of entries after which a block is compiled.
+const unsigned JIT_HOT_COUNT = 64;
+
+/// Longest compiled block, in cells.
+const int JIT_MAX_BLOCK = 256;
+
+/// Default size of the executable memory of a JitRunner.
+const size_t JIT_CODE_SIZE = 1 << 20;
+
+/// JitContext struct
+/* The state shared by the host and the machine code. The generated code uses the offsets of
+ * the fields, they are checked with static_assert in jit.cpp.
+ */
+struct JitContext{
+    Cell* memory;                   /// The memory of the run
+    unsigned char* compiled;        /// Number of compiled blocks that contain every cell
+    const void* const* entries;     /// Machine code of the block at every address, nullptr if there is none
+    unsigned long long left;        /// Step budget
+    int acc;                        /// Accumulator
+    int pc;                         /// Next instruction when the code returns
+    int address;                    /// The compiled cell that was written, for JIT_EXIT_WRITE
+    void* io;                       /// The ControlUnit, passed back to the callbacks
+    int (*read)(void*);             /// READ: IOUnit::read of the ControlUnit
+    void (*print)(void*, int);      /// PRINT: IOUnit::print of the ControlUnit
+};
+
+/// JitExit enum
+/* Why the machine code returned to the host. */
+enum JitExit{
+    JIT_EXIT_CONTINUE,      /// The next block is not compiled or does not fit in the budget
+    JIT_EXIT_HALT,          /// An EXIT was executed
+    JIT_EXIT_WRITE          /// A STORE or READ wrote a compiled cell, its blocks are stale
+};
+
+/// JitBlock struct
+struct JitBlock{
+    int first;              /// Address of the first cell
+    int last;               /// Address of the last cell
+    bool valid;             /// The cells did not change since the block was compiled
+};
+
+/// JitRunner class
+/* Tiered execution of the program of a ControlUnit. Every run starts on the tier 0
+ * interpreter, which counts how many times the execution enters a block (the start, the
+ * targets of the jumps and the cells after the branches). A block entered JIT_HOT_COUNT
+ * times is compiled into x86-64 machine code: every instruction is a fixed template with
+ * its operand as a constant, the accumulator, the budget and the memory stay in registers,
+ * and a block jumps straight to the next compiled block through the entry table.
+ * The code is written into memory from mmap, which is only executable while it is not
+ * writable (mprotect). A write into a compiled cell, from either tier, invalidates every
+ * block that contains it. The code of an invalidated block stays in the memory until it is
+ * full: then every block is dropped and the memory is reused from the start. The instructions that fail, the other arithmetics and 64-bit words are
+ * executed by the ControlUnit itself, with the same status and steps as ControlUnit::run().
+ * With a time limit the budget is run in slices of WATCHDOG_SLICE steps, like in the engines.
+ * On other platforms than Linux x86-64 every run is a ControlUnit::run().
+ */
+class JitRunner{
+    ControlUnit& CU;                        /// The machine
+    unsigned hotCount;                      /// Entries before a block is compiled
+    std::vector<Cell> memory;               /// The memory during a run
+    std::vector<unsigned char> compiled;    /// Compiled blocks that contain every cell
+    std::vector<const void*> entries;       /// Machine code of the block at every address
+    std::vector<unsigned> counters;         /// Entries of every address on tier 0
+    std::vector<JitBlock> blocks;           /// The blocks in the executable memory, also the invalidated ones
+    unsigned char* code=nullptr;            /// The executable memory
+    size_t codeSize;                        /// Bytes of the executable memory
+    size_t used=0;                          /// Bytes of code written
+    const void* epilogue=nullptr;           /// Common exit of the compiled blocks
+    size_t compilations=0;                  /// Blocks compiled since the construction
+    unsigned long long invalidations=0;     /// Blocks dropped because their cells were written
+    unsigned long long codeResets=0;        /// Times the executable memory was full and every block was dropped
+
+    /// Compiles the block that starts at an address, if its first cell can be compiled.
+    /// @param first - the address
+    void compile(int first);
+
+    /// Invalidates the compiled blocks that contain a cell.
+    /// @param address - the written cell
+    void invalidate(int address);
+
+    /// Drops every block, the executable memory is written again from its start.
+    void resetCode();
+
+    /// Writes a variable into the memory of the run.
+    /// @param address - a valid address
+    /// @param value - the value
+    void write(int address, int value){
+        memory[address] = Cell{value, OP_VAR};
+        if(compiled[address] != 0)
+            invalidate(address);
+    }
+
+    JitRunner(const JitRunner&);
+    JitRunner& operator=(const JitRunner&);
+public:
+    /// Constructor.
+    /// Maps the executable memory, without it every run is a ControlUnit::run().
+    /// @param CU - the machine, it must live as long as the JitRunner
+    /// @param hotCount - entries before a block is compiled
+    /// @param codeSize - bytes of executable memory
+    JitRunner(ControlUnit& CU, unsigned hotCount=JIT_HOT_COUNT, size_t codeSize=JIT_CODE_SIZE);
+
+    /// Unmaps the executable memory.
+    ~JitRunner();
+
+    /// Checks if the platform has a JIT.
+    /// @return true on Linux x86-64
+    static bool isSupported();
+
+    /// Runs the program like ControlUnit::run(), with the same result.
+    /// @param maxSteps - maximum number of instructions to execute
+    /// @return the status and the number of executed instructions
+    RunResult run(unsigned long long maxSteps=~0ULL);
+
+    /// Get the number of compiled blocks.
+    /// @return the blocks compiled since the construction, also the invalidated ones
+    size_t getCompiledBlocks() const { return compilations; }
+
+    /// Get the number of invalidated blocks.
+    /// @return the blocks dropped because the program wrote their cells
+    unsigned long long getInvalidations() const { return invalidations; }
+
+    /// Get the number of resets of the executable memory.
+    /// @return the times the memory was full and every block was dropped
+    unsigned long long getCodeResets() const { return codeResets; }
+};
+
+#endif // JIT_H_INCLUDED
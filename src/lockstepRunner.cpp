@@ -0,0 +1,257 @@
+#include "lockstepRunner.h"
+#include "programAnalysis.h"
+#include "workPool.h"
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <sstream>
+
+/// Every reachable STORE and READ target gets a row, the other cells keep their initial value.
+LockstepRunner::LockstepRunner(std::shared_ptr<const ProgramImage> image, unsigned threads, unsigned long long maxSteps)
+    : image(image), threads(poolThreads(threads)), maxSteps(maxSteps)
+{
+    if (image == nullptr)
+        return;
+    MemoryUnit memory(image);
+    int storage = static_cast<int>(memory.getStorage());
+    for (int address = 0; address < storage; address++)
+    {
+        Cell cell = memory.cellAt(address);
+        if (cell.op >= OP_COUNT)
+            cell.op = OP_EMPTY;  // A damaged binary image can hold anything
+        cells.push_back(cell);
+    }
+    ProgramAnalysis analysis(cells);
+    if (!analysis.getSelfModifying().empty())
+        return;
+    rowOf.assign(storage, -1);
+    for (int address = 0; address < storage; address++)
+    {
+        const Cell &cell = cells[address];
+        if ((cell.op == OP_STORE || cell.op == OP_READ) && analysis.isReachable(address) &&
+            cell.operand >= 0 && cell.operand < storage && rowOf[cell.operand] < 0)
+            rowOf[cell.operand] = static_cast<int>(rows++);
+    }
+    lockstep = true;
+}
+
+/// A program that can't run in lanes runs like a fork of the ForkRunner, from the start.
+std::vector<ForkResult> LockstepRunner::run(const std::vector<std::string> &inputs) const
+{
+    std::vector<ForkResult> results(inputs.size());
+    if (!lockstep)
+    {
+        parallelFor(inputs.size(), threads, [&](size_t lane)
+        {
+            std::istringstream input(inputs[lane]);
+            std::ostringstream output;
+            RunResult run;
+            {
+                ControlUnit CU(image, output, input, ENGINE_THREADED);
+                CU.setFusion(true);
+                CU.setBuffered(true);
+                run = CU.run(maxSteps);
+            }
+            results[lane] = ForkResult{inputs[lane], run.status, run.steps, output.str()};
+        });
+        return results;
+    }
+    size_t groups = (inputs.size() + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES;
+    parallelFor(groups, threads, [&](size_t group) { runGroup(inputs, group * LOCKSTEP_LANES, results); });
+    return results;
+}
+
+/// Follows runSwitch lane by lane: a failing instruction is not counted, EXIT is.
+/* The group always has LOCKSTEP_LANES lanes, the ones without an input are stopped from the start:
+ * the kernels have a fixed trip count, which the vectorizer handles without a remainder loop.
+ */
+void LockstepRunner::runGroup(const std::vector<std::string> &inputs, size_t first, std::vector<ForkResult> &results) const
+{
+    const int storage = static_cast<int>(cells.size());
+    const int lanes = static_cast<int>(LOCKSTEP_LANES);
+    const int used = static_cast<int>(std::min(LOCKSTEP_LANES, inputs.size() - first));
+    std::vector<int> memory(rows * lanes);
+    for (int address = 0; address < storage; address++)
+        if (rowOf[address] >= 0)
+            std::fill_n(&memory[rowOf[address] * lanes], lanes, cells[address].operand);
+    // Registers of the lanes, local arrays do not alias the memory rows for the vectorizer
+    int acc[LOCKSTEP_LANES] = {}, pc[LOCKSTEP_LANES] = {}, active[LOCKSTEP_LANES] = {}, scratch[LOCKSTEP_LANES];
+    unsigned long long steps[LOCKSTEP_LANES] = {};
+    Status status[LOCKSTEP_LANES];
+    std::fill_n(status, lanes, STATUS_STEP_LIMIT);
+    std::vector<std::istringstream> in;
+    std::vector<std::ostringstream> out(used);
+    std::vector<std::unique_ptr<IOUnit>> io;
+    in.reserve(used);
+    for (int l = used; l < lanes; l++)
+        pc[l] = INT_MAX;
+    for (int l = 0; l < used; l++)
+    {
+        in.emplace_back(inputs[first + l]);
+        io.emplace_back(new IOUnit(out[l], in[l]));
+        io.back()->setBuffered(true);
+    }
+
+    // Stops the lanes of the current group, a stopped lane waits at PC INT_MAX
+    int live = used;
+    auto stop = [&](Status reason)
+    {
+        for (int l = 0; l < lanes; l++)
+            if (active[l])
+            {
+                status[l] = reason;
+                pc[l] = INT_MAX;
+                live--;
+            }
+    };
+
+    unsigned long long rounds = 0;  // No lane has executed more instructions than this
+    while (live > 0)
+    {
+        if (rounds >= maxSteps)
+        {
+            for (int l = 0; l < lanes; l++)
+                active[l] = pc[l] != INT_MAX && steps[l] >= maxSteps;
+            stop(STATUS_STEP_LIMIT);
+            if (live == 0)
+                break;
+        }
+        rounds++;
+
+        // The lanes at the lowest PC run next
+        int p = INT_MAX;
+        for (int l = 0; l < lanes; l++)
+            p = std::min(p, pc[l]);
+        for (int l = 0; l < lanes; l++)
+            active[l] = pc[l] == p;
+        if (p >= storage)
+        {
+            stop(STATUS_BAD_ADDRESS);  // The lanes ran out of the memory
+            continue;
+        }
+
+        const Cell cell = cells[p];
+        bool valid = cell.operand >= 0 && cell.operand < storage;
+        int *row = valid && rowOf[cell.operand] >= 0 ? &memory[rowOf[cell.operand] * lanes] : nullptr;
+        const int *source = row;
+        if (valid && row == nullptr)
+        {
+            std::fill_n(scratch, lanes, cells[cell.operand].operand);
+            source = scratch;
+        }
+        int next = p + 1;
+        switch (cell.op)
+        {
+        case OP_LOAD:
+            if (!valid)
+            {
+                stop(STATUS_BAD_ADDRESS);
+                continue;
+            }
+            for (int l = 0; l < lanes; l++)
+            {
+                int value = source[l];  // Read by every lane, so the select has no branch
+                acc[l] = active[l] ? value : acc[l];
+            }
+            break;
+        case OP_STORE:
+            if (!valid)
+            {
+                stop(STATUS_BAD_ADDRESS);
+                continue;
+            }
+            for (int l = 0; l < lanes; l++)
+                row[l] = active[l] ? acc[l] : row[l];
+            break;
+        case OP_ADD:
+            if (!valid)
+            {
+                stop(STATUS_BAD_ADDRESS);
+                continue;
+            }
+            for (int l = 0; l < lanes; l++)
+            {
+                int sum = (int)((unsigned)acc[l] + (unsigned)source[l]);  // Wraps like WrapArithmetic
+                acc[l] = active[l] ? sum : acc[l];
+            }
+            break;
+        case OP_SUB:
+            if (!valid)
+            {
+                stop(STATUS_BAD_ADDRESS);
+                continue;
+            }
+            for (int l = 0; l < lanes; l++)
+            {
+                int difference = (int)((unsigned)acc[l] - (unsigned)source[l]);
+                acc[l] = active[l] ? difference : acc[l];
+            }
+            break;
+        case OP_READ:
+            for (int l = 0; l < used; l++)
+                if (active[l])
+                {
+                    int val = io[l]->read();  // Read first, then store the value as a variable
+                    if (valid)
+                        row[l] = val;
+                }
+            if (!valid)
+            {
+                stop(STATUS_BAD_ADDRESS);
+                continue;
+            }
+            break;
+        case OP_PRINT:
+            if (!valid)
+            {
+                stop(STATUS_BAD_ADDRESS);
+                continue;
+            }
+            for (int l = 0; l < used; l++)
+                if (active[l])
+                    io[l]->print(source[l]);
+            break;
+        case OP_JUMP:
+            if (!valid)
+            {
+                stop(STATUS_BAD_JUMP);
+                continue;
+            }
+            next = cell.operand;
+            break;
+        case OP_BRANCHGT:
+            if (!valid)
+            {
+                stop(STATUS_BAD_JUMP);
+                continue;
+            }
+            for (int l = 0; l < lanes; l++)
+            {
+                steps[l] += active[l];
+                pc[l] = active[l] ? (acc[l] > 0 ? cell.operand : next) : pc[l];
+            }
+            continue;
+        case OP_VAR:
+            stop(STATUS_VAR_EXECUTED);
+            continue;
+        case OP_EXIT:
+            for (int l = 0; l < lanes; l++)
+                steps[l] += active[l];
+            stop(STATUS_HALTED);
+            continue;
+        default:
+            break;  // Empty cells are skipped
+        }
+        for (int l = 0; l < lanes; l++)
+        {
+            steps[l] += active[l];
+            pc[l] = active[l] ? next : pc[l];
+        }
+    }
+
+    for (int l = 0; l < used; l++)
+    {
+        io[l]->flush();
+        results[first + l] = ForkResult{inputs[first + l], status[l], steps[l], out[l].str()};
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef LOCKSTEPRUNNER_H_INCLUDED
+#define LOCKSTEPRUNNER_H_INCLUDED
+
+#include "forkRunner.h"
+#include <string>
+#include <vector>
+
+/// Number of inputs that run together in one group of lanes.
+const size_t LOCKSTEP_LANES = 256;
+
+/// LockstepRunner class
+/* Runs one program with many inputs, every instruction on many inputs at once (lanes).
+ * The registers and the written variables are kept in structure-of-arrays form: one row of
+ * LOCKSTEP_LANES values per variable, the cells that are never written are shared constants.
+ * Each step executes the instruction at the lowest PC for every lane that is there, the
+ * other lanes are masked out. Lanes that took different branches wait at their PC, and run
+ * together again when the others reach it: divergent paths run one after the other, so a
+ * group whose lanes never meet again costs as much as running its paths separately.
+ * The lanes are scalar SoA code, there are no intrinsics: the kernels are plain loops over
+ * the lanes without branches, and the compiler's auto-vectorizer turns them into SIMD code.
+ * GCC 12 does it at -O2 with SSE2, -O3 -march=native gives wider vectors, an older compiler
+ * at -O2 or -fno-tree-vectorize leaves them scalar. The "lanes" rows of the benchmark
+ * compare them with the ForkRunner.
+ * A program that writes its own executed cells can make the lanes run different code:
+ * it runs on a separate ControlUnit for every input instead.
+ * The results are the same as the results of the wrapping ControlUnit engines.
+ */
+class LockstepRunner{
+    std::shared_ptr<const ProgramImage> image;  /// The program
+    std::vector<Cell> cells;        /// The initial memory
+    std::vector<int> rowOf;         /// Variable row of every address, -1 for a cell that is never written
+    size_t rows=0;                  /// Number of variable rows
+    bool lockstep=false;            /// The program can run in lanes
+    unsigned threads;               /// Number of worker threads
+    unsigned long long maxSteps;    /// Step budget of every input
+
+    /// Runs a group of at most LOCKSTEP_LANES inputs in lanes.
+    /// @param inputs - every input
+    /// @param first - index of the first input of the group
+    /// @param results - receives the results of the group
+    void runGroup(const std::vector<std::string>& inputs, size_t first, std::vector<ForkResult>& results) const;
+public:
+    /// Constructor.
+    /// Analyses the program to find its variables.
+    /// @param image - the program, nullptr gives STATUS_NO_PROGRAM for every input
+    /// @param threads - number of worker threads, 0 uses every core
+    /// @param maxSteps - step budget of every input
+    LockstepRunner(std::shared_ptr<const ProgramImage> image, unsigned threads=0, unsigned long long maxSteps=100000000ULL);
+
+    /// Checks if the inputs run in lanes.
+    /// @return false if the program modifies itself and every input runs alone
+    bool isLockstep() const { return lockstep; }
+
+    /// Runs every input, the groups of lanes run in parallel.
+    /// @param inputs - text read by the READ instructions, one per lane
+    /// @return the results in the order of the inputs
+    std::vector<ForkResult> run(const std::vector<std::string>& inputs) const;
+};
+
+#endif // LOCKSTEPRUNNER_H_INCLUDED
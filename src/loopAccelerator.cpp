@@ -0,0 +1,204 @@
+#include "loopAccelerator.h"
+#include <algorithm>
+#include <climits>
+
+/// Largest coefficient of a slot, keeps the exact sums of the closed form in a long long.
+static const long long LOOP_MAX_COEFFICIENT = 256;
+
+/// Evaluates an update in wrap-around arithmetic.
+static int evaluate(const LoopUpdate &update, const int *state)
+{
+    unsigned value = 0;
+    for (const LoopTerm &term : update.terms)
+        value += (unsigned)term.coefficient * (unsigned)state[term.slot];
+    return (int)value;
+}
+
+/// Symbolic execution of one iteration: every slot holds its coefficients of the slots at the start.
+bool LoopPlan::compile(const std::vector<Cell> &body, int first, int storage, LoopPlan &plan)
+{
+    int length = static_cast<int>(body.size());
+    if (length == 0 || length > LOOP_MAX_LENGTH || body.back().op != OP_BRANCHGT || body.back().operand != first)
+        return false;
+    LoopPlan loop;
+    loop.head = first;
+    loop.tail = first + length - 1;
+    loop.addresses.push_back(-1);
+    std::vector<int> slot(length - 1, 0);
+    for (int i = 0; i < length - 1; i++)
+    {
+        const Cell &cell = body[i];
+        if (cell.op == OP_EMPTY)
+            continue;
+        if (cell.op != OP_LOAD && cell.op != OP_ADD && cell.op != OP_SUB && cell.op != OP_STORE)
+            return false;  // I/O, a jump, a variable or EXIT
+        if (cell.operand < 0 || cell.operand >= storage)
+            return false;  // The single instruction reports the error
+        if (cell.op == OP_STORE && cell.operand >= loop.head && cell.operand <= loop.tail)
+            return false;  // The loop modifies itself
+        std::vector<int>::iterator found = std::find(loop.addresses.begin(), loop.addresses.end(), cell.operand);
+        slot[i] = static_cast<int>(found - loop.addresses.begin());
+        if (found == loop.addresses.end())
+            loop.addresses.push_back(cell.operand);
+    }
+
+    size_t slots = loop.addresses.size();
+    std::vector<std::vector<long long>> value(slots, std::vector<long long>(slots, 0));
+    for (size_t s = 0; s < slots; s++)
+        value[s][s] = 1;
+    std::vector<int> lastStore(slots, -1);
+    lastStore[0] = length;  // The accumulator is not written back, it comes last
+    for (int i = 0; i < length - 1; i++)
+    {
+        switch (body[i].op)
+        {
+        case OP_LOAD:
+            value[0] = value[slot[i]];
+            break;
+        case OP_ADD:
+        case OP_SUB:
+            for (size_t s = 0; s < slots; s++)
+            {
+                value[0][s] += body[i].op == OP_ADD ? value[slot[i]][s] : -value[slot[i]][s];
+                if (value[0][s] > LOOP_MAX_COEFFICIENT || value[0][s] < -LOOP_MAX_COEFFICIENT)
+                    return false;
+            }
+            break;
+        case OP_STORE:
+            value[slot[i]] = value[0];
+            lastStore[slot[i]] = i;
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::vector<int> written;
+    for (size_t s = 0; s < slots; s++)
+        if (lastStore[s] >= 0)
+            written.push_back(static_cast<int>(s));
+    std::sort(written.begin(), written.end(), [&](int a, int b) { return lastStore[a] < lastStore[b]; });
+    loop.updateOf.assign(slots, -1);
+    for (int s : written)
+    {
+        LoopUpdate update{s, {}, true};
+        for (size_t j = 0; j < slots; j++)
+            if (value[s][j] != 0)
+                update.terms.push_back(LoopTerm{static_cast<int>(j), static_cast<int>(value[s][j])});
+        loop.updateOf[s] = static_cast<int>(loop.updates.size());
+        loop.updates.push_back(update);
+    }
+
+    // A translation is s + invariant, the other slots must depend only on translations and invariants
+    for (LoopUpdate &update : loop.updates)
+        for (const LoopTerm &term : update.terms)
+            if (term.slot == update.slot ? term.coefficient != 1 : loop.updateOf[term.slot] >= 0)
+                update.translation = false;
+    for (LoopUpdate &update : loop.updates)
+        if (value[update.slot][update.slot] != 1)
+            update.translation = false;  // The slot does not appear in its own sum
+    loop.closedForm = true;
+    for (const LoopUpdate &update : loop.updates)
+        if (!update.translation)
+            for (const LoopTerm &term : update.terms)
+                if (loop.updateOf[term.slot] >= 0 && !loop.updates[loop.updateOf[term.slot]].translation)
+                    loop.closedForm = false;
+    plan = loop;
+    return true;
+}
+
+/* The translations move by the same amount t every iteration, so the accumulator the
+ * BRANCHGT tests after iteration i is A + (i - 1) * B: a line, its first non-positive
+ * point is the number of iterations. A and B are exact sums, the closed form only holds
+ * if the accumulator stays in the int range on the line, otherwise the loop is iterated.
+ * The final values are computed modulo 2^32 like the instructions compute them.
+ */
+unsigned long long LoopPlan::jump(int *state, int *scratch, unsigned long long most, bool &exited) const
+{
+    for (const LoopUpdate &update : updates)
+        if (update.translation)
+        {
+            long long step = 0;
+            for (const LoopTerm &term : update.terms)
+                if (term.slot != update.slot)
+                    step += (long long)term.coefficient * state[term.slot];
+            scratch[update.slot] = (int)(unsigned)step;
+        }
+    const LoopUpdate &condition = updates[updateOf[0]];
+    long long first = 0, change = 0;
+    for (const LoopTerm &term : condition.terms)
+    {
+        first += (long long)term.coefficient * state[term.slot];
+        int index = updateOf[term.slot];
+        if (index >= 0)
+        {
+            long long step = 0;
+            for (const LoopTerm &inner : updates[index].terms)
+                if (inner.slot != term.slot)
+                    step += (long long)inner.coefficient * state[inner.slot];
+            change += (long long)term.coefficient * step;
+        }
+    }
+    if (first > INT_MAX || first < INT_MIN)
+        return 0;
+
+    unsigned long long iterations;
+    if (first <= 0)
+    {
+        iterations = 1;
+        exited = true;
+    }
+    else if (change >= 0)
+    {
+        if (change > 0 && most - 1 > (unsigned long long)((INT_MAX - first) / change))
+            return 0;
+        iterations = most;
+        exited = false;
+    }
+    else
+    {
+        unsigned long long more = (unsigned long long)((first - change - 1) / -change);  // Rounded up
+        exited = more < most;
+        iterations = exited ? more + 1 : most;
+        if (first + (long long)(iterations - 1) * change < INT_MIN)
+            return 0;
+    }
+
+    unsigned before = (unsigned)(iterations - 1);
+    for (const LoopUpdate &update : updates)
+        if (update.translation)
+            state[update.slot] = (int)((unsigned)state[update.slot] + before * (unsigned)scratch[update.slot]);
+    for (const LoopUpdate &update : updates)
+        if (!update.translation)
+            scratch[update.slot] = evaluate(update, state);  // The last iteration starts from here
+    for (const LoopUpdate &update : updates)
+        state[update.slot] = update.translation ? (int)((unsigned)state[update.slot] + (unsigned)scratch[update.slot])
+                                                : scratch[update.slot];
+    return iterations;
+}
+
+unsigned long long LoopPlan::run(int *state, int *scratch, unsigned long long most, bool &exited) const
+{
+    if (closedForm)
+    {
+        unsigned long long iterations = jump(state, scratch, most, exited);
+        if (iterations != 0)
+            return iterations;
+    }
+    exited = false;
+    unsigned long long iterations = 0;
+    while (iterations < most)
+    {
+        for (const LoopUpdate &update : updates)
+            scratch[update.slot] = evaluate(update, state);
+        for (const LoopUpdate &update : updates)
+            state[update.slot] = scratch[update.slot];
+        iterations++;
+        if (state[0] <= 0)
+        {
+            exited = true;
+            break;
+        }
+    }
+    return iterations;
+}
@@ -0,0 +1,98 @@
+#ifndef LOOPACCELERATOR_H_INCLUDED
+#define LOOPACCELERATOR_H_INCLUDED
+
+#include "instruction.h"
+#include <vector>
+
+/// Longest loop that is compiled, in cells.
+const int LOOP_MAX_LENGTH = 64;
+
+/// LoopTerm struct
+struct LoopTerm{
+    int slot;           /// A value at the start of the iteration
+    int coefficient;    /// Its multiplier
+};
+
+/// LoopUpdate struct
+/* The value of a slot after one iteration, as a sum of the slots at the start of the iteration. */
+struct LoopUpdate{
+    int slot;                       /// The written slot
+    std::vector<LoopTerm> terms;    /// The sum
+    bool translation;               /// The slot only changes by a loop invariant amount
+};
+
+/// LoopPlan class
+/* A counted loop compiled for bulk execution: one basic block closed by a BRANCHGT back
+ * to its first cell, with only LOAD, ADD, SUB, STORE and empty cells in it. The loop can't
+ * do I/O, and it can't write its own cells, so every iteration runs the same instructions.
+ * The values it uses are slots: slot 0 is the accumulator, the others are memory cells.
+ * Symbolic execution of the body gives every written slot as a linear function of the
+ * slots at the start of the iteration, exact in wrap-around int arithmetic.
+ * If every written slot only moves by a loop invariant amount, or depends only on those
+ * slots, the number of iterations and the final values are computed in O(1).
+ * Other loops (e.g. Fibonacci) evaluate the linear functions in a tight loop instead of
+ * dispatching every instruction.
+ */
+class LoopPlan{
+    int head=0;                         /// Address of the first cell
+    int tail=0;                         /// Address of the BRANCHGT
+    std::vector<int> addresses;         /// Memory address of every slot, -1 for the accumulator
+    std::vector<LoopUpdate> updates;    /// The written slots, the memory ones in the order of their last STORE
+    std::vector<int> updateOf;          /// Index of the update of every slot, -1 if the loop only reads it
+    bool closedForm=false;              /// Every update is a translation or depends only on translations
+
+    /// Runs the iterations in O(1).
+    /// @param state - the slots, receives the values after the iterations
+    /// @param scratch - room for getSlots() values
+    /// @param most - maximum number of iterations
+    /// @param exited - receives true if the loop ended
+    /// @return the number of iterations, 0 if the accumulator would leave the int range
+    unsigned long long jump(int* state, int* scratch, unsigned long long most, bool& exited) const;
+public:
+    /// Compiles a loop.
+    /// @param body - the cells from the first one to the BRANCHGT
+    /// @param first - address of the first cell
+    /// @param storage - memory size, for the operand checks
+    /// @param plan - receives the plan
+    /// @return false if the loop can't be accelerated
+    static bool compile(const std::vector<Cell>& body, int first, int storage, LoopPlan& plan);
+
+    /// Get the first cell.
+    /// @return the address the BRANCHGT jumps to
+    int getHead() const { return head; }
+
+    /// Get the BRANCHGT.
+    /// @return the address of the last cell
+    int getTail() const { return tail; }
+
+    /// Get the length of an iteration.
+    /// @return the number of instructions executed by one iteration
+    int getLength() const { return tail - head + 1; }
+
+    /// Get the number of slots.
+    /// @return the accumulator and the memory cells the loop uses
+    size_t getSlots() const { return addresses.size(); }
+
+    /// Get the address of a slot.
+    /// @param slot - the slot, 1 or more
+    /// @return the memory address
+    int getAddress(size_t slot) const { return addresses[slot]; }
+
+    /// Get the updates.
+    /// @return the written slots, the accumulator included
+    const std::vector<LoopUpdate>& getUpdates() const { return updates; }
+
+    /// Checks if the iterations are computed in O(1).
+    /// @return true for a closed form
+    bool isClosedForm() const { return closedForm; }
+
+    /// Runs iterations of the loop.
+    /// @param state - the slots at the head of the loop, receives their values after the iterations
+    /// @param scratch - room for getSlots() values
+    /// @param most - maximum number of iterations, at least 1
+    /// @param exited - receives true if the BRANCHGT fell through at the end
+    /// @return the number of iterations
+    unsigned long long run(int* state, int* scratch, unsigned long long most, bool& exited) const;
+};
+
+#endif // LOOPACCELERATOR_H_INCLUDED
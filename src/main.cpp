@@ -1,12 +1,357 @@
 #include "test.h"
 #include <iostream>
+#include <fstream>
+#include <chrono>
 #include "instruction.h"
 #include "controlUnit.h"
+#include "batchRunner.h"
+#include "profiler.h"
+#include "forkRunner.h"
+#include "programAnalysis.h"
+#include "lockstepRunner.h"
+#include "trace.h"
+#include "nativeProgram.h"
+#include "jit.h"
 #include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
 
+/// Reads a non-negative integer argument, e.g. a number of threads.
+/// @param text - the argument
+/// @param value - receives the number
+/// @return false if the argument is not a number that fits in an unsigned
+static bool ParseUnsigned(const char *text, unsigned &value)
+{
+    char *end;
+    errno = 0;
+    unsigned long number = std::strtoul(text, &end, 10);
+    if (*text == '-' || end == text || *end != '\0' || errno != 0 || number > UINT_MAX)
+        return false;  // strtoul accepts a sign and ignores the rest of the text
+    value = static_cast<unsigned>(number);
+    return true;
+}
+
+/// Reads an input number of a program.
+/// @param text - the argument
+/// @param value - receives the number
+/// @return false if the argument is not a number that fits in an int
+static bool ParseInput(const char *text, int &value)
+{
+    char *end;
+    errno = 0;
+    long number = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || number < INT_MIN || number > INT_MAX)
+        return false;
+    value = static_cast<int>(number);
+    return true;
+}
+
+/// Reads a non-negative number of seconds.
+/// @param text - the argument
+/// @param value - receives the number
+/// @return false if the argument is not a finite, non-negative number
+static bool ParseSeconds(const char *text, double &value)
+{
+    char *end;
+    double number = std::strtod(text, &end);
+    if (end == text || *end != '\0' || !std::isfinite(number) || number < 0)
+        return false;
+    value = number;
+    return true;
+}
+
+/// Batch mode: program --batch manifest [report] [threads] [seconds]
+/// Runs every job of the manifest in parallel and writes a JSON report.
+/// @return 0 if every job passed
+static int RunBatch(int argc, char *argv[])
+{
+    unsigned threads = 0;
+    double timeLimit = 0;
+    if ((argc > 4 && !ParseUnsigned(argv[4], threads)) || (argc > 5 && !ParseSeconds(argv[5], timeLimit)))
+    {
+        std::cerr << "Usage: program --batch manifest [report] [threads] [seconds]\n";
+        return 2;
+    }
+    BatchRunner batch(threads, 100000000ULL, timeLimit);
+    try
+    {
+        batch.readManifest(argv[2]);
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<BatchResult> results = batch.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (argc > 3)
+    {
+        std::ofstream report(argv[3]);
+        batch.writeReport(report, results, seconds);
+    }
+    else
+        batch.writeReport(std::cout, results, seconds);
+    for (const BatchResult &result : results)
+        if (!result.passed)
+            return 1;
+    return 0;
+}
+
+/// Load mode: program --load file [--hex]
+/// Loads a program file and prints the load throughput.
+/// @return 0 if the file could be loaded
+static int RunLoad(int argc, char *argv[])
+{
+    NumberFormat format = argc > 3 && std::string(argv[3]) == "--hex" ? FORMAT_HEX : FORMAT_LEGACY_DECIMAL;
+    try
+    {
+        std::shared_ptr<const ProgramImage> image = ProgramImage::load(argv[2], format);
+        const LoadStats &stats = image->getLoadStats();
+        std::cout << stats.bytes << " bytes, " << stats.cells << " cells, memory size " << image->getStorage()
+                  << ", " << stats.seconds << " s, " << stats.megabytesPerSecond() << " MB/s" << std::endl;
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+    return 0;
+}
+
+/// Analyze mode: program --analyze file [--hex]
+/// Prints the basic blocks of the program and the problems found without running it.
+/// @return 0 if the program is safe
+static int RunAnalyze(int argc, char *argv[])
+{
+    NumberFormat format = argc > 3 && std::string(argv[3]) == "--hex" ? FORMAT_HEX : FORMAT_LEGACY_DECIMAL;
+    try
+    {
+        ProgramAnalysis analysis(*ProgramImage::load(argv[2], format));
+        analysis.report(std::cout);
+        return analysis.isSafe() ? 0 : 1;
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+}
+
+/// Convert mode: program --convert input.txt output.img [--hex]
+/// Converts a text program into the binary image format.
+/// @return 0 if the image was written
+static int RunConvert(int argc, char *argv[])
+{
+    NumberFormat format = argc > 4 && std::string(argv[4]) == "--hex" ? FORMAT_HEX : FORMAT_LEGACY_DECIMAL;
+    try
+    {
+        ProgramImage::load(argv[2], format)->save(argv[3]);
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+    return 0;
+}
+
+/// Profile mode: program --profile file [--threaded]
+/// Runs a program with the profiler, the input is read from the console.
+/// The flat profile and the hot loops are written when the program halts.
+/// @return 0 if the program halted
+static int RunProfile(int argc, char *argv[])
+{
+    Engine engine = argc > 3 && std::string(argv[3]) == "--threaded" ? ENGINE_THREADED : ENGINE_SWITCH;
+    ControlUnit CUmain(argv[2], std::cout, std::cin, engine);
+    if (CUmain.NotValidMemory())
+        return 2;
+    CUmain.setBuffered(true);
+    Profiler profiler(&std::cerr);
+    RunResult result = CUmain.run(profiler);
+    std::cout << statusMessage(result.status) << '\n';
+    return result.status == STATUS_HALTED ? 0 : 1;
+}
 
-int main()
+/// Trace mode: program --trace file trace [--threaded]
+/// Runs a program and records every executed instruction, the input is read from the console.
+/// @return 0 if the program halted
+static int RunTrace(int argc, char *argv[])
 {
+    Engine engine = argc > 4 && std::string(argv[4]) == "--threaded" ? ENGINE_THREADED : ENGINE_SWITCH;
+    ControlUnit CUmain(argv[2], std::cout, std::cin, engine);
+    if (CUmain.NotValidMemory())
+        return 2;
+    std::ofstream file(argv[3], std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "File open failed.\n";
+        return 2;
+    }
+    CUmain.setBuffered(true);
+    TraceRecorder recorder(file, CUmain);
+    RunResult result = CUmain.runWith(recorder, ~0ULL);
+    recorder.close(result);
+    std::cout << statusMessage(result.status) << '\n';
+    return result.status == STATUS_HALTED ? 0 : 1;
+}
+
+/// Replay mode: program --replay file trace
+/// Runs the program again with the input of a trace and compares the two runs.
+/// @return 0 if the replay was the same
+static int RunReplay(char *argv[])
+{
+    try
+    {
+        std::ifstream file(argv[3], std::ios::binary);
+        if (!file)
+            throw "File open failed.\n";
+        ReplayResult replay = replayTrace(file, ProgramImage::load(argv[2]));
+        std::cout << replay.events << " events, ";
+        if (replay.deterministic)
+            std::cout << "the replay is the same\n";
+        else
+            std::cout << "the replay diverges at event " << replay.divergence << '\n';
+        return replay.deterministic ? 0 : 1;
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+}
+
+/// Native mode: program --native file [source]
+/// Compiles a program into native code and runs it, the input is read from the console.
+/// Writes the generated C++ into the source file if it is given.
+/// @return 0 if the program halted
+static int RunNative(int argc, char *argv[])
+{
+    try
+    {
+        std::shared_ptr<const ProgramImage> image = ProgramImage::load(argv[2]);
+        if (argc > 3)
+        {
+            std::vector<bool> native;
+            std::ofstream source(argv[3]);
+            if (!(source << NativeProgram::generate(*image, native)))
+                throw "File open failed.\n";
+        }
+        NativeProgram compiled(*image);
+        ControlUnit CUmain(image);
+        CUmain.setBuffered(true);
+        RunResult result = compiled.run(CUmain);
+        std::cout << statusMessage(result.status) << '\n';
+        return result.status == STATUS_HALTED ? 0 : 1;
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+}
+
+/// JIT mode: program --jit file
+/// Runs a program with the tiered JIT, the input is read from the console.
+/// @return 0 if the program halted
+static int RunJit(char *argv[])
+{
+    try
+    {
+        std::shared_ptr<const ProgramImage> image = ProgramImage::load(argv[2]);
+        ControlUnit CUmain(image);
+        CUmain.setBuffered(true);
+        JitRunner jit(CUmain);
+        RunResult result = jit.run();
+        std::cout << statusMessage(result.status) << '\n';
+        std::cerr << jit.getCompiledBlocks() << " blocks compiled, " << jit.getInvalidations() << " invalidated, "
+                  << jit.getCodeResets() << " code memory resets" << std::endl;
+        return result.status == STATUS_HALTED ? 0 : 1;
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+}
+
+/// Most inputs of one sweep, every input and its output are kept in memory until the end.
+static const long long MAX_SWEEP_INPUTS = 1 << 20;
+
+/// Sweep mode: program --sweep file first last [threads] [--lockstep]
+/// Runs the program for every input from first to last, forked at the first READ,
+/// or with --lockstep in groups of lanes that execute every instruction together.
+/// Writes one line per input: the input and the output of the program.
+/// @return 0 if every run halted
+static int RunSweep(int argc, char *argv[])
+{
+    int first, last;
+    unsigned threads = 0;
+    bool lockstep = std::string(argv[argc - 1]) == "--lockstep";
+    if (!ParseInput(argv[3], first) || !ParseInput(argv[4], last) || first > last ||
+        (long long)last - first >= MAX_SWEEP_INPUTS ||
+        (argc > 5 && std::string(argv[5]) != "--lockstep" && !ParseUnsigned(argv[5], threads)))
+    {
+        std::cerr << "Usage: program --sweep file first last [threads] [--lockstep]\n"
+                  << "first <= last, at most " << MAX_SWEEP_INPUTS << " inputs\n";
+        return 2;
+    }
+    std::shared_ptr<const ProgramImage> image;
+    try
+    {
+        image = ProgramImage::load(argv[2]);
+    }
+    catch (const char *e)
+    {
+        std::cerr << e;
+        return 2;
+    }
+    std::vector<std::string> inputs;
+    for (long long n = first; n <= last; n++)
+        inputs.push_back(std::to_string(n));
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<ForkResult> results =
+        lockstep ? LockstepRunner(image, threads).run(inputs) : ForkRunner(image, threads).run(inputs);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int exitCode = 0;
+    for (const ForkResult &result : results)
+    {
+        std::cout << result.input << '\t' << result.output;
+        if (result.status != STATUS_HALTED)
+        {
+            std::cout << statusMessage(result.status);
+            exitCode = 1;
+        }
+    }
+    std::cerr << results.size() << " runs, " << seconds << " s" << std::endl;
+    return exitCode;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 && std::string(argv[1]) == "--batch")
+        return RunBatch(argc, argv);
+    if (argc > 2 && std::string(argv[1]) == "--load")
+        return RunLoad(argc, argv);
+    if (argc > 3 && std::string(argv[1]) == "--convert")
+        return RunConvert(argc, argv);
+    if (argc > 2 && std::string(argv[1]) == "--profile")
+        return RunProfile(argc, argv);
+    if (argc > 2 && std::string(argv[1]) == "--analyze")
+        return RunAnalyze(argc, argv);
+    if (argc > 4 && std::string(argv[1]) == "--sweep")
+        return RunSweep(argc, argv);
+    if (argc > 3 && std::string(argv[1]) == "--trace")
+        return RunTrace(argc, argv);
+    if (argc > 3 && std::string(argv[1]) == "--replay")
+        return RunReplay(argv);
+    if (argc > 2 && std::string(argv[1]) == "--native")
+        return RunNative(argc, argv);
+    if (argc > 2 && std::string(argv[1]) == "--jit")
+        return RunJit(argv);
+
     RunTest();
     bool exit = false;
     while (!exit)
@@ -24,20 +369,16 @@ int main()
             exit = true;
         }
         ControlUnit CUmain(file); // Initializes the control unit with the input file
-        bool cycleexit = CUmain.NotValidMemory();
-        while (!cycleexit)
+        if (!CUmain.NotValidMemory())
         {
-            try
-            {
-                CUmain.cycle(); // Executes one cycle of the control unit
-            }
-            catch (const char *e)
-            {
-                std::cout << e << '\n';
-                cycleexit = true; // Exits cycle if an exception occurs
-            }
+            ProgramAnalysis analysis(CUmain);  // Warns before the run about what would stop it
+            if (!analysis.isSafe())
+                analysis.problems(std::cerr);
+            CUmain.setBuffered(true); // The results are written before every input prompt and at the end
+            RunResult result = CUmain.run(); // Runs the program until it exits or fails
+            std::cout << statusMessage(result.status) << '\n';
         }
     }
 
     return 0;
-}
\ No newline at end of file
+}
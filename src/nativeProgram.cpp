@@ -0,0 +1,271 @@
+#include "nativeProgram.h"
+#include "programAnalysis.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+/// READ of the generated code.
+static int nativeRead(void *io)
+{
+    return static_cast<ControlUnit *>(io)->read();
+}
+
+/// PRINT of the generated code.
+static void nativePrint(void *io, int value)
+{
+    static_cast<ControlUnit *>(io)->print(value);
+}
+
+/// Every block is a function that returns the address of the next block, -1 after EXIT.
+/* The dispatcher switches on the address, takes the steps of the whole block from the budget
+ * and calls the block, which the compiler inlines. An address without a block (an unsafe
+ * block, the end of the memory) or a budget smaller than the block returns to the host.
+ */
+std::string NativeProgram::generate(const ProgramImage &image, std::vector<bool> &native)
+{
+    ProgramAnalysis analysis(image);
+    int storage = static_cast<int>(image.getStorage());
+    std::vector<bool> modified(storage, false);
+    for (int address : analysis.getSelfModifying())
+        modified[address] = true;
+    native.assign(storage, false);
+
+    std::ostringstream source, dispatch;
+    source << "// Generated by NativeProgram, one function per basic block\n"
+           << "struct NativeContext{\n"
+           << "    int* memory;\n"
+           << "    unsigned char* written;\n"
+           << "    int acc;\n"
+           << "    int pc;\n"
+           << "    unsigned long long left;\n"
+           << "    void* io;\n"
+           << "    int (*read)(void*);\n"
+           << "    void (*print)(void*, int);\n"
+           << "};\n\n";
+    for (const BasicBlock &block : analysis.getBlocks())
+    {
+        bool safe = true;
+        for (int address = block.first; address <= block.last; address++)
+        {
+            Cell cell = image.getPage(address >> ProgramImage::PAGE_BITS)[address & ProgramImage::PAGE_MASK];
+            bool inside = cell.operand >= 0 && cell.operand < storage;
+            if (modified[address] || cell.op == OP_VAR || cell.op >= OP_COUNT ||
+                (cell.op != OP_EMPTY && cell.op != OP_EXIT && !inside))
+                safe = false;
+        }
+        if (!safe)
+            continue;
+        native[block.first] = true;
+        source << "static inline int block_" << block.first
+               << "(NativeContext* c, int* m, unsigned char* w, int& acc)\n{\n";
+        bool stops = false;
+        for (int address = block.first; address <= block.last; address++)
+        {
+            Cell cell = image.getPage(address >> ProgramImage::PAGE_BITS)[address & ProgramImage::PAGE_MASK];
+            int x = cell.operand;
+            switch (cell.op)
+            {
+            case OP_LOAD:
+                source << "    acc = m[" << x << "];\n";
+                break;
+            case OP_STORE:
+                source << "    m[" << x << "] = acc;\n    w[" << x << "] = 1;\n";
+                break;
+            case OP_ADD:
+                source << "    acc = (int)((unsigned)acc + (unsigned)m[" << x << "]);\n";
+                break;
+            case OP_SUB:
+                source << "    acc = (int)((unsigned)acc - (unsigned)m[" << x << "]);\n";
+                break;
+            case OP_READ:
+                source << "    m[" << x << "] = c->read(c->io);\n    w[" << x << "] = 1;\n";
+                break;
+            case OP_PRINT:
+                source << "    c->print(c->io, m[" << x << "]);\n";
+                break;
+            case OP_JUMP:
+                source << "    return " << x << ";\n";
+                stops = true;
+                break;
+            case OP_BRANCHGT:
+                source << "    return acc > 0 ? " << x << " : " << address + 1 << ";\n";
+                stops = true;
+                break;
+            case OP_EXIT:
+                source << "    c->pc = " << address + 1 << ";\n    return -1;\n";
+                stops = true;
+                break;
+            default:
+                break;  // Empty cells are skipped
+            }
+        }
+        if (!stops)
+            source << "    return " << block.last + 1 << ";\n";
+        source << "}\n\n";
+        int length = block.last - block.first + 1;
+        dispatch << "        case " << block.first << ":\n"
+                 << "            if (left < " << length << "ULL)\n"
+                 << "                goto handover;\n"
+                 << "            left -= " << length << "ULL;\n"
+                 << "            pc = block_" << block.first << "(c, m, w, acc);\n"
+                 << "            break;\n";
+    }
+    source << "extern \"C\" int neumann_run(NativeContext* c)\n{\n"
+           << "    int* m = c->memory;\n"
+           << "    unsigned char* w = c->written;\n"
+           << "    int acc = c->acc;\n"
+           << "    int pc = c->pc;\n"
+           << "    unsigned long long left = c->left;\n"
+           << "    for (;;)\n    {\n"
+           << "        switch (pc)\n        {\n"
+           << dispatch.str()
+           << "        default:\n            goto handover;\n"
+           << "        }\n"
+           << "        if (pc < 0)\n        {\n"
+           << "            c->acc = acc;\n            c->left = left;\n            return 1;\n"
+           << "        }\n    }\n"
+           << "handover:\n"
+           << "    c->acc = acc;\n    c->pc = pc;\n    c->left = left;\n    return 0;\n}\n";
+    return source.str();
+}
+
+/// The source and the library are written into a new temporary directory, removed after loading.
+NativeProgram::NativeProgram(const ProgramImage &image, const std::string &compiler)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    std::string source = generate(image, native);
+    const char *temp = std::getenv("TMPDIR");
+    std::string pattern = std::string(temp != nullptr ? temp : "/tmp") + "/neumannXXXXXX";
+    std::vector<char> directory(pattern.begin(), pattern.end());
+    directory.push_back('\0');
+    if (mkdtemp(directory.data()) == nullptr)
+        throw "Native compilation failed.\n";
+    std::string base(directory.data());
+    std::string cpp = base + "/program.cpp", so = base + "/program.so";
+    {
+        std::ofstream file(cpp);
+        file << source;
+    }
+    std::string command = compiler + " -O2 -shared -fPIC -o '" + so + "' '" + cpp + "'";
+    if (std::system(command.c_str()) == 0)
+        library = dlopen(so.c_str(), RTLD_NOW | RTLD_LOCAL);
+    std::remove(cpp.c_str());
+    std::remove(so.c_str());
+    rmdir(base.c_str());
+    if (library == nullptr)
+        throw "Native compilation failed.\n";
+    entry = reinterpret_cast<NativeEntry>(dlsym(library, "neumann_run"));
+    if (entry == nullptr)
+    {
+        dlclose(library);
+        throw "Native compilation failed.\n";
+    }
+    int storage = static_cast<int>(image.getStorage());
+    for (int address = 0; address < storage; address++)
+    {
+        Cell cell = image.getPage(address >> ProgramImage::PAGE_BITS)[address & ProgramImage::PAGE_MASK];
+        if ((cell.op == OP_STORE || cell.op == OP_READ) && cell.operand >= 0 && cell.operand < storage)
+            targets.push_back(cell.operand);
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    written.assign(storage, 0);
+#else
+    (void)image;
+    (void)compiler;
+    throw "Native code is not supported on this platform.\n";
+#endif
+}
+
+NativeProgram::~NativeProgram()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (library != nullptr)
+        dlclose(library);
+#endif
+}
+
+/// The memory is copied into an int array once per run, the two copies are kept in sync.
+/* Between two native runs the interpreter executes one instruction at a time, until the PC
+ * is at a block with native code again. Only the cells the program can write are checked
+ * after native code. A single instruction writes at most one cell, the one in MAR, anything
+ * else the write counter of the ControlUnit shows is copied again in full.
+ * With a time limit the native code gets slices of WATCHDOG_SLICE steps, like the engines,
+ * and the clock is read between them.
+ */
+RunResult NativeProgram::run(ControlUnit &CU, unsigned long long maxSteps)
+{
+    if (CU.getArithmetic() != ARITH_WRAP || CU.getWordWidth() != WORD_INT32)
+        return CU.run(maxSteps);
+    int storage = static_cast<int>(native.size());
+    memory.resize(storage);
+    for (int i = 0; i < storage; i++)
+        memory[i] = CU.cellAt(i).operand;  // The ControlUnit may have changed since the last run
+    unsigned long long writes = CU.getWrites();
+    bool watchdog = CU.getTimeLimit() > 0;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(CU.getTimeLimit()));
+    unsigned long long check = watchdog ? std::min(maxSteps, WATCHDOG_SLICE) : maxSteps;  // Where the clock is read next
+    RunResult total{STATUS_STEP_LIMIT, 0};
+    while (total.steps < maxSteps)
+    {
+        if (total.steps >= check)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                total.status = STATUS_TIMEOUT;
+                break;
+            }
+            check = total.steps + std::min(maxSteps - total.steps, WATCHDOG_SLICE);
+        }
+        int pc = CU.getPC();
+        if (pc >= 0 && pc < storage && native[pc])
+        {
+            unsigned long long budget = check - total.steps;
+            NativeContext context{memory.data(), written.data(), CU.getAcc(), pc, budget,
+                                  &CU, nativeRead, nativePrint};
+            int halted = entry(&context);
+            total.steps += budget - context.left;
+            for (int address : targets)
+                if (written[address])
+                {
+                    written[address] = 0;
+                    CU.setMAR(address);
+                    CU.setMDR(Cell{memory[address], OP_VAR});
+                    CU.writeEnable();
+                }
+            writes = CU.getWrites();
+            CU.setPC(context.pc);
+            CU.setACC(context.acc);
+            if (halted)
+            {
+                total.status = STATUS_HALTED;
+                break;
+            }
+            if (context.left == 0)
+                continue;  // The budget or the slice is used up
+        }
+        RunResult single = CU.run(1);
+        total.steps += single.steps;
+        if (CU.getWrites() == writes + 1)
+            memory[CU.getMAR()] = CU.cellAt(CU.getMAR()).operand;  // STORE or READ
+        else if (CU.getWrites() != writes)
+            for (int i = 0; i < storage; i++)
+                memory[i] = CU.cellAt(i).operand;
+        writes = CU.getWrites();
+        if (single.status != STATUS_STEP_LIMIT)
+        {
+            total.status = single.status;
+            break;
+        }
+    }
+    CU.flush();  // The buffered output is written when the run stops
+    return total;
+}
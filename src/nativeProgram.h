@@ -0,0 +1,73 @@
+#ifndef NATIVEPROGRAM_H_INCLUDED
+#define NATIVEPROGRAM_H_INCLUDED
+
+#include "controlUnit.h"
+#include "programImage.h"
+#include <string>
+#include <vector>
+
+/// NativeContext struct
+/* The state the generated code works on. The generated source declares the same struct,
+ * the two sides only share this layout and the entry point.
+ */
+struct NativeContext{
+    int* memory;                    /// Operands of every cell
+    unsigned char* written;         /// Cells written by STORE or READ, they become variables
+    int acc;                        /// Accumulator
+    int pc;                         /// Next instruction when the generated code returns
+    unsigned long long left;        /// Step budget, whole blocks are taken from it
+    void* io;                       /// The ControlUnit, passed back to the callbacks
+    int (*read)(void*);             /// READ: IOUnit::read of the ControlUnit
+    void (*print)(void*, int);      /// PRINT: IOUnit::print of the ControlUnit
+};
+
+/// Entry point of the generated code.
+/// @return 1 if an EXIT stopped the program, 0 if the interpreter has to go on at pc
+typedef int (*NativeEntry)(NativeContext*);
+
+/// NativeProgram class
+/* Ahead-of-time compiler: the program is translated into C++, one function per basic block,
+ * built into a shared library with the system compiler and loaded with dlopen.
+ * Every operand and jump target is a constant of the generated code, PRINT and READ call
+ * back into the IOUnit of the ControlUnit. A block only gets native code if it can't fail:
+ * no operand outside the memory, no variable, and no cell that the program may overwrite.
+ * The other blocks, and the last instructions of a step budget that does not hold a whole
+ * block, run on the interpreter of the ControlUnit, which hands back at the next block.
+ * Native code wraps around 32-bit words, the other arithmetics and 64-bit words only use the interpreter.
+ * Needs a POSIX system with a C++ compiler at run time.
+ */
+class NativeProgram{
+    void* library=nullptr;          /// Handle of the loaded shared library
+    NativeEntry entry=nullptr;      /// The dispatcher of the generated code
+    std::vector<bool> native;       /// First cells of the blocks with native code
+    std::vector<int> memory;        /// Operands of the memory, kept in sync with the ControlUnit during a run
+    std::vector<unsigned char> written; /// Cells written by the last native code, cleared when they are copied back
+    std::vector<int> targets;       /// Every address a STORE or READ of the program can write
+
+    NativeProgram(const NativeProgram&);
+    NativeProgram& operator=(const NativeProgram&);
+public:
+    /// Constructor.
+    /// Generates, compiles and loads the native code. Throws an exception if it fails.
+    /// @param image - the program
+    /// @param compiler - command of the C++ compiler
+    NativeProgram(const ProgramImage& image, const std::string& compiler="c++");
+
+    /// Unloads the library.
+    ~NativeProgram();
+
+    /// Translates a program into C++.
+    /// @param image - the program
+    /// @param native - receives the first cell of every block that has a function
+    /// @return the source of the library
+    static std::string generate(const ProgramImage& image, std::vector<bool>& native);
+
+    /// Runs the program of a ControlUnit like ControlUnit::run(), with the same result.
+    /// The ControlUnit must run the program the NativeProgram was compiled from.
+    /// @param CU - the machine, its registers, memory and streams are used
+    /// @param maxSteps - maximum number of instructions to execute
+    /// @return the status and the number of executed instructions
+    RunResult run(ControlUnit& CU, unsigned long long maxSteps=~0ULL);
+};
+
+#endif // NATIVEPROGRAM_H_INCLUDED
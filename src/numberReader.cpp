@@ -0,0 +1,126 @@
+#include "numberReader.h"
+#include <cerrno>
+#include <climits>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#define open _open
+#define read _read
+#define close _close
+#define lseek _lseeki64
+#define O_RDONLY (_O_RDONLY | _O_BINARY)
+#endif
+
+NumberReader::NumberReader(std::string filename, size_t chunkSize): owned(true), chunk(chunkSize > 0 ? chunkSize : 1)
+{
+    std::string path = "input/" + filename;
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw "Input file open failed.\n";
+}
+
+/// The descriptor may have been read already, the positions are counted from where it stands.
+NumberReader::NumberReader(int fd, size_t chunkSize): fd(fd), owned(false), chunk(chunkSize > 0 ? chunkSize : 1)
+{
+    long long offset = lseek(fd, 0, SEEK_CUR);
+    chunkStart = offset > 0 ? offset : 0;
+}
+
+NumberReader::~NumberReader()
+{
+    if (owned)
+        close(fd);
+}
+
+/// A pipe may return less than a chunk, only 0 bytes mean the end of the input.
+bool NumberReader::refill()
+{
+    chunkStart += end;
+    pos = 0;
+    end = 0;
+    while (true)
+    {
+        long n = read(fd, chunk.data(), (unsigned)chunk.size());
+        if (n > 0)
+        {
+            end = n;
+            return true;
+        }
+        if (n == 0)
+            return false;
+        if (errno != EINTR)
+            return false;  // Read error, handled as the end of the input
+    }
+}
+
+bool NumberReader::seek(long long offset)
+{
+    if (offset >= chunkStart && offset <= chunkStart + (long long)end)
+    {
+        pos = offset - chunkStart;  // Still in the current chunk
+        return true;
+    }
+    if (lseek(fd, offset, SEEK_SET) < 0)
+        return false;
+    chunkStart = offset;
+    pos = 0;
+    end = 0;
+    return true;
+}
+
+static bool isSpace(int c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/// Like operator>> for an int, the sign and the digits are consumed even if they are no number.
+/* After a failure the IOUnit reads the next word of the stream and reports that one, so the
+ * reader gives the word after the consumed characters as the wrong input.
+ */
+bool NumberReader::next(int &val, std::string &wrong)
+{
+    int c = peek();
+    while (isSpace(c))
+    {
+        pos++;
+        c = peek();
+    }
+    bool negative = false;
+    if (c == '-' || c == '+')
+    {
+        negative = c == '-';
+        pos++;
+        c = peek();
+    }
+    bool digits = false;
+    unsigned long long magnitude = 0;
+    while (c >= '0' && c <= '9')
+    {
+        digits = true;
+        if (magnitude <= (unsigned long long)INT_MAX + 1)
+            magnitude = magnitude * 10 + (c - '0');
+        pos++;
+        c = peek();
+    }
+    if (digits && magnitude <= (unsigned long long)INT_MAX + (negative ? 1 : 0))
+    {
+        val = negative ? (int)-(long long)magnitude : (int)magnitude;
+        return true;
+    }
+    val = !digits ? 0 : negative ? INT_MIN : INT_MAX;  // The closest value if it does not fit
+    while (isSpace(c))
+    {
+        pos++;
+        c = peek();
+    }
+    while (c != -1 && !isSpace(c))
+    {
+        wrong += (char)c;  // The word after the failed number, the caller reports it
+        pos++;
+        c = peek();
+    }
+    return false;
+}
@@ -0,0 +1,68 @@
+#ifndef NUMBERREADER_H_INCLUDED
+#define NUMBERREADER_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+/// Size of the chunks a NumberReader reads at once.
+const size_t INPUT_CHUNK_SIZE = 65536;
+
+/// NumberReader class
+/* Input source of the READ instruction for large inputs.
+ * Reads a file or a pipe in big chunks with the system read call and scans the
+ * integers by hand, without the locale machinery of std::istream.
+ * It accepts what operator>> accepts for an int: whitespace, an optional sign and decimal digits.
+ */
+class NumberReader{
+    int fd;                     /// The file descriptor that is read
+    bool owned;                 /// The reader opened the file and closes it
+    std::vector<char> chunk;    /// The last chunk that was read
+    size_t pos=0;               /// Next character in the chunk
+    size_t end=0;               /// Number of valid characters in the chunk
+    long long chunkStart=0;     /// Offset of the chunk in the file
+
+    /// Reads the next chunk.
+    /// @return false at the end of the input
+    bool refill();
+
+    /// Gives the next character without consuming it.
+    /// @return the character, -1 at the end of the input
+    int peek(){ return pos < end || refill() ? (unsigned char)chunk[pos] : -1; }
+
+    NumberReader(const NumberReader&);
+    NumberReader& operator=(const NumberReader&);
+public:
+    /// Constructor.
+    /// Opens a file of the input directory. Throws an exception if it can't be opened.
+    /// @param filename - the file to read
+    /// @param chunkSize - number of bytes to read at once
+    NumberReader(std::string filename, size_t chunkSize=INPUT_CHUNK_SIZE);
+
+    /// Constructor.
+    /// Reads an open file descriptor, e.g. 0 for the standard input. The descriptor is not closed.
+    /// @param fd - the file descriptor
+    /// @param chunkSize - number of bytes to read at once
+    NumberReader(int fd, size_t chunkSize=INPUT_CHUNK_SIZE);
+
+    /// Closes the file if it was opened by the reader.
+    ~NumberReader();
+
+    /// Reads the next integer.
+    /// On a wrong input the sign and digits are consumed and then the next whitespace separated
+    /// word, like the IOUnit does with a stream.
+    /// @param val - the read integer, 0 if there was no number, the closest int if it does not fit
+    /// @param wrong - receives the word after the wrong input, empty at the end of the input
+    /// @return true if a valid integer was read
+    bool next(int& val, std::string& wrong);
+
+    /// Get the position of the next character.
+    /// @return the offset in the file
+    long long tell(){ return chunkStart + (long long)pos; }
+
+    /// Continues reading at an offset of the file.
+    /// @param offset - the position returned by tell()
+    /// @return false if the input can't be rewound, e.g. a pipe
+    bool seek(long long offset);
+};
+
+#endif // NUMBERREADER_H_INCLUDED
@@ -0,0 +1,139 @@
+#include "profiler.h"
+#include <algorithm>
+#include <iomanip>
+
+/// Constructor, the counters are sized by attach().
+Profiler::Profiler(std::ostream *dump): dump(dump), opcodes(OP_COUNT + 1, 0) {}
+
+/// One more counter than the memory size: the threaded engine reports the end of the memory as an instruction.
+void Profiler::attach(std::shared_ptr<const ProgramImage> image, int storage)
+{
+    size_t size = storage + 1;
+    program = image;
+    executions.assign(size, 0);
+    reads.assign(size, 0);
+    writes.assign(size, 0);
+    taken.assign(size, 0);
+    notTaken.assign(size, 0);
+    targets.assign(size, -1);
+    ops.assign(size, OP_EMPTY);
+    std::fill(opcodes.begin(), opcodes.end(), 0);
+}
+
+void Profiler::reset()
+{
+    std::fill(opcodes.begin(), opcodes.end(), 0);
+    std::fill(executions.begin(), executions.end(), 0);
+    std::fill(reads.begin(), reads.end(), 0);
+    std::fill(writes.begin(), writes.end(), 0);
+    std::fill(taken.begin(), taken.end(), 0);
+    std::fill(notTaken.begin(), notTaken.end(), 0);
+    std::fill(targets.begin(), targets.end(), -1);
+    std::fill(ops.begin(), ops.end(), OP_EMPTY);
+}
+
+void Profiler::halted()
+{
+    if (dump != nullptr)
+        report(*dump);
+}
+
+/// The end of the memory is not an instruction, it is not counted.
+unsigned long long Profiler::getTotal() const
+{
+    unsigned long long total = 0;
+    for (int op = 0; op < OP_COUNT; op++)
+        total += opcodes[op];
+    return total;
+}
+
+/// Reads a counter of an address, 0 outside the memory.
+static unsigned long long counterAt(const std::vector<unsigned long long> &counters, int address)
+{
+    if (address < 0 || (size_t)address >= counters.size())
+        return 0;
+    return counters[address];
+}
+
+unsigned long long Profiler::getExecutions(int address) const { return counterAt(executions, address); }
+unsigned long long Profiler::getReads(int address) const { return counterAt(reads, address); }
+unsigned long long Profiler::getWrites(int address) const { return counterAt(writes, address); }
+unsigned long long Profiler::getTaken(int address) const { return counterAt(taken, address); }
+unsigned long long Profiler::getNotTaken(int address) const { return counterAt(notTaken, address); }
+
+std::vector<HotLoop> Profiler::hotLoops() const
+{
+    std::vector<HotLoop> loops;
+    for (size_t tail = 0; tail < targets.size(); tail++)
+    {
+        int head = targets[tail];
+        if (head < 0 || (size_t)head > tail || taken[tail] == 0)
+            continue;  // Not a taken backward jump
+        unsigned long long instructions = 0;
+        for (size_t address = head; address <= tail; address++)
+            instructions += executions[address];
+        loops.push_back(HotLoop{head, (int)tail, taken[tail], instructions});
+    }
+    std::stable_sort(loops.begin(), loops.end(), [](const HotLoop &a, const HotLoop &b) {
+        return a.instructions > b.instructions;
+    });
+    return loops;
+}
+
+/// Percentage of a counter, 0 if nothing was executed.
+static double percent(unsigned long long count, unsigned long long total)
+{
+    return total == 0 ? 0.0 : 100.0 * count / total;
+}
+
+void Profiler::report(std::ostream &os, size_t top) const
+{
+    unsigned long long total = getTotal();
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(2);
+
+    os << "Flat profile, " << total << " instructions\n";
+    os << "  " << std::left << std::setw(10) << "opcode" << std::right << std::setw(14) << "count" << std::setw(9) << "%" << '\n';
+    for (int op = 0; op < OP_COUNT; op++)
+        if (opcodes[op] != 0)
+            os << "  " << std::left << std::setw(10) << opcodeName((Opcode)op) << std::right
+               << std::setw(14) << opcodes[op] << std::setw(9) << percent(opcodes[op], total) << '\n';
+
+    // The hottest instruction addresses, the end of the memory is left out
+    std::vector<int> hot;
+    for (size_t address = 0; address + 1 < executions.size(); address++)
+        if (executions[address] != 0)
+            hot.push_back((int)address);
+    std::stable_sort(hot.begin(), hot.end(), [this](int a, int b) { return executions[a] > executions[b]; });
+    if (hot.size() > top)
+        hot.resize(top);
+    os << "Hot addresses\n";
+    os << "  " << std::setw(8) << "address" << "  " << std::left << std::setw(10) << "opcode" << std::right
+       << std::setw(14) << "count" << std::setw(9) << "%" << '\n';
+    for (int address : hot)
+        os << "  " << std::setw(8) << address << "  " << std::left << std::setw(10) << opcodeName(ops[address]) << std::right
+           << std::setw(14) << executions[address] << std::setw(9) << percent(executions[address], total) << '\n';
+
+    os << "Branches\n";
+    os << "  " << std::setw(8) << "address" << std::setw(8) << "target" << std::setw(14) << "taken" << std::setw(14) << "not taken" << '\n';
+    for (size_t address = 0; address < ops.size(); address++)
+        if (ops[address] == OP_BRANCHGT && targets[address] >= 0)
+            os << "  " << std::setw(8) << address << std::setw(8) << targets[address]
+               << std::setw(14) << taken[address] << std::setw(14) << notTaken[address] << '\n';
+
+    std::vector<HotLoop> loops = hotLoops();
+    if (loops.size() > top)
+        loops.resize(top);
+    os << "Hot loops\n";
+    os << "  " << std::setw(15) << "cells" << std::setw(14) << "iterations" << std::setw(14) << "instructions" << std::setw(9) << "%" << '\n';
+    for (const HotLoop &loop : loops)
+    {
+        std::string cells = std::to_string(loop.head) + "-" + std::to_string(loop.tail);
+        os << "  " << std::setw(15) << cells << std::setw(14) << loop.iterations
+           << std::setw(14) << loop.instructions << std::setw(9) << percent(loop.instructions, total) << '\n';
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
@@ -0,0 +1,138 @@
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#include "instruction.h"
+#include "programImage.h"
+#include <iostream>
+#include <memory>
+#include <vector>
+
+/// HotLoop struct
+/* A backward jump that was taken, with the instructions between its target and itself. */
+struct HotLoop{
+    int head;                           /// Target of the backward jump, the first cell of the loop
+    int tail;                           /// Address of the JUMP or BRANCHGT that closes the loop
+    unsigned long long iterations;      /// Number of times the backward jump was taken
+    unsigned long long instructions;    /// Instructions executed inside [head, tail]
+};
+
+/// Profiler class
+/* Instrumentation policy of ControlUnit::run(Profiler&).
+ * Counts the executed instructions per opcode and per address, the data reads and writes
+ * per address, and how many times every JUMP and BRANCHGT was taken.
+ * The counters are kept between runs of the same program, reset() clears them.
+ * An instruction that stops the program with an error is taken back by failed(),
+ * so getTotal() is the number of steps the runs reported.
+ * The engines call the member functions below directly, a run without a Profiler
+ * uses NoProbe and does not pay for any of this.
+ */
+class Profiler{
+    std::ostream* dump;                             /// Where the report goes on halt, nullptr for nowhere
+    std::vector<unsigned long long> opcodes;        /// Executions per opcode
+    std::vector<unsigned long long> executions;     /// Executions per address
+    std::vector<unsigned long long> reads;          /// Data reads per address
+    std::vector<unsigned long long> writes;         /// Data writes per address
+    std::vector<unsigned long long> taken;          /// Taken jumps per address
+    std::vector<unsigned long long> notTaken;       /// Not taken branches per address
+    std::vector<int> targets;                       /// Jump target per address, -1 if there was no jump
+    std::vector<Opcode> ops;                        /// Last opcode executed per address
+    std::shared_ptr<const ProgramImage> program;    /// The profiled program, nullptr before attach()
+public:
+    /// Constructor.
+    /// @param dump - the stream the report is written to when the program halts, nullptr for none
+    Profiler(std::ostream* dump=nullptr);
+
+    /// Sizes the counters for a program and clears them.
+    /// @param image - the profiled program
+    /// @param storage - memory size of the profiled program
+    void attach(std::shared_ptr<const ProgramImage> image, int storage);
+
+    /// Tells if the counters belong to the program.
+    /// @param image - a program
+    /// @return true if attach() was last called with the program
+    bool isAttached(const std::shared_ptr<const ProgramImage>& image) const { return program != nullptr && program == image; }
+
+    /// Clears every counter.
+    void reset();
+
+    /// Counts an executed instruction.
+    /// @param address - where the instruction was fetched from
+    /// @param op - opcode of the instruction
+    void executed(int address, Opcode op){ opcodes[op]++; executions[address]++; ops[address] = op; }
+
+    /// Takes back the count of an instruction that stopped the program without completing.
+    /// @param address - where the instruction was fetched from
+    /// @param op - opcode of the instruction
+    void failed(int address, Opcode op){ opcodes[op]--; executions[address]--; }
+
+    /// Counts a JUMP or BRANCHGT.
+    /// @param address - address of the jump
+    /// @param target - the jump address
+    /// @param wasTaken - true if the program counter was set to the target
+    void branch(int address, int target, bool wasTaken){
+        targets[address] = target;
+        if (wasTaken)
+            taken[address]++;
+        else
+            notTaken[address]++;
+    }
+
+    /// Counts a data read.
+    /// @param address - the address that was read
+    void memoryRead(int address){ reads[address]++; }
+
+    /// Counts a data write.
+    /// @param address - the address that was written
+    void memoryWrite(int address, int){ writes[address]++; }
+
+    /// The new value of the accumulator is not profiled.
+    void accumulator(int){}
+
+    /// Called by the ControlUnit when the program halts, writes the report to the dump stream.
+    void halted();
+
+    /// Get the number of executed instructions.
+    /// @return the sum of the opcode counters
+    unsigned long long getTotal() const;
+
+    /// Get the number of executions of an opcode.
+    /// @param op - the opcode
+    /// @return the counter
+    unsigned long long getOpcodeCount(Opcode op) const { return opcodes[op]; }
+
+    /// Get the number of executions of an address.
+    /// @param address - the instruction address
+    /// @return the counter, 0 outside the memory
+    unsigned long long getExecutions(int address) const;
+
+    /// Get the number of data reads of an address.
+    /// @param address - the data address
+    /// @return the counter, 0 outside the memory
+    unsigned long long getReads(int address) const;
+
+    /// Get the number of data writes of an address.
+    /// @param address - the data address
+    /// @return the counter, 0 outside the memory
+    unsigned long long getWrites(int address) const;
+
+    /// Get the number of times the jump at the address was taken.
+    /// @param address - address of a JUMP or BRANCHGT
+    /// @return the counter, 0 outside the memory
+    unsigned long long getTaken(int address) const;
+
+    /// Get the number of times the branch at the address was not taken.
+    /// @param address - address of a BRANCHGT
+    /// @return the counter, 0 outside the memory
+    unsigned long long getNotTaken(int address) const;
+
+    /// Finds the loops: the taken backward jumps, the most expensive one first.
+    /// @return the loops ordered by the number of instructions executed inside them
+    std::vector<HotLoop> hotLoops() const;
+
+    /// Writes the flat profile, the hottest addresses, the branches and the hot loops.
+    /// @param os - the stream to write to
+    /// @param top - number of addresses and loops to list
+    void report(std::ostream& os, size_t top=10) const;
+};
+
+#endif // PROFILER_H_INCLUDED
@@ -0,0 +1,192 @@
+#include "programAnalysis.h"
+#include "controlUnit.h"
+#include <algorithm>
+
+ProgramAnalysis::ProgramAnalysis(const std::vector<Cell> &memory): cells(memory)
+{
+    analyze();
+}
+
+ProgramAnalysis::ProgramAnalysis(const ProgramImage &image)
+{
+    cells.reserve(image.getStorage());
+    for (size_t address = 0; address < image.getStorage(); address++)
+        cells.push_back(image.getPage(address >> ProgramImage::PAGE_BITS)[address & ProgramImage::PAGE_MASK]);
+    analyze();
+}
+
+ProgramAnalysis::ProgramAnalysis(MemoryUnit &memory)
+{
+    cells.reserve(memory.getStorage());
+    for (size_t address = 0; address < memory.getStorage(); address++)
+        cells.push_back(memory.cellAt(static_cast<int>(address)));
+    analyze();
+}
+
+/// Follows the runtime rules: a failing instruction stops the program.
+bool ProgramAnalysis::continues(int address) const
+{
+    const Cell &cell = cells[address];
+    bool valid = cell.operand >= 0 && static_cast<size_t>(cell.operand) < cells.size();
+    switch (cell.op)
+    {
+    case OP_JUMP:
+    case OP_VAR:
+    case OP_EXIT:
+        return false;
+    case OP_EMPTY:
+        return true;  // An empty cell does nothing
+    default:
+        return valid;
+    }
+}
+
+int ProgramAnalysis::successors(int address, int next[2]) const
+{
+    const Cell &cell = cells[address];
+    bool valid = cell.operand >= 0 && static_cast<size_t>(cell.operand) < cells.size();
+    int count = 0;
+    if ((cell.op == OP_JUMP || cell.op == OP_BRANCHGT) && valid)
+        next[count++] = cell.operand;
+    if (continues(address) && static_cast<size_t>(address) + 1 < cells.size())
+        next[count++] = address + 1;
+    return count;
+}
+
+void ProgramAnalysis::analyze()
+{
+    int storage = static_cast<int>(cells.size());
+    reachable.assign(storage, false);
+    blockOf.assign(storage, -1);
+    if (storage == 0)
+        return;
+
+    // Reachable cells, depth first from address 0
+    std::vector<bool> target(storage, false);
+    std::vector<int> work(1, 0);
+    reachable[0] = true;
+    while (!work.empty())
+    {
+        int address = work.back();
+        work.pop_back();
+        const Cell &cell = cells[address];
+        bool valid = cell.operand >= 0 && cell.operand < storage;
+        if (cell.op == OP_JUMP || cell.op == OP_BRANCHGT)
+        {
+            if (valid)
+                target[cell.operand] = true;
+            else
+                badJumps.push_back(address);
+        }
+        else if (cell.op >= OP_LOAD && cell.op <= OP_PRINT && !valid)
+            badOperands.push_back(address);
+        int next[2];
+        int count = successors(address, next);
+        if (address == storage - 1 && continues(address))
+            fallsOff = true;
+        for (int k = 0; k < count; k++)
+            if (!reachable[next[k]])
+            {
+                reachable[next[k]] = true;
+                work.push_back(next[k]);
+            }
+    }
+
+    // Basic blocks: a block ends at a jump, at a cell that stops the program and before a jump target
+    for (int address = 0; address < storage; address++)
+    {
+        if (!reachable[address])
+            continue;
+        bool leader = address == 0 || target[address] || !reachable[address - 1] ||
+                      cells[address - 1].op == OP_BRANCHGT || !continues(address - 1);
+        if (leader)
+            blocks.push_back(BasicBlock{address, address, std::vector<int>()});
+        blocks.back().last = address;
+        blockOf[address] = static_cast<int>(blocks.size()) - 1;
+    }
+    for (BasicBlock &block : blocks)
+    {
+        int next[2];
+        int count = successors(block.last, next);
+        for (int k = 0; k < count; k++)
+            if (std::find(block.successors.begin(), block.successors.end(), blockOf[next[k]]) == block.successors.end())
+                block.successors.push_back(blockOf[next[k]]);
+    }
+
+    // Problems
+    for (int address = 0; address < storage; address++)
+    {
+        const Cell &cell = cells[address];
+        if (!reachable[address])
+        {
+            if (cell.op != OP_EMPTY && cell.op != OP_VAR)
+                unreachable.push_back(address);
+            continue;
+        }
+        if ((cell.op == OP_STORE || cell.op == OP_READ) && cell.operand >= 0 && cell.operand < storage &&
+            reachable[cell.operand])
+            selfModifying.push_back(cell.operand);
+    }
+    std::sort(badJumps.begin(), badJumps.end());
+    std::sort(badOperands.begin(), badOperands.end());
+    std::sort(selfModifying.begin(), selfModifying.end());
+    selfModifying.erase(std::unique(selfModifying.begin(), selfModifying.end()), selfModifying.end());
+}
+
+int ProgramAnalysis::getBlock(int address) const
+{
+    if (address < 0 || static_cast<size_t>(address) >= blockOf.size())
+        return -1;
+    return blockOf[address];
+}
+
+bool ProgramAnalysis::isReachable(int address) const
+{
+    return address >= 0 && static_cast<size_t>(address) < reachable.size() && reachable[address];
+}
+
+bool ProgramAnalysis::isSelfModifying(int address) const
+{
+    return std::binary_search(selfModifying.begin(), selfModifying.end(), address);
+}
+
+bool ProgramAnalysis::isSafe() const
+{
+    return !cells.empty() && badJumps.empty() && badOperands.empty() && selfModifying.empty() && !fallsOff;
+}
+
+/// Writes a list of addresses after a title, or nothing if the list is empty.
+static void writeAddresses(std::ostream &os, const char *title, const std::vector<int> &addresses)
+{
+    if (addresses.empty())
+        return;
+    os << title << ':';
+    for (int address : addresses)
+        os << ' ' << address;
+    os << '\n';
+}
+
+void ProgramAnalysis::report(std::ostream &os) const
+{
+    os << "Basic blocks: " << blocks.size() << '\n';
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        os << "  " << b << ": " << blocks[b].first << '-' << blocks[b].last << ' '
+           << opcodeName(cells[blocks[b].last].op) << " ->";
+        for (int successor : blocks[b].successors)
+            os << ' ' << successor;
+        os << '\n';
+    }
+    problems(os);
+    os << (isSafe() ? "Safe: every address is inside the memory\n" : "Not safe\n");
+}
+
+void ProgramAnalysis::problems(std::ostream &os) const
+{
+    writeAddresses(os, "Unreachable instructions", unreachable);
+    writeAddresses(os, "Jumps out of range", badJumps);
+    writeAddresses(os, "Operands out of range", badOperands);
+    writeAddresses(os, "Executed cells written by the program", selfModifying);
+    if (fallsOff)
+        os << "The program can run past the end of the memory\n";
+}
@@ -0,0 +1,121 @@
+#ifndef PROGRAMANALYSIS_H_INCLUDED
+#define PROGRAMANALYSIS_H_INCLUDED
+
+#include "instruction.h"
+#include "programImage.h"
+#include <iostream>
+#include <vector>
+
+class MemoryUnit;
+
+/// BasicBlock struct
+/* Cells that always run one after the other: only the first one is a jump target,
+ * only the last one can jump or stop the program.
+ */
+struct BasicBlock{
+    int first;                      /// Address of the first cell
+    int last;                       /// Address of the last cell
+    std::vector<int> successors;    /// Indices of the blocks that can run next
+};
+
+/// ProgramAnalysis class
+/* Static analysis of a program, made once at load time.
+ * Execution starts at address 0, every cell reachable from there is an instruction.
+ * The operands never change while a program runs (STORE and READ only write variables),
+ * so the reachable cells, the jump targets and the control-flow graph are known before the run.
+ * A self-modifying write can only turn an instruction into a variable, which stops the program:
+ * the graph may have more edges than a run takes, never less.
+ */
+class ProgramAnalysis{
+    std::vector<Cell> cells;                /// The analysed memory
+    std::vector<bool> reachable;            /// Cells that can be executed
+    std::vector<int> blockOf;               /// Block index of every cell, -1 if it is not reachable
+    std::vector<BasicBlock> blocks;         /// Basic blocks in address order
+    std::vector<int> unreachable;           /// Instructions that can never be executed
+    std::vector<int> badJumps;              /// Reachable JUMP and BRANCHGT with a target outside the memory
+    std::vector<int> badOperands;           /// Reachable data instructions with an address outside the memory
+    std::vector<int> selfModifying;         /// Reachable cells that a reachable STORE or READ writes
+    bool fallsOff=false;                    /// The last cell of the memory can run into the end of the memory
+
+    /// Checks if the execution can go on with the next cell after a cell.
+    /// @param address - a cell
+    /// @return false for a jump, a stop or an operand outside the memory
+    bool continues(int address) const;
+
+    /// Finds the cells that can run after a cell.
+    /// @param address - a reachable cell
+    /// @param next - receives at most two addresses
+    /// @return the number of successors, 0 if the cell stops the program
+    int successors(int address, int next[2]) const;
+
+    /// Runs the analysis on the cells.
+    void analyze();
+public:
+    /// Constructor.
+    /// @param memory - the cells, address 0 first
+    ProgramAnalysis(const std::vector<Cell>& memory);
+
+    /// Constructor.
+    /// Analyses the initial memory of a loaded program.
+    /// @param image - the program
+    ProgramAnalysis(const ProgramImage& image);
+
+    /// Constructor.
+    /// Analyses the current content of a memory, including its earlier writes.
+    /// @param memory - the memory
+    ProgramAnalysis(MemoryUnit& memory);
+
+    /// Get the basic blocks.
+    /// @return the blocks in address order
+    const std::vector<BasicBlock>& getBlocks() const { return blocks; }
+
+    /// Get the block of a cell.
+    /// @param address - the cell
+    /// @return the block index, -1 if the cell is not reachable
+    int getBlock(int address) const;
+
+    /// Checks if a cell can be executed.
+    /// @param address - the cell
+    /// @return true if the cell is reachable from address 0
+    bool isReachable(int address) const;
+
+    /// Get the instructions that are never executed.
+    /// @return their addresses
+    const std::vector<int>& getUnreachable() const { return unreachable; }
+
+    /// Get the jumps with a target outside the memory.
+    /// @return their addresses
+    const std::vector<int>& getBadJumps() const { return badJumps; }
+
+    /// Get the instructions that address a cell outside the memory.
+    /// @return their addresses
+    const std::vector<int>& getBadOperands() const { return badOperands; }
+
+    /// Get the cells that are both executed and written.
+    /// @return their addresses
+    const std::vector<int>& getSelfModifying() const { return selfModifying; }
+
+    /// Checks if a cell is both executed and written.
+    /// @param address - the cell
+    /// @return true if a reachable STORE or READ writes the reachable cell
+    bool isSelfModifying(int address) const;
+
+    /// Checks if the program can run past the last cell of the memory.
+    /// @return true if the last cell can fall through
+    bool getFallsOff() const { return fallsOff; }
+
+    /// Checks if no run of the program can leave the memory or modify its own code.
+    /// @return true if every reachable operand and jump target is inside the memory,
+    ///         the program cannot fall off the end and writes no executed cell
+    bool isSafe() const;
+
+    /// Writes the blocks and the problems found.
+    /// @param os - the stream to write to
+    void report(std::ostream& os) const;
+
+    /// Writes only the problems found, nothing for a clean program.
+    /// @param os - the stream to write to
+    void problems(std::ostream& os) const;
+};
+
+#endif // PROGRAMANALYSIS_H_INCLUDED
@@ -0,0 +1,304 @@
+#include "programImage.h"
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// Converts a number of the program file, the "0x" prefix is skipped.
+/* FORMAT_LEGACY_DECIMAL reads the digits after the prefix as a decimal number,
+ * like the original loader did. FORMAT_HEX reads real hexadecimal digits and allows a minus sign.
+ * Throws an exception if the number does not fit in an int.
+ */
+static int parseNumber(const char *begin, const char *end, NumberFormat format)
+{
+    if (format == FORMAT_LEGACY_DECIMAL)
+    {
+        const char *p = begin + 2;  // Skip "0x" prefix
+        long long result = 0;
+        for (; p < end; p++)
+        {
+            result = result * 10 + (*p - '0');  // Convert each character to a numeric value
+            if (result > INT_MAX || result < INT_MIN)
+                throw "Program file is damaged.\n";
+        }
+        return static_cast<int>(result);
+    }
+    bool negative = begin < end && *begin == '-';
+    const char *p = negative ? begin + 1 : begin;
+    if (end - p >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        p += 2;
+    unsigned long long result = 0;
+    for (; p < end; p++)
+    {
+        char c = *p;
+        unsigned digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            break;  // The number ends at the first non-hexadecimal character
+        result = result * 16 + digit;
+        if (result > (negative ? 0x80000000ULL : 0x7FFFFFFFULL))
+            throw "Program file is damaged.\n";
+    }
+    return negative ? static_cast<int>(-static_cast<long long>(result)) : static_cast<int>(result);
+}
+
+/// Converts a hexadecimal string (e.g., "0x0010") to an integer, ignoring leading zeros.
+int ProgramImage::HextoInt(std::string hex)
+{
+    if (hex.length() < 2)
+        return 0;
+    return parseNumber(hex.data(), hex.data() + hex.length(), FORMAT_LEGACY_DECIMAL);
+}
+
+/// Perfect hash of the instruction names: every name gets a different slot of 32.
+static unsigned opcodeHash(const char *begin, size_t length)
+{
+    return (static_cast<unsigned char>(begin[0]) * 3 + length) & 31;
+}
+
+/// Looks up the opcode of an instruction name with one table access and one comparison.
+/// @return the opcode, OP_EMPTY for an unknown name
+static Opcode lookupOpcode(const char *begin, const char *end)
+{
+    struct Entry{
+        const char *name;
+        Opcode op;
+    };
+    struct Table{
+        Entry slots[32];
+        Table(): slots()
+        {
+            static const Entry names[] = {
+                {"LOAD", OP_LOAD}, {"STORE", OP_STORE}, {"ADD", OP_ADD}, {"SUB", OP_SUB}, {"READ", OP_READ},
+                {"PRINT", OP_PRINT}, {"JUMP", OP_JUMP}, {"BRANCHGT", OP_BRANCHGT}, {"VAR", OP_VAR}, {"EXIT", OP_EXIT}};
+            for (const Entry &entry : names)
+                slots[opcodeHash(entry.name, strlen(entry.name))] = entry;
+        }
+    };
+    static const Table table;  // Built once, thread-safe static initialization
+    size_t length = end - begin;
+    if (length == 0)
+        return OP_EMPTY;
+    const Entry &entry = table.slots[opcodeHash(begin, length)];
+    if (entry.name == nullptr || strlen(entry.name) != length || memcmp(entry.name, begin, length) != 0)
+        return OP_EMPTY;
+    return entry.op;
+}
+
+/// Finds the next whitespace separated token.
+/// @return false if there are no more tokens
+static bool nextToken(const char *&p, const char *end, const char *&begin, const char *&tokenEnd)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\v' || *p == '\f'))
+        p++;
+    if (p == end)
+        return false;
+    begin = p;
+    while (p < end && !(*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\v' || *p == '\f'))
+        p++;
+    tokenEnd = p;
+    return true;
+}
+
+/// Parses the text of a program file into the cells.
+void ProgramImage::parse(const char *text, size_t size)
+{
+    const char *p = text;
+    const char *end = text + size;
+    const char *begin, *tokenEnd;
+    if (!nextToken(p, end, begin, tokenEnd))
+        return;
+    int memorySize = parseNumber(begin, tokenEnd, format);  // Set storage size from the file content
+    if (memorySize <= 0 || static_cast<size_t>(memorySize) > MAX_STORAGE)
+        throw "Program file is damaged.\n";
+    storage = memorySize;
+    pageCount = (storage + PAGE_SIZE - 1) >> PAGE_BITS;
+    owned.assign(pageCount << PAGE_BITS, Cell{0, OP_EMPTY});  // Every cell starts as OP_EMPTY
+    cells = owned.data();
+
+    // Read (position, instruction, operand) triples and store them in the cells
+    const char *position, *positionEnd, *name, *nameEnd;
+    while (nextToken(p, end, position, positionEnd) && nextToken(p, end, name, nameEnd) && nextToken(p, end, begin, tokenEnd))
+    {
+        Opcode code = lookupOpcode(name, nameEnd);
+        if (code == OP_EMPTY)
+            continue;  // Unknown instructions are skipped
+        int address = parseNumber(position, positionEnd, format);
+        if (address < 0 || static_cast<size_t>(address) >= storage)
+            continue;  // Lines outside the memory are skipped
+        owned[address] = Cell{parseNumber(begin, tokenEnd, format), code};
+        stats.cells++;
+    }
+}
+
+/// Header of the binary image format, see programImage.h.
+struct ImageHeader{
+    char magic[8];
+    unsigned int version;
+    unsigned int cellSize;
+    unsigned int byteOrder;
+    unsigned int pageCount;
+    unsigned long long storage;
+};
+
+static const char IMAGE_MAGIC[8] = {'N', 'E', 'U', 'M', 'A', 'N', 'N', '\0'};
+static const unsigned int IMAGE_BYTE_ORDER = 0x01020304;
+
+static_assert(sizeof(ImageHeader) == ProgramImage::HEADER_SIZE, "image header layout");
+static_assert(sizeof(Cell) == 8 && offsetof(Cell, operand) == 0 && offsetof(Cell, op) == 4, "image cell layout");
+
+/// Checks if the file content starts like a binary image.
+static bool isBinaryImage(const char *data, size_t size)
+{
+    return size >= ProgramImage::HEADER_SIZE && memcmp(data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0;
+}
+
+const Cell *ProgramImage::binaryCells(const char *data, size_t size)
+{
+    ImageHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != IMAGE_VERSION || header.cellSize != sizeof(Cell) || header.byteOrder != IMAGE_BYTE_ORDER)
+        throw "Image file of another version or machine.\n";
+    pageCount = header.pageCount;
+    storage = header.storage;
+    if (storage > pageCount * PAGE_SIZE || size < HEADER_SIZE + pageCount * PAGE_SIZE * sizeof(Cell))
+        throw "Image file is damaged.\n";
+    stats.cells = storage;
+    const Cell *mapped = reinterpret_cast<const Cell *>(data + HEADER_SIZE);
+    for (size_t i = 0; i < storage; i++)
+        if (mapped[i].op >= OP_COUNT)
+            throw "Image file is damaged.\n";  // The engines index tables with the opcode
+    return mapped;
+}
+
+/// Maps the file into memory, a text file is parsed, a binary image is used in place.
+ProgramImage::ProgramImage(std::string filename, NumberFormat format)
+    : cells(nullptr), pageCount(0), storage(0), format(format), stats{0, 0, 0.0}, mapping(nullptr), mappingSize(0)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string path = "input/" + filename;  // Open file from the "input" directory
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw "File open failed.\n";
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        throw "File open failed.\n";
+    }
+    stats.bytes = info.st_size;
+    if (stats.bytes > 0)
+    {
+        void *text = mmap(nullptr, stats.bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (text == MAP_FAILED)
+            throw "File open failed.\n";
+        const char *data = static_cast<const char *>(text);
+        if (isBinaryImage(data, stats.bytes))
+        {
+            mapping = text;  // The cells stay in the mapping, the pages are read on first use
+            mappingSize = stats.bytes;
+            try
+            {
+                cells = binaryCells(data, stats.bytes);
+            }
+            catch (const char *)
+            {
+                munmap(mapping, mappingSize);
+                throw;
+            }
+        }
+        else
+        {
+            madvise(text, stats.bytes, MADV_SEQUENTIAL);
+            try
+            {
+                parse(data, stats.bytes);
+            }
+            catch (const char *)
+            {
+                munmap(text, stats.bytes);
+                throw;
+            }
+            munmap(text, stats.bytes);
+        }
+    }
+    else
+        close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw "File open failed.\n";
+    std::ostringstream text;
+    text << file.rdbuf();
+    std::string content = text.str();
+    stats.bytes = content.size();
+    if (isBinaryImage(content.data(), content.size()))
+    {
+        const Cell *mapped = binaryCells(content.data(), content.size());  // No mmap: copy the cells
+        owned.assign(mapped, mapped + (pageCount << PAGE_BITS));
+        cells = owned.data();
+    }
+    else
+        parse(content.data(), content.size());
+#endif
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+ProgramImage::~ProgramImage()
+{
+#ifndef _WIN32
+    if (mapping != nullptr)
+        munmap(mapping, mappingSize);
+#endif
+}
+
+/// Writes the header and the cells, the padding bytes are written as zeros.
+void ProgramImage::save(std::string filename) const
+{
+    std::ofstream file("input/" + filename, std::ios::binary);
+    if (!file)
+        throw "File write failed.\n";
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version = IMAGE_VERSION;
+    header.cellSize = sizeof(Cell);
+    header.byteOrder = IMAGE_BYTE_ORDER;
+    header.pageCount = static_cast<unsigned int>(pageCount);
+    header.storage = storage;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    std::vector<char> page(PAGE_SIZE * sizeof(Cell));
+    for (size_t p = 0; p < pageCount; p++)
+    {
+        memset(page.data(), 0, page.size());
+        for (int i = 0; i < PAGE_SIZE; i++)
+        {
+            const Cell &cell = cells[(p << PAGE_BITS) + i];
+            memcpy(&page[i * sizeof(Cell)], &cell.operand, sizeof(cell.operand));
+            page[i * sizeof(Cell) + offsetof(Cell, op)] = static_cast<char>(cell.op);
+        }
+        file.write(page.data(), page.size());
+    }
+    if (!file)
+        throw "File write failed.\n";
+}
+
+std::shared_ptr<const ProgramImage> ProgramImage::load(std::string filename, NumberFormat format)
+{
+    return std::make_shared<const ProgramImage>(filename, format);
+}
@@ -0,0 +1,131 @@
+#ifndef PROGRAMIMAGE_H_INCLUDED
+#define PROGRAMIMAGE_H_INCLUDED
+
+#include "instruction.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+/// NumberFormat enum
+/* How the numbers after "0x" are read from the program files. */
+enum NumberFormat{
+    FORMAT_LEGACY_DECIMAL,  /// The digits are decimal: 0x0010 is 10, like in Fb.txt
+    FORMAT_HEX              /// Real hexadecimal numbers: 0x0010 is 16, a-f are allowed
+};
+
+/// LoadStats struct
+/* Measurements of one program load. */
+struct LoadStats{
+    size_t bytes;           /// Size of the file
+    size_t cells;           /// Number of cells read from the file
+    double seconds;         /// Time of opening and parsing the file
+
+    /// Get the load throughput.
+    /// @return megabytes parsed per second
+    double megabytesPerSecond() const { return seconds > 0 ? bytes / 1e6 / seconds : 0.0; }
+};
+
+/// ProgramImage class
+/* A loaded program: the memory size and the initial content of every cell.
+ * The image is never modified after loading, so any number of MemoryUnits
+ * (also on different threads) can share it through a shared_ptr.
+ * The cells are stored in pages, a MemoryUnit copies only the pages it writes.
+ *
+ * A program can be loaded from the text format or from the binary image format
+ * written by save(). The binary format is a 32 byte header followed by the cells
+ * exactly as they are in memory, so it is used through mmap without parsing:
+ *     offset  0: "NEUMANN" + '\0'      magic
+ *     offset  8: uint32 version        IMAGE_VERSION
+ *     offset 12: uint32 cell size      sizeof(Cell)
+ *     offset 16: uint32 byte order     0x01020304 written by the saving machine
+ *     offset 20: uint32 page count     number of PAGE_SIZE cell pages that follow
+ *     offset 24: uint64 memory size
+ *     offset 32: cells                 int32 operand, uint8 opcode, 3 zero bytes
+ */
+class ProgramImage{
+    std::vector<Cell> owned;    /// Cells parsed from a text file, padded to whole pages
+    const Cell* cells;          /// Initial memory content: owned, or inside the mapped binary file
+    size_t pageCount;           /// Number of pages of cells
+    size_t storage;             /// Memory size
+    NumberFormat format;        /// How the numbers of the file are read
+    LoadStats stats;            /// Measurements of the load
+    void* mapping;              /// The mapped binary file, nullptr for a text file
+    size_t mappingSize;         /// Length of the mapping
+
+    /// Parses the text of a program file.
+    /// Throws an exception if the memory size is not between 1 and MAX_STORAGE or a number
+    /// does not fit in an int.
+    /// @param text - the file content
+    /// @param size - the length of the file content
+    void parse(const char* text, size_t size);
+
+    /// Checks the header of a binary image and finds its cells.
+    /// Throws an exception if the header does not fit this program, the file is too short
+    /// or a cell has an unknown opcode.
+    /// @param data - the file content
+    /// @param size - the length of the file content
+    /// @return the first cell
+    const Cell* binaryCells(const char* data, size_t size);
+
+    ProgramImage(const ProgramImage&);      /// Not copyable, it may own a mapping
+    void operator=(const ProgramImage&);
+public:
+    static const int PAGE_BITS = 8;                 /// log2 of the page size
+    static const int PAGE_SIZE = 1 << PAGE_BITS;    /// Number of cells in a page
+    static const int PAGE_MASK = PAGE_SIZE - 1;     /// Selects the cell inside the page
+    static const unsigned IMAGE_VERSION = 1;        /// Version of the binary image format
+    static const size_t HEADER_SIZE = 32;           /// Size of the binary image header
+    static const size_t MAX_STORAGE = 1 << 24;      /// Largest memory size a program file can ask for
+
+    /// Constructor.
+    /// Maps the program file of the input directory into memory and parses it.
+    /// A binary image (see save) is used directly from the mapping, format is ignored for it.
+    /// Throws an exception if the file can't be opened, the binary header is wrong or the text is damaged.
+    /// @param filename - the file from which to read the program
+    /// @param format - how the numbers of the file are read
+    ProgramImage(std::string filename, NumberFormat format=FORMAT_LEGACY_DECIMAL);
+
+    /// Loads a program that can be shared between many ControlUnits.
+    /// Throws an exception if the file can't be opened or is damaged.
+    /// @param filename - the file from which to read the program
+    /// @param format - how the numbers of the file are read
+    /// @return the shared, read-only image
+    static std::shared_ptr<const ProgramImage> load(std::string filename, NumberFormat format=FORMAT_LEGACY_DECIMAL);
+
+    /// Writes the image in the binary image format into the input directory.
+    /// Throws an exception if the file can't be written.
+    /// @param filename - the file to write
+    void save(std::string filename) const;
+
+    /// Checks if the image is used directly from a mapped binary file.
+    /// @return true if the cells were not parsed
+    bool isMapped() const { return mapping != nullptr; }
+
+    /// Unmaps the binary file.
+    ~ProgramImage();
+
+    /// Strips leading zeros from a string and converts it to an integer.
+    /// Throws an exception if the number does not fit in an int.
+    /// @param hex - the string to be converted to an integer
+    /// @return the integer after removing leading zeros
+    static int HextoInt(std::string hex);
+
+    /// Get the load measurements.
+    /// @return size, cell count and time of the load
+    const LoadStats& getLoadStats() const { return stats; }
+
+    /// Get storage.
+    /// @return the memory size of the program
+    size_t getStorage() const { return storage; }
+
+    /// Get the number of pages.
+    /// @return the number of pages needed for the memory
+    size_t getPages() const { return pageCount; }
+
+    /// Get a page of the image.
+    /// @param page - index of the page
+    /// @return pointer to the first of PAGE_SIZE cells
+    const Cell* getPage(size_t page) const { return cells + (page << PAGE_BITS); }
+};
+
+#endif // PROGRAMIMAGE_H_INCLUDED
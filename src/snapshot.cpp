@@ -0,0 +1,169 @@
+#include "snapshot.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+/// Header of a serialized snapshot.
+struct SnapshotHeader{
+    char magic[8];
+    unsigned int version;
+    unsigned int cellSize;
+    unsigned int pageCount;
+    unsigned int changedPages;
+    unsigned long long storage;
+    int PC;
+    int ACC;
+    int MAR;
+    unsigned int reserved;
+    Cell MDR;
+    Cell IR;
+    long long input;
+    unsigned long long printed;
+};
+
+static const char SNAPSHOT_MAGIC[8] = {'N', 'E', 'U', 'S', 'N', 'A', 'P', '\0'};
+static const unsigned int SNAPSHOT_VERSION = 1;
+static const size_t PAGE_BYTES = ProgramImage::PAGE_SIZE * sizeof(Cell);
+
+static_assert(sizeof(SnapshotHeader) == 80, "snapshot header layout");
+
+/// The merge keeps the newer page of an index that is in both layers.
+template <class T>
+std::shared_ptr<const FrozenLayer<T>> FrozenLayer<T>::push(std::shared_ptr<const FrozenLayer> previous,
+                                                           std::vector<size_t> indices,
+                                                           std::vector<std::shared_ptr<const T>> pages)
+{
+    while (previous != nullptr && previous->indices.size() <= 2 * indices.size())
+    {
+        std::vector<size_t> mergedIndices;
+        std::vector<std::shared_ptr<const T>> mergedPages;
+        size_t o = 0, n = 0;
+        while (o < previous->indices.size() || n < indices.size())
+        {
+            if (n == indices.size() || (o < previous->indices.size() && previous->indices[o] < indices[n]))
+            {
+                mergedIndices.push_back(previous->indices[o]);
+                mergedPages.push_back(previous->pages[o++]);
+                continue;
+            }
+            if (o < previous->indices.size() && previous->indices[o] == indices[n])
+                o++;  // Written again since the older layer
+            mergedIndices.push_back(indices[n]);
+            mergedPages.push_back(pages[n++]);
+        }
+        indices.swap(mergedIndices);
+        pages.swap(mergedPages);
+        previous = previous->previous;
+    }
+    return std::shared_ptr<const FrozenLayer>(new FrozenLayer{previous, std::move(indices), std::move(pages)});
+}
+
+template <class T>
+std::shared_ptr<const T> FrozenLayer<T>::find(size_t page) const
+{
+    for (const FrozenLayer *layer = this; layer != nullptr; layer = layer->previous.get())
+    {
+        std::vector<size_t>::const_iterator it = std::lower_bound(layer->indices.begin(), layer->indices.end(), page);
+        if (it != layer->indices.end() && *it == page)
+            return layer->pages[it - layer->indices.begin()];
+    }
+    return nullptr;
+}
+
+template <class T>
+void FrozenLayer<T>::collect(std::vector<const T *> &table) const
+{
+    for (const FrozenLayer *layer = this; layer != nullptr; layer = layer->previous.get())
+        for (size_t i = 0; i < layer->indices.size(); i++)
+            if (layer->indices[i] < table.size() && table[layer->indices[i]] == nullptr)
+                table[layer->indices[i]] = layer->pages[i].get();  // A newer layer was visited first
+}
+
+// The layers of the cells and of the high halves of the 64-bit words
+template struct FrozenLayer<Cell>;
+template struct FrozenLayer<int>;
+
+size_t Snapshot::getChangedPages() const
+{
+    std::vector<const Cell *> table(image ? image->getPages() : 0, nullptr);
+    if (pages)
+        pages->collect(table);
+    return table.size() - std::count(table.begin(), table.end(), nullptr);
+}
+
+std::vector<char> Snapshot::serialize() const
+{
+    if (wide)
+        throw "Snapshot of 64-bit words can't be serialized.\n";
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.cellSize = sizeof(Cell);
+    std::vector<const Cell *> table(image ? image->getPages() : 0, nullptr);
+    if (pages)
+        pages->collect(table);
+    header.pageCount = static_cast<unsigned int>(table.size());
+    header.changedPages = static_cast<unsigned int>(table.size() - std::count(table.begin(), table.end(), nullptr));
+    header.storage = image ? image->getStorage() : 0;
+    header.PC = PC;
+    header.ACC = (int)ACC;
+    header.MAR = MAR;
+    header.MDR = MDR;
+    header.IR = IR;
+    header.input = input;
+    header.printed = printed;
+
+    std::vector<char> buffer(sizeof(header) + header.changedPages * (sizeof(unsigned int) + PAGE_BYTES));
+    memcpy(buffer.data(), &header, sizeof(header));
+    char *out = buffer.data() + sizeof(header);
+    for (size_t p = 0; p < table.size(); p++)
+    {
+        if (table[p] == nullptr)
+            continue;  // Same as the image
+        unsigned int index = static_cast<unsigned int>(p);
+        memcpy(out, &index, sizeof(index));
+        memcpy(out + sizeof(index), table[p], PAGE_BYTES);
+        out += sizeof(index) + PAGE_BYTES;
+    }
+    return buffer;
+}
+
+Snapshot Snapshot::deserialize(const std::vector<char> &buffer, std::shared_ptr<const ProgramImage> image)
+{
+    SnapshotHeader header;
+    if (buffer.size() < sizeof(header))
+        throw "Snapshot is damaged.\n";
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.cellSize != sizeof(Cell))
+        throw "Snapshot of another version or machine.\n";
+    if (image == nullptr || header.pageCount != image->getPages() || header.storage != image->getStorage())
+        throw "Snapshot does not match the program.\n";
+    if (buffer.size() != sizeof(header) + header.changedPages * (sizeof(unsigned int) + PAGE_BYTES))
+        throw "Snapshot is damaged.\n";
+
+    Snapshot snapshot{image, nullptr, header.PC, header.ACC, header.MAR, header.MDR, header.IR, header.input,
+                      header.printed, nullptr, false};
+    std::vector<size_t> indices;
+    std::vector<std::shared_ptr<const Cell>> pages;
+    const char *in = buffer.data() + sizeof(header);
+    for (unsigned int i = 0; i < header.changedPages; i++)
+    {
+        unsigned int index;
+        memcpy(&index, in, sizeof(index));
+        if (index >= header.pageCount || (!indices.empty() && index <= indices.back()))
+            throw "Snapshot is damaged.\n";  // serialize writes the pages in ascending order
+        std::unique_ptr<Cell[]> cells(new Cell[ProgramImage::PAGE_SIZE]);  // Freed if the page is damaged
+        memcpy(cells.get(), in + sizeof(index), PAGE_BYTES);
+        for (int c = 0; c < ProgramImage::PAGE_SIZE; c++)
+            if (cells[c].op < OP_EMPTY || cells[c].op >= OP_COUNT)
+                throw "Snapshot is damaged.\n";  // serialize only writes valid opcodes
+        indices.push_back(index);
+        pages.push_back(std::shared_ptr<const Cell>(cells.release(), std::default_delete<Cell[]>()));
+        in += sizeof(index) + PAGE_BYTES;
+    }
+    if (!indices.empty())
+        snapshot.pages = FrozenPages::push(nullptr, std::move(indices), std::move(pages));
+    return snapshot;
+}
@@ -0,0 +1,93 @@
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+#include "programImage.h"
+#include <memory>
+#include <vector>
+
+/// FrozenLayer struct
+/* The pages frozen by one snapshot, on top of the layers of the earlier snapshots. A snapshot
+ * only adds the pages written since the previous one, the older pages are shared through the
+ * previous layer. A page is found in the newest layer that has it, nullptr means the base page.
+ * A new layer swallows the older layers that are at most twice its size, so every layer is
+ * more than twice as large as the next newer one and a lookup visits O(log pages) layers.
+ * T is the element of the pages: the cells, or the high halves of the 64-bit words.
+ */
+template <class T>
+struct FrozenLayer{
+    std::shared_ptr<const FrozenLayer> previous;    /// Older layer, nullptr for the oldest
+    std::vector<size_t> indices;                    /// Page indices of the layer, ascending
+    std::vector<std::shared_ptr<const T>> pages;    /// The frozen page of every index
+
+    /// Adds a layer on top of the older ones.
+    /// @param previous - the newest layer so far, may be nullptr
+    /// @param indices - page indices of the new pages, ascending
+    /// @param pages - the new pages
+    /// @return the new newest layer
+    static std::shared_ptr<const FrozenLayer> push(std::shared_ptr<const FrozenLayer> previous,
+                                                   std::vector<size_t> indices,
+                                                   std::vector<std::shared_ptr<const T>> pages);
+
+    /// Finds a page in this layer or an older one.
+    /// @param page - index of the page
+    /// @return the frozen page, nullptr if it is the base page
+    std::shared_ptr<const T> find(size_t page) const;
+
+    /// Fills a page table from this layer and the older ones.
+    /// @param table - the page of every index, only the nullptr entries are set
+    void collect(std::vector<const T*>& table) const;
+};
+
+/// Frozen cells, nullptr means the page of the program image.
+typedef FrozenLayer<Cell> FrozenPages;
+
+/// Frozen high halves of the 64-bit words, nullptr means a page of zeros.
+typedef FrozenLayer<int> FrozenHighWords;
+
+/// Snapshot struct
+/* The complete state of a ControlUnit, made by ControlUnit::snapshot().
+ * The memory is not copied: a page that was written since the program was loaded is frozen
+ * and shared by the snapshot and the ControlUnit, which copies it again on its next write.
+ * So a snapshot costs as much as the pages written since the previous one (see FrozenPages).
+ * With 64-bit words the pages of the high halves are frozen and shared the same way.
+ * A snapshot is never modified, it can be restored any number of times, also on other threads.
+ *
+ * serialize() turns it into a compact buffer: an 80 byte header followed by the pages that
+ * differ from the program image, each as a uint32 page index and PAGE_SIZE cells.
+ */
+struct Snapshot{
+    std::shared_ptr<const ProgramImage> image;          /// The program the memory was started from
+    std::shared_ptr<const FrozenPages> pages;           /// Frozen pages, nullptr if no page differs from the image
+    int PC;                 /// Program counter
+    long long ACC;          /// Accumulator
+    int MAR;                /// Memory address register
+    Cell MDR;               /// Memory data register
+    Cell IR;                /// Last executed instruction
+    long long input;        /// Position of the input, -1 if the input can't tell it
+    unsigned long long printed; /// Number of values written by PRINT
+    std::shared_ptr<const FrozenHighWords> high;        /// Frozen high halves of the 64-bit words, nullptr if none was written
+    bool wide;              /// The words are 64-bit
+
+    /// Get a page of the memory.
+    /// @param page - index of the page
+    /// @return the frozen page, nullptr if it is the page of the image
+    std::shared_ptr<const Cell> getPage(size_t page) const { return pages ? pages->find(page) : nullptr; }
+
+    /// Get the number of pages that differ from the image.
+    /// @return the number of frozen pages
+    size_t getChangedPages() const;
+
+    /// Writes the snapshot into a compact buffer.
+    /// Throws an exception for a snapshot of 64-bit words, the format has 32-bit values.
+    /// @return the header and the changed pages
+    std::vector<char> serialize() const;
+
+    /// Reads a snapshot from a buffer written by serialize().
+    /// Throws an exception if the buffer is damaged or belongs to another program.
+    /// @param buffer - the serialized snapshot
+    /// @param image - the program the snapshot was made of
+    /// @return the snapshot
+    static Snapshot deserialize(const std::vector<char>& buffer, std::shared_ptr<const ProgramImage> image);
+};
+
+#endif // SNAPSHOT_H_INCLUDED
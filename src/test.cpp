@@ -1,9 +1,24 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <cstdio>
+#include <fstream>
+#include <new>
+#include <cstddef>
+#include <cstring>
 #include "instruction.h"
 #include "controlUnit.h"
 #include "gtest_lite.h"
+#include "allocCounter.h"
+#include "batchRunner.h"
+#include "profiler.h"
+#include "forkRunner.h"
+#include "programAnalysis.h"
+#include "lockstepRunner.h"
+#include "trace.h"
+#include "timeTravel.h"
+#include "nativeProgram.h"
+#include "jit.h"
 
 void RunTest()
 {
@@ -37,6 +52,18 @@ void RunTest()
     }
     END
 
+    // Test case to check the compact cell representation of the memory
+    TEST(MemoryUnit, cellak)
+    {
+        EXPECT_EQ((size_t)40, CU.getStorage());
+        EXPECT_EQ(OP_LOAD, CU.fetch(0)->getOpcode());
+        EXPECT_EQ(OP_VAR, CU.fetch(34)->getOpcode());
+        EXPECT_EQ(true, CU.fetch(27) == nullptr);  // Empty cell has no instruction view
+        EXPECT_EQ(1, CU.readWord(34));
+        EXPECT_EQ(0, CU.readWord(27));
+    }
+    END
+
     // Test cases for checking the execution of different instructions (LOAD, STORE, ADD, SUB, etc.)
     TEST(LOAD, executeby)
     {
@@ -217,82 +244,1277 @@ void RunTest()
     // Tests the Fibonacci sequence with different values of 'n' (0, 1, 3, 9)
     TEST(Fibonacci, n = 0)
     {
-        std::istringstream input1("0");
-        std::ostringstream output;
-        int val;
-        ControlUnit CU1("Fb.txt", output, input1);
-        while (true)
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})  // Both engines must give the same result
         {
-            CU1.cycle();  // Executes one cycle of the control unit
-            if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+            std::istringstream input1("0");
+            std::ostringstream output;
+            int val;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            while (true)
             {
-                std::istringstream expect(output.str());
-                expect >> val;
-                break;
+                CU1.cycle();  // Executes one cycle of the control unit
+                if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+                {
+                    std::istringstream expect(output.str());
+                    expect >> val;
+                    break;
+                }
             }
+            EXPECT_EQ(0, val);  // Verifies the correct Fibonacci value for n = 0
         }
-        EXPECT_EQ(0, val);  // Verifies the correct Fibonacci value for n = 0
     }
     END
 
     // More Fibonacci tests for n = 1, n = 3, and n = 9 with expected results
     TEST(Fibonacci, n = 1)
     {
-        std::istringstream input1("1");
-        std::ostringstream output;
-        int val;
-        ControlUnit CU1("Fb.txt", output, input1);
-        while (true)
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})  // Both engines must give the same result
         {
-            CU1.cycle();
-            if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+            std::istringstream input1("1");
+            std::ostringstream output;
+            int val;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            while (true)
             {
-                std::istringstream expect(output.str());
-                expect >> val;
-                break;
+                CU1.cycle();
+                if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+                {
+                    std::istringstream expect(output.str());
+                    expect >> val;
+                    break;
+                }
             }
+            EXPECT_EQ(1, val);  // Verifies the correct Fibonacci value for n = 1
         }
-        EXPECT_EQ(1, val);  // Verifies the correct Fibonacci value for n = 1
     }
     END
 
     TEST(Fibonacc, n = 3)
     {
-        std::istringstream input1("3");
-        std::ostringstream output;
-        int val;
-        ControlUnit CU1("Fb.txt", output, input1);
-        while (true)
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})  // Both engines must give the same result
         {
-            CU1.cycle();
-            if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+            std::istringstream input1("3");
+            std::ostringstream output;
+            int val;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            while (true)
             {
-                std::istringstream expect(output.str());
-                expect >> val;
-                break;
+                CU1.cycle();
+                if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+                {
+                    std::istringstream expect(output.str());
+                    expect >> val;
+                    break;
+                }
             }
+            EXPECT_EQ(2, val);  // Verifies the correct Fibonacci value for n = 3
         }
-        EXPECT_EQ(2, val);  // Verifies the correct Fibonacci value for n = 3
     }
     END
 
     TEST(Fibonacc, n = 9)
     {
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})  // Both engines must give the same result
+        {
+            std::istringstream input1("9");
+            std::ostringstream output;
+            int val;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            while (true)
+            {
+                CU1.cycle();
+                if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+                {
+                    std::istringstream expect(output.str());
+                    expect >> val;
+                    break;
+                }
+            }
+            EXPECT_EQ(34, val);  // Verifies the correct Fibonacci value for n = 9
+        }
+    }
+    END
+
+    // The threaded engine reports the end of the program the same way as cycle()
+    TEST(ENGINE_THREADED, kilepes)
+    {
+        std::istringstream input1("5");
+        std::ostringstream output;
+        ControlUnit CU1("Fb.txt", output, input1, ENGINE_THREADED);
+        try
+        {
+            EXPECT_THROW_THROW(while (true) CU1.cycle(), const char *);
+        }
+        catch (const char *p)
+        {
+            EXPECT_STREQ("Code exited\n", p);
+        }
+        EXPECT_EQ(27, CU1.getPC());  // PC is after the EXIT instruction
+        EXPECT_EQ(std::string("5\n"), output.str());
+    }
+    END
+
+    // run() reports the end of the program as a status instead of an exception
+    TEST(ControlUnit, run)
+    {
+        unsigned long long steps[2];
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::istringstream input1("9");
+            std::ostringstream output;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            RunResult first = CU1.run(10);
+            EXPECT_EQ(STATUS_STEP_LIMIT, first.status);  // Stopped by the budget, can be continued
+            EXPECT_EQ(10ULL, first.steps);
+            RunResult rest = CU1.run();
+            EXPECT_EQ(STATUS_HALTED, rest.status);
+            EXPECT_EQ(std::string("34\n"), output.str());
+            steps[engine] = first.steps + rest.steps;
+            CU1.setPC(50);
+            EXPECT_EQ(STATUS_BAD_ADDRESS, CU1.run().status);
+            CU1.setPC(34);
+            EXPECT_EQ(STATUS_VAR_EXECUTED, CU1.run().status);
+        }
+        EXPECT_EQ(steps[ENGINE_SWITCH], steps[ENGINE_THREADED]);  // Both engines count the same steps
+        EXPECT_STREQ("Can't jump here\n", statusMessage(STATUS_BAD_JUMP));
+    }
+    END
+
+    // Superinstructions give the same result with fewer dispatches
+    TEST(ENGINE_THREADED, fuzio)
+    {
+        std::istringstream input1("20"), input2("20");
+        std::ostringstream output1, output2;
+        ControlUnit plain("Fb.txt", output1, input1, ENGINE_THREADED);
+        ControlUnit fused("Fb.txt", output2, input2, ENGINE_THREADED);
+        fused.setFusion(true);
+        RunResult r1 = plain.run();
+        RunResult r2 = fused.run();
+        EXPECT_EQ(STATUS_HALTED, r2.status);
+        EXPECT_EQ(output1.str(), output2.str());
+        EXPECT_EQ(r1.steps, r2.steps);  // Fused instructions still count as steps
+        EXPECT_EQ(plain.getAcc(), fused.getAcc());
+        EXPECT_EQ(0ULL, plain.getEliminatedInstructions());
+        EXPECT_LT(100ULL, fused.getEliminatedInstructions());
+    }
+    END
+
+    // A STORE into a fused sequence makes it run as single instructions again
+    TEST(ENGINE_THREADED, fuzioOnmodosito)
+    {
+        for (bool on : {false, true})
+        {
+            std::ostringstream output;
+            ControlUnit CU1("Onmodosito.txt", output, std::cin, ENGINE_THREADED);
+            CU1.setFusion(on);
+            RunResult result = CU1.run();
+            EXPECT_EQ(STATUS_VAR_EXECUTED, result.status);  // The ADD was overwritten by a variable
+            EXPECT_EQ(5, CU1.getPC());
+            EXPECT_EQ(2, CU1.getAcc());
+            EXPECT_EQ(4ULL, result.steps);
+            EXPECT_EQ(std::string("7\n"), output.str());
+        }
+    }
+    END
+
+    // The analysis of the decoded memory keeps fusion off the cells that the program writes
+    TEST(ENGINE_THREADED, elemzes)
+    {
+        Cell program[] = {{16, OP_LOAD}, {17, OP_ADD}, {18, OP_STORE}, {19, OP_LOAD}, {1, OP_STORE}, {0, OP_JUMP}};
+        int variables[] = {5, 6, 0, 7};
+        RunResult result[2];
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::ostringstream output;
+            ControlUnit CU1("Countdown.txt", output, std::cin, engine);
+            CU1.setFusion(true);
+            for (int address = 0; address < 20; address++)
+            {
+                CU1.setMAR(address);
+                CU1.setMDR(address < 6 ? program[address] : address >= 16 ? Cell{variables[address - 16], OP_VAR}
+                                                                           : Cell{0, OP_EMPTY});
+                CU1.writeEnable();
+            }
+            result[engine] = CU1.run();
+            EXPECT_EQ(2, CU1.getPC());  // The second pass stops at the overwritten ADD
+            if (engine == ENGINE_THREADED)
+                EXPECT_EQ(1ULL, CU1.getEliminatedInstructions());  // Only the LOAD STORE, the LOAD ADD STORE is not fused
+        }
+        EXPECT_EQ(STATUS_VAR_EXECUTED, result[ENGINE_THREADED].status);
+        EXPECT_EQ(result[ENGINE_SWITCH].steps, result[ENGINE_THREADED].steps);
+    }
+    END
+
+    // The threaded engine checks the addresses while decoding and stops like the checked switch engine
+    TEST(ENGINE_THREADED, ellenorzott)
+    {
+        Cell broken[] = {{99, OP_LOAD}, {-1, OP_PRINT}, {40, OP_JUMP}, {50, OP_READ}};
+        for (Cell cell : broken)
+        {
+            Status status[2];
+            int pc[2];
+            std::string out[2];
+            for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+            {
+                std::istringstream input1("3 4");
+                std::ostringstream output;
+                ControlUnit CU1("Onmodosito.txt", output, input1, engine);
+                CU1.setMAR(0);  // Replaces the first instruction
+                CU1.setMDR(cell);
+                CU1.writeEnable();
+                RunResult result = CU1.run();
+                status[engine] = result.status;
+                pc[engine] = CU1.getPC();
+                int rest = 0;
+                input1 >> rest;
+                out[engine] = output.str() + std::to_string(rest);
+            }
+            EXPECT_EQ(status[ENGINE_SWITCH], status[ENGINE_THREADED]);
+            EXPECT_EQ(pc[ENGINE_SWITCH], pc[ENGINE_THREADED]);
+            EXPECT_EQ(out[ENGINE_SWITCH], out[ENGINE_THREADED]);  // A bad READ consumes its number on both
+            EXPECT_EQ(cell.op == OP_JUMP ? STATUS_BAD_JUMP : STATUS_BAD_ADDRESS, status[ENGINE_THREADED]);
+        }
+    }
+    END
+
+    // Counted loops run in bulk with the same memory, accumulator and steps, also when the budget ends inside
+    TEST(ENGINE_THREADED, ciklusgyorsitas)
+    {
+        const char *programs[] = {"Countdown.txt", "Fb.txt"};  // A closed form and a Fibonacci loop
+        const char *inputs[] = {"0", "1", "2", "45", "100000", "-5"};
+        for (const char *program : programs)
+            for (const char *number : inputs)
+                for (unsigned long long budget : {~0ULL, 7ULL, 1000ULL})
+                {
+                    std::istringstream input1(number), input2(number);
+                    std::ostringstream output1, output2;
+                    ControlUnit plain(program, output1, input1, ENGINE_SWITCH);
+                    ControlUnit fast(program, output2, input2, ENGINE_THREADED);
+                    fast.setLoopAcceleration(true);
+                    RunResult r1{STATUS_STEP_LIMIT, 0}, r2{STATUS_STEP_LIMIT, 0};
+                    for (int run = 0; run < 200 && r1.status == STATUS_STEP_LIMIT; run++)
+                    {
+                        r1 = plain.run(budget);
+                        r2 = fast.run(budget);
+                        EXPECT_EQ(r1.status, r2.status);
+                        EXPECT_EQ(r1.steps, r2.steps);
+                        EXPECT_EQ(plain.getPC(), fast.getPC());
+                        EXPECT_EQ(plain.getAcc(), fast.getAcc());
+                    }
+                    EXPECT_EQ(output1.str(), output2.str());
+                    for (int i = 0; i < static_cast<int>(plain.getStorage()); i++)
+                        EXPECT_EQ(plain.cellAt(i).operand, fast.cellAt(i).operand);
+                }
+
+        std::istringstream input1("1000000");
+        std::ostringstream output;
+        ControlUnit CU1("Countdown.txt", output, input1, ENGINE_THREADED);
+        CU1.setLoopAcceleration(true);
+        RunResult result = CU1.run();
+        EXPECT_EQ(STATUS_HALTED, result.status);
+        EXPECT_EQ(4000003ULL, result.steps);
+        EXPECT_LT(3999990ULL, CU1.getEliminatedInstructions());  // One dispatch for the whole loop
+        EXPECT_EQ(std::string("0\n"), output.str());
+    }
+    END
+
+    // A store into the body of a counted loop stops its bulk run, as on the other engines
+    TEST(ENGINE_THREADED, ciklusiras)
+    {
+        // The STORE 4 runs before the loop, the STORE 1 only after a setPC: the analysis does not see it
+        Cell before[] = {{35, OP_LOAD}, {4, OP_STORE}, {3, OP_JUMP}, {30, OP_LOAD}, {34, OP_SUB}, {30, OP_STORE},
+                         {3, OP_BRANCHGT}, {30, OP_PRINT}, {0, OP_EXIT}};
+        Cell after[] = {{30, OP_LOAD}, {34, OP_SUB}, {30, OP_STORE}, {0, OP_BRANCHGT}, {30, OP_PRINT},
+                        {0, OP_EXIT}, {35, OP_LOAD}, {1, OP_STORE}, {0, OP_JUMP}};
+        for (Cell *program : {before, after})
+        {
+            RunResult result[3];
+            int pc[3];
+            for (int kind = 0; kind < 3; kind++)
+            {
+                std::ostringstream output;
+                ControlUnit CU1("Fb.txt", output, std::cin, kind == 0 ? ENGINE_SWITCH : ENGINE_THREADED);
+                CU1.setLoopAcceleration(kind == 2);
+                for (int address = 0; address < static_cast<int>(CU1.getStorage()); address++)
+                {
+                    CU1.setMAR(address);
+                    CU1.setMDR(address < 9 ? program[address] : address == 30 ? Cell{3, OP_VAR}
+                                                              : address == 34 ? Cell{1, OP_VAR}
+                                                              : address == 35 ? Cell{0, OP_VAR} : Cell{0, OP_EMPTY});
+                    CU1.writeEnable();
+                }
+                CU1.setPC(program == after ? 6 : 0);
+                result[kind] = CU1.run();
+                pc[kind] = CU1.getPC();
+                EXPECT_EQ(std::string(""), output.str());
+            }
+            for (int kind = 0; kind < 3; kind++)
+            {
+                EXPECT_EQ(STATUS_VAR_EXECUTED, result[kind].status);
+                EXPECT_EQ(4ULL, result[kind].steps);
+            }
+            EXPECT_EQ(pc[0], pc[2]);
+        }
+    }
+    END
+
+    // ADD and SUB have a defined result when the word overflows: wrap, stop or saturate
+    TEST(ControlUnit, tulcsordulas)
+    {
+        unsigned long long steps[2];
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::string outputs[3];
+            for (Arithmetic mode : {ARITH_WRAP, ARITH_CHECKED, ARITH_SATURATE})
+            {
+                std::istringstream input1("47");  // The 47th Fibonacci number does not fit in an int
+                std::ostringstream output;
+                ControlUnit CU1("Fb.txt", output, input1, engine);
+                CU1.setFusion(true);
+                CU1.setArithmetic(mode);
+                RunResult result = CU1.run();
+                EXPECT_EQ(mode == ARITH_CHECKED ? STATUS_OVERFLOW : STATUS_HALTED, result.status);
+                if (mode == ARITH_CHECKED)
+                {
+                    EXPECT_EQ(16, CU1.getPC());  // After the ADD, the sum was not stored
+                    EXPECT_EQ(1134903170, CU1.getAcc());
+                    steps[engine] = result.steps;
+                }
+                outputs[mode] = output.str();
+            }
+            EXPECT_EQ(std::string("-1323752223\n"), outputs[ARITH_WRAP]);
+            EXPECT_EQ(std::string(""), outputs[ARITH_CHECKED]);
+            EXPECT_EQ(std::string("2147483647\n"), outputs[ARITH_SATURATE]);
+        }
+        EXPECT_EQ(steps[ENGINE_SWITCH], steps[ENGINE_THREADED]);
+        EXPECT_STREQ("Arithmetic overflow\n", statusMessage(STATUS_OVERFLOW));
+    }
+    END
+
+    // With 64-bit words Fb is exact past the 46th number, the first overflow is the 93rd
+    TEST(ControlUnit, szeles)
+    {
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::string outputs[3];
+            for (Arithmetic mode : {ARITH_WRAP, ARITH_CHECKED, ARITH_SATURATE})
+            {
+                std::istringstream input1("93");
+                std::ostringstream output;
+                ControlUnit CU1("Fb.txt", output, input1, engine);
+                CU1.setFusion(true);
+                CU1.setArithmetic(mode);
+                CU1.setWordWidth(WORD_INT64);
+                RunResult result = CU1.run();
+                EXPECT_EQ(mode == ARITH_CHECKED ? STATUS_OVERFLOW : STATUS_HALTED, result.status);
+                if (mode == ARITH_CHECKED)
+                {
+                    EXPECT_EQ(16, CU1.getPC());
+                    EXPECT_EQ(4660046610375530309LL, CU1.getWideAcc());
+                }
+                outputs[mode] = output.str();
+            }
+            EXPECT_EQ(std::string("-6246583658587674878\n"), outputs[ARITH_WRAP]);
+            EXPECT_EQ(std::string(""), outputs[ARITH_CHECKED]);
+            EXPECT_EQ(std::string("9223372036854775807\n"), outputs[ARITH_SATURATE]);
+
+            // A snapshot keeps the 64-bit values, the fork finishes the 92nd number
+            std::istringstream input1("92"), input2("");
+            std::ostringstream output1, output2;
+            ControlUnit CU1("Fb.txt", output1, input1, engine);
+            CU1.setWordWidth(WORD_INT64);
+            EXPECT_EQ(STATUS_STEP_LIMIT, CU1.run(900).status);
+            Snapshot state = CU1.snapshot();
+            ControlUnit CU2(state, output2, input2, engine);
+            EXPECT_EQ(WORD_INT64, CU2.getWordWidth());
+            EXPECT_EQ(STATUS_HALTED, CU2.run().status);
+            EXPECT_EQ(std::string("7540113804746346429\n"), output2.str());
+            EXPECT_EQ(true, state.high != nullptr);
+            EXPECT_EQ(true, CU1.snapshot().high == state.high);  // Nothing written, the high halves are shared
+            CU1.writeWord(39, -5);  // A 32-bit write is sign extended
+            EXPECT_EQ(-5LL, CU1.readWide(39));
+            CU1.writeWide(39, 1LL << 31);
+            EXPECT_EQ(1LL << 31, CU1.readWide(39));
+            EXPECT_EQ(-2147483647 - 1, CU1.readWord(39));  // The cell has the low half
+            CU1.restore(state);
+            EXPECT_EQ(state.ACC, CU1.getWideAcc());
+            try
+            {
+                EXPECT_THROW_THROW(state.serialize(), const char *);
+            }
+            catch (const char *p)
+            {
+                EXPECT_STREQ("Snapshot of 64-bit words can't be serialized.\n", p);
+            }
+
+            // The trace has 32-bit values, 32-bit words keep the low half
+            std::ostringstream trace;
+            TraceRecorder recorder(trace, CU1);
+            try
+            {
+                EXPECT_THROW_THROW(CU1.runWith(recorder, ~0ULL), const char *);
+            }
+            catch (const char *p)
+            {
+                EXPECT_STREQ("The probe needs 32-bit words\n", p);
+            }
+            long long acc = CU1.getWideAcc();
+            CU1.setWordWidth(WORD_INT32);
+            EXPECT_EQ((long long)(int)acc, CU1.getWideAcc());
+            EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+        }
+    }
+    END
+
+    // Checks that STORE and READ update the memory in place, the hot loop does not allocate
+    // The allocations are only counted in a build with -DALLOCCOUNTER
+    TEST(ControlUnit, allokaciomentes)
+    {
+        if (allocationCounting())
+        {
+            unsigned long long before = allocationCount();
+            void *numbers = ::operator new[](16, std::nothrow);  // Direct calls, a new expression may be optimized out
+            void *line = ::operator new(64, std::align_val_t(64));
+            ::operator delete[](numbers, std::nothrow);
+            ::operator delete(line, std::align_val_t(64));
+            EXPECT_EQ(2ULL, allocationCount() - before);  // The nothrow and the aligned forms are counted too
+        }
+        else
+            std::cout << "Allocations are not counted, compile with -DALLOCCOUNTER" << std::endl;
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::istringstream input1("20");
+            std::ostringstream output;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            for (int i = 0; i < 5; i++)
+                CU1.cycle();  // Warm up: runs until after the READ instruction
+            unsigned long long before = allocationCount();
+            int steps = 0;
+            while (CU1.getPC() != 25)  // Runs the whole loop, stops before the PRINT
+            {
+                CU1.cycle();
+                steps++;
+            }
+            EXPECT_EQ(0ULL, allocationCount() - before);
+            EXPECT_LT(100, steps);
+            EXPECT_EQ(6765, CU1.readWord(31));
+        }
+    }
+    END
+
+    // ControlUnits share one program image, only the written pages are copied
+    TEST(ProgramImage, kozos)
+    {
+        std::shared_ptr<const ProgramImage> image = ProgramImage::load("Fb.txt");
+        std::istringstream input1("9"), input2("20");
+        std::ostringstream output1, output2;
+        ControlUnit CU1(image, output1, input1, ENGINE_THREADED);
+        ControlUnit CU2(image, output2, input2);
+        EXPECT_EQ(3L, image.use_count());
+        EXPECT_EQ((size_t)0, CU1.getPrivatePages());
+        EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+        EXPECT_EQ(STATUS_HALTED, CU2.run().status);
+        EXPECT_EQ(std::string("34\n"), output1.str());
+        EXPECT_EQ(std::string("6765\n"), output2.str());
+        EXPECT_EQ((size_t)1, CU1.getPrivatePages());  // Fb.txt fits into one page
+        EXPECT_EQ(0, image->getPage(0)[31].operand);  // The image itself is not written
+        ControlUnit CU3(image);
+        EXPECT_EQ(0, CU3.readWord(31));
+    }
+    END
+
+    // The loader reads real hexadecimal numbers, or decimal ones for the old files
+    TEST(ProgramImage, formatum)
+    {
+        std::shared_ptr<const ProgramImage> legacy = ProgramImage::load("Fb.txt");
+        EXPECT_EQ((size_t)40, legacy->getStorage());
+        EXPECT_EQ((size_t)33, legacy->getLoadStats().cells);
+        EXPECT_LT((size_t)0, legacy->getLoadStats().bytes);
+        std::shared_ptr<const ProgramImage> hex = ProgramImage::load("Hex.txt", FORMAT_HEX);
+        EXPECT_EQ((size_t)32, hex->getStorage());
+        EXPECT_EQ(-5, hex->getPage(0)[27].operand);
+        std::ostringstream output;
+        ControlUnit CU1(hex, output);
+        EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+        EXPECT_EQ(std::string("10\n"), output.str());
+        EXPECT_EQ(26, ProgramImage::HextoInt("0x0026"));  // Legacy: the digits are decimal
+
+        // A memory size out of range or a number that does not fit in an int is rejected
+        const char *damaged[][2] = {{"-0x10\n0x0 EXIT 0x0\n", "hex"}, {"0x0\n", "hex"},
+                                    {"0x99999999999\n0x0000 EXIT 0x0000\n", "legacy"},
+                                    {"0x20\n0x0000 LOAD 0x99999999999\n", "legacy"},
+                                    {"0x20\n0x00 LOAD 0x80000000\n", "hex"}, {"0x1000001\n", "hex"}};
+        for (auto &text : damaged)
+        {
+            {
+                std::ofstream file("input/Hibas_teszt.txt", std::ios::binary);
+                file << text[0];
+            }
+            try
+            {
+                EXPECT_THROW_THROW(ProgramImage::load("Hibas_teszt.txt", std::string(text[1]) == "hex" ? FORMAT_HEX : FORMAT_LEGACY_DECIMAL), const char *);
+            }
+            catch (const char *p)
+            {
+                EXPECT_STREQ("Program file is damaged.\n", p);
+            }
+        }
+        std::remove("input/Hibas_teszt.txt");
+    }
+    END
+
+    // The binary image is used from the mapped file and runs the same way as the text
+    TEST(ProgramImage, binaris)
+    {
+        ProgramImage::load("Fb.txt")->save("Fb_teszt.img");
+        std::shared_ptr<const ProgramImage> image = ProgramImage::load("Fb_teszt.img");
+        EXPECT_EQ(true, image->isMapped());
+        EXPECT_EQ((size_t)40, image->getStorage());
+        EXPECT_EQ(34, image->getPage(0)[2].operand);
+        EXPECT_EQ(OP_BRANCHGT, image->getPage(0)[24].op);
         std::istringstream input1("9");
         std::ostringstream output;
-        int val;
+        ControlUnit CU1(image, output, input1, ENGINE_THREADED);
+        EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+        EXPECT_EQ(std::string("34\n"), output.str());
+        image.reset();
+
+        std::string bytes;
+        {
+            std::ifstream file("input/Fb_teszt.img", std::ios::binary);
+            std::ostringstream content;
+            content << file.rdbuf();
+            bytes = content.str();
+        }
+        bytes[ProgramImage::HEADER_SIZE + offsetof(Cell, op)] = static_cast<char>(200);  // Opcode of cell 0
+        {
+            std::ofstream file("input/Fb_teszt.img", std::ios::binary);
+            file << bytes;
+        }
+        try
+        {
+            EXPECT_THROW_THROW(ProgramImage::load("Fb_teszt.img"), const char *);
+        }
+        catch (const char *p)
+        {
+            EXPECT_STREQ("Image file is damaged.\n", p);
+        }
+        std::remove("input/Fb_teszt.img");
+    }
+    END
+
+    // The batch runner runs independent jobs in parallel and reports every result
+    TEST(BatchRunner, run)
+    {
+        BatchRunner batch(2);
+        batch.addJob(BatchJob{"Fb.txt", "0", "0\n"});
+        batch.addJob(BatchJob{"Fb.txt", "9", "34\n"});
+        batch.addJob(BatchJob{"Fb.txt", "20", "6765\n"});
+        batch.addJob(BatchJob{"Fb.txt", "3", "3\n"});  // Wrong expected output
+        batch.addJob(BatchJob{"nem_letezik", "", ""});
+        std::vector<BatchResult> results = batch.run();
+        EXPECT_EQ((size_t)5, results.size());
+        EXPECT_EQ(true, results[0].passed);
+        EXPECT_EQ(true, results[1].passed);
+        EXPECT_EQ(true, results[2].passed);
+        EXPECT_EQ(false, results[3].passed);
+        EXPECT_EQ(std::string("2\n"), results[3].output);
+        EXPECT_EQ(STATUS_NO_PROGRAM, results[4].status);
+        std::ostringstream report;
+        batch.writeReport(report, results, 0.5);
+        EXPECT_NE(std::string::npos, report.str().find("\"passed\": 3,"));
+        EXPECT_NE(std::string::npos, report.str().find("\"status\": \"no_program\""));
+    }
+    END
+
+    // The profiler counts the same execution on every engine, also with superinstructions
+    TEST(Profiler, szamlalok)
+    {
+        for (int config = 0; config < 3; config++)
+        {
+            std::istringstream input1("9");
+            std::ostringstream output, dump;
+            ControlUnit CU1("Fb.txt", output, input1, config == 0 ? ENGINE_SWITCH : ENGINE_THREADED);
+            CU1.setFusion(config == 2);
+            Profiler profiler(&dump);
+            RunResult result = CU1.run(profiler);
+            EXPECT_EQ(STATUS_HALTED, result.status);
+            EXPECT_EQ(std::string("34\n"), output.str());
+            EXPECT_EQ(result.steps, profiler.getTotal());
+            EXPECT_EQ(1ULL, profiler.getOpcodeCount(OP_READ));
+            EXPECT_EQ(8ULL, profiler.getExecutions(24));
+            EXPECT_EQ(7ULL, profiler.getTaken(24));  // BRANCHGT of the loop
+            EXPECT_EQ(1ULL, profiler.getNotTaken(24));
+            EXPECT_EQ(10ULL, profiler.getWrites(33));  // The counter: READ, STORE and 8 loop iterations
+            std::vector<HotLoop> loops = profiler.hotLoops();
+            EXPECT_EQ((size_t)1, loops.size());
+            EXPECT_EQ(14, loops[0].head);
+            EXPECT_EQ(24, loops[0].tail);
+            EXPECT_EQ(88ULL, loops[0].instructions);
+            EXPECT_NE(std::string::npos, dump.str().find("Hot loops"));  // Dumped on halt
+        }
+    }
+    END
+
+    // Profiled and plain runs take turns on the same decoded code
+    TEST(Profiler, vegyes)
+    {
+        std::istringstream input1("30"), input2("30");
+        std::ostringstream output1, output2;
+        ControlUnit plain("Fb.txt", output1, input1);
+        ControlUnit CU1("Fb.txt", output2, input2, ENGINE_THREADED);
+        CU1.setFusion(true);
+        Profiler profiler;
+        RunResult r1{STATUS_STEP_LIMIT, 0}, r2{STATUS_STEP_LIMIT, 0};
+        for (int run = 0; run < 100 && r1.status == STATUS_STEP_LIMIT; run++)
+        {
+            r1 = plain.run(7);
+            r2 = run % 2 == 0 ? CU1.run(profiler, 7) : CU1.run(7);
+            EXPECT_EQ(r1.status, r2.status);
+            EXPECT_EQ(r1.steps, r2.steps);
+            EXPECT_EQ(plain.getPC(), CU1.getPC());
+            EXPECT_EQ(plain.getAcc(), CU1.getAcc());
+        }
+        EXPECT_EQ(STATUS_HALTED, r2.status);
+        EXPECT_EQ(output1.str(), output2.str());
+    }
+    END
+
+    // The failing instruction is not counted, and another program starts with new counters
+    TEST(Profiler, hibas)
+    {
+        for (int config = 0; config < 3; config++)
+        {
+            Engine engine = config == 0 ? ENGINE_SWITCH : ENGINE_THREADED;
+            std::ostringstream output1, output2;
+            std::istringstream input1("3");
+            ControlUnit CU1("Onmodosito.txt", output1, std::cin, engine);
+            CU1.setFusion(config == 2);
+            Profiler profiler;
+            RunResult result = CU1.run(profiler);
+            EXPECT_EQ(STATUS_VAR_EXECUTED, result.status);
+            EXPECT_EQ(result.steps, profiler.getTotal());
+            EXPECT_EQ(0ULL, profiler.getExecutions(4));  // The ADD overwritten by a variable
+            EXPECT_EQ(0ULL, profiler.getOpcodeCount(OP_VAR));
+            ControlUnit CU2("Countdown.txt", output2, input1, engine);  // Same memory size
+            result = CU2.run(profiler);
+            EXPECT_EQ(STATUS_HALTED, result.status);
+            EXPECT_EQ(result.steps, profiler.getTotal());
+            EXPECT_EQ(3ULL, profiler.getExecutions(4));  // The BRANCHGT of the countdown
+        }
+    }
+    END
+
+    // The buffered output is written when the run stops, in the same format
+    TEST(IOUnit, pufferelt)
+    {
+        std::istringstream input1("");
+        std::ostringstream output;
+        IOUnit io(output, input1);
+        io.setBuffered(true);
+        io.print(5);
+        io.print(-2147483647 - 1);
+        EXPECT_EQ(std::string(""), output.str());  // Still in the buffer
+        io.flush();
+        EXPECT_EQ(std::string("5\n-2147483648\n"), output.str());
+        for (int i = 0; i < 10000; i++)
+            io.print(i);  // Fills the buffer more than once
+        io.setBuffered(false);
+        EXPECT_EQ((size_t)(2 + 12 + 10 * 1 + 90 * 2 + 900 * 3 + 9000 * 4 + 10000), output.str().size());
+        EXPECT_EQ(std::string("9998\n9999\n"), output.str().substr(output.str().size() - 10));
+
+        std::istringstream input2("20");
+        std::ostringstream output2;
+        ControlUnit CU1("Fb.txt", output2, input2, ENGINE_THREADED);
+        CU1.setBuffered(true);
+        EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+        EXPECT_EQ(std::string("6765\n"), output2.str());
+    }
+    END
+
+    // The NumberReader reads the same numbers as the stream, also across chunk boundaries
+    TEST(NumberReader, beolvasas)
+    {
+        std::string numbers;
+        for (int i = 1; i <= 10000; i++)
+            numbers += std::to_string(i) + (i % 10 ? " " : "\n");
+        numbers += "0";
+        {
+            std::ofstream file("input/Szamok_teszt.txt", std::ios::binary);
+            file << numbers;
+        }
+        std::istringstream input1(numbers);
+        std::ostringstream output1, output2;
+        NumberReader reader("Szamok_teszt.txt", 7);  // Small chunks: numbers are split between reads
+        ControlUnit CU1("Sum.txt", output1, input1, ENGINE_THREADED);
+        ControlUnit CU2("Sum.txt", output2, reader, ENGINE_THREADED);
+        EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+        EXPECT_EQ(STATUS_HALTED, CU2.run().status);
+        EXPECT_EQ(std::string("50005000\n"), output2.str());
+        EXPECT_EQ(output1.str(), output2.str());
+
+        {
+            std::ofstream file("input/Szamok_teszt.txt", std::ios::binary);
+            file << " -2147483648\t+7 2147483648 abc";
+        }
+        NumberReader wrong("Szamok_teszt.txt");
+        int val = 1;
+        std::string word;
+        EXPECT_EQ(true, wrong.next(val, word));
+        EXPECT_EQ(-2147483647 - 1, val);
+        EXPECT_EQ(true, wrong.next(val, word));
+        EXPECT_EQ(7, val);
+        EXPECT_EQ(false, wrong.next(val, word));  // Does not fit into an int, the next word is the wrong one
+        EXPECT_EQ(2147483647, val);
+        EXPECT_EQ(std::string("abc"), word);
+        word.clear();
+        EXPECT_EQ(false, wrong.next(val, word));  // End of the input
+        EXPECT_EQ(0, val);
+        EXPECT_EQ(std::string(""), word);
+        std::remove("input/Szamok_teszt.txt");
+        EXPECT_THROW(NumberReader("nem_letezik"), const char *);
+    }
+    END
+
+    // Wrong inputs give the same values and error messages from a NumberReader as from a stream
+    TEST(NumberReader, hibauzenet)
+    {
+        for (const char *text : {"99999999999 5 7", "-99999999999 5", "2147483648", "99999999999x 5", "-abc 4", "+ 4"})
+        {
+            {
+                std::ofstream file("input/Szamok_teszt.txt", std::ios::binary);
+                file << text;
+            }
+            std::istringstream input1(text);
+            NumberReader reader("Szamok_teszt.txt");
+            std::ostringstream output, errors1, errors2;
+            IOUnit io1(output, input1), io2(output, reader);
+            std::streambuf *console = std::cerr.rdbuf();
+            for (int i = 0; i < 3; i++)
+            {
+                std::cerr.rdbuf(errors1.rdbuf());
+                int val1 = io1.read();
+                std::cerr.rdbuf(errors2.rdbuf());
+                int val2 = io2.read();
+                std::cerr.rdbuf(console);
+                EXPECT_EQ(val1, val2);
+            }
+            EXPECT_EQ(errors1.str(), errors2.str());
+        }
+        std::remove("input/Szamok_teszt.txt");
+    }
+    END
+
+    // The watchdog stops an endless loop and leaves the machine resumable
+    TEST(ControlUnit, idokorlat)
+    {
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::istringstream input1("2000000000");  // Countdown from 2 billion: runs for seconds
+            std::ostringstream output;
+            ControlUnit CU1("Countdown.txt", output, input1, engine);
+            CU1.setTimeLimit(0.01);
+            RunResult result = CU1.run();
+            EXPECT_EQ(STATUS_TIMEOUT, result.status);
+            EXPECT_EQ(0ULL, result.steps % WATCHDOG_SLICE);  // Stopped at a slice boundary
+            EXPECT_LT(0ULL, result.steps);
+            RunResult limited = CU1.run(1000);  // The step budget is still exact
+            EXPECT_EQ(STATUS_STEP_LIMIT, limited.status);
+            EXPECT_EQ(1000ULL, limited.steps);
+            CU1.setTimeLimit(0);
+            int pc = CU1.getPC();
+            CU1.writeWord(10, 5);  // Shortens the countdown at cell 10, the program continues where it stopped
+            CU1.setACC(5);
+            RunResult rest = CU1.run();
+            EXPECT_EQ(STATUS_HALTED, rest.status);
+            EXPECT_LT(rest.steps, 100ULL);
+            EXPECT_EQ(std::string("0\n"), output.str());
+            EXPECT_EQ(true, pc >= 1 && pc <= 4);
+        }
+        EXPECT_STREQ("Time limit reached\n", statusMessage(STATUS_TIMEOUT));
+    }
+    END
+
+    // A snapshot brings back the whole machine, also from the serialized buffer
+    TEST(ControlUnit, pillanatkep)
+    {
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::istringstream input1("20");
+            std::ostringstream output;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            EXPECT_EQ(STATUS_STEP_LIMIT, CU1.run(50).status);
+            Snapshot state = CU1.snapshot();
+            int pc = CU1.getPC(), acc = CU1.getAcc();
+            EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+            CU1.restore(state);
+            EXPECT_EQ(pc, CU1.getPC());
+            EXPECT_EQ(acc, CU1.getAcc());
+            EXPECT_EQ(STATUS_HALTED, CU1.run().status);
+            EXPECT_EQ(std::string("6765\n6765\n"), output.str());  // The output is not rewound
+            EXPECT_EQ(1ULL, CU1.getPrinted());  // Counted from the snapshot
+
+            std::vector<char> buffer = state.serialize();
+            EXPECT_EQ((size_t)(80 + 4 + ProgramImage::PAGE_SIZE * 8), buffer.size());  // Only the written page
+            std::istringstream input2("20");
+            std::ostringstream output2;
+            ControlUnit CU2(CU1.getImage(), output2, input2, engine);
+            CU2.restore(Snapshot::deserialize(buffer, CU2.getImage()));
+            EXPECT_EQ(STATUS_HALTED, CU2.run().status);
+            EXPECT_EQ(std::string("6765\n"), output2.str());
+        }
+    }
+    END
+
+    // Repeated snapshots only freeze the pages written since the previous one
+    TEST(Snapshot, piszkosLapok)
+    {
+        ControlUnit CU1("Sweep.txt");
+        EXPECT_EQ((size_t)0, CU1.snapshot().getChangedPages());
+        int old = CU1.readWord(301);
+        CU1.writeWord(300, 1);
+        CU1.writeWord(5000, 2);
+        Snapshot first = CU1.snapshot();
+        EXPECT_EQ((size_t)2, first.getChangedPages());
+        EXPECT_EQ((size_t)0, CU1.getPrivatePages());  // Shared with the snapshot now
+        CU1.writeWord(301, 3);
+        EXPECT_EQ((size_t)1, CU1.getPrivatePages());  // Copied again on the write
+        Snapshot second = CU1.snapshot();
+        EXPECT_EQ((size_t)2, second.getChangedPages());
+        EXPECT_EQ(true, first.getPage(19) == second.getPage(19));  // The page of 5000 is not copied again
+        EXPECT_EQ(false, first.getPage(1) == second.getPage(1));  // The page of 301 is frozen again
+        EXPECT_EQ(true, CU1.snapshot().pages == second.pages);  // Nothing written, nothing frozen
+        CU1.restore(first);
+        EXPECT_EQ(old, CU1.readWord(301));
+        EXPECT_EQ(1, CU1.readWord(300));
+        CU1.restore(second);
+        EXPECT_EQ(3, CU1.readWord(301));
+        std::vector<char> damaged = second.serialize();
+        damaged.resize(damaged.size() - 1);
+        EXPECT_THROW(Snapshot::deserialize(damaged, CU1.getImage()), const char *);
+        damaged = second.serialize();
+        int unknown = OP_COUNT + 5;
+        memcpy(damaged.data() + damaged.size() - sizeof(unknown), &unknown, sizeof(unknown));  // Opcode of the last cell
+        try
+        {
+            EXPECT_THROW_THROW(Snapshot::deserialize(damaged, CU1.getImage()), const char *);
+        }
+        catch (const char *p)
+        {
+            EXPECT_STREQ("Snapshot is damaged.\n", p);
+        }
+    }
+    END
+
+    // Every snapshot adds a layer of the pages written since the previous one, the layers stay few
+    TEST(Snapshot, retegek)
+    {
+        ControlUnit CU1("Sweep.txt"), original("Sweep.txt");
+        size_t pageCount = CU1.getImage()->getPages();
+        std::vector<Snapshot> snapshots;
+        for (size_t page = 0; page < pageCount; page++)
+        {
+            CU1.writeWord(static_cast<int>(page << ProgramImage::PAGE_BITS), static_cast<int>(page) + 1000);
+            snapshots.push_back(CU1.snapshot());
+        }
+        size_t layers = 0;
+        for (const FrozenPages *layer = snapshots.back().pages.get(); layer != nullptr; layer = layer->previous.get())
+            layers++;
+        EXPECT_LT(layers, (size_t)10);  // 68 pages: at most log2(68) + 1 layers
+        for (size_t page = 0; page < pageCount; page += 7)
+        {
+            EXPECT_EQ(page + 1, snapshots[page].getChangedPages());
+            CU1.restore(snapshots[page]);
+            EXPECT_EQ(static_cast<int>(page) + 1000, CU1.readWord(static_cast<int>(page << ProgramImage::PAGE_BITS)));
+            if (page + 1 < pageCount)
+            {
+                int next = static_cast<int>((page + 1) << ProgramImage::PAGE_BITS);
+                EXPECT_EQ(original.readWord(next), CU1.readWord(next));
+            }
+        }
+    }
+    END
+
+    // The forks of the first READ give the same results as separate runs
+    TEST(ForkRunner, run)
+    {
+        std::shared_ptr<const ProgramImage> image = ProgramImage::load("Fb.txt");
+        ForkRunner forks(image, 3);
+        EXPECT_EQ(STATUS_STEP_LIMIT, forks.getPrologue().status);
+        EXPECT_EQ(4ULL, forks.getPrologue().steps);  // Stopped before the READ at 0x0004
+        EXPECT_EQ(4, forks.getPrefix().PC);
+        std::vector<std::string> inputs;
+        for (int n = 0; n <= 25; n++)
+            inputs.push_back(std::to_string(n));
+        std::vector<ForkResult> results = forks.run(inputs);
+        EXPECT_EQ(inputs.size(), results.size());
+        for (size_t n = 0; n < results.size(); n++)
+        {
+            std::istringstream input1(inputs[n]);
+            std::ostringstream output;
+            ControlUnit CU1(image, output, input1);
+            RunResult alone = CU1.run();
+            EXPECT_EQ(alone.status, results[n].status);
+            EXPECT_EQ(alone.steps, results[n].steps);
+            EXPECT_EQ(output.str(), results[n].output);
+        }
+        EXPECT_EQ(std::string("75025\n"), results[25].output);
+
+        ForkRunner noRead(ProgramImage::load("Hex.txt", FORMAT_HEX));  // Halts before any READ
+        EXPECT_EQ(STATUS_HALTED, noRead.getPrologue().status);
+        std::vector<ForkResult> same = noRead.run({"1", "2"});
+        EXPECT_EQ(std::string("10\n"), same[1].output);
+        EXPECT_EQ(STATUS_NO_PROGRAM, ForkRunner(nullptr).run({"1"})[0].status);
+    }
+    END
+
+    // The analysis finds the blocks of Fb.txt and the problems of a broken program
+    TEST(ProgramAnalysis, cfg)
+    {
+        ProgramAnalysis fb(*ProgramImage::load("Fb.txt"));
+        EXPECT_EQ((size_t)6, fb.getBlocks().size());
+        int loop = fb.getBlock(14);
+        EXPECT_EQ(loop, fb.getBlock(24));  // The loop body is one block
+        EXPECT_EQ(24, fb.getBlocks()[loop].last);
+        EXPECT_EQ((size_t)2, fb.getBlocks()[loop].successors.size());
+        EXPECT_EQ(loop, fb.getBlocks()[loop].successors[0]);  // Jumps back to itself
+        EXPECT_EQ(false, fb.isReachable(30));
+        EXPECT_EQ(true, fb.isSafe());
+
+        ProgramAnalysis modifying(*ProgramImage::load("Onmodosito.txt"));
+        EXPECT_EQ((size_t)1, modifying.getSelfModifying().size());
+        EXPECT_EQ(4, modifying.getSelfModifying()[0]);
+        EXPECT_EQ(false, modifying.isSafe());
+
+        std::vector<Cell> broken = {
+            {2, OP_BRANCHGT}, {99, OP_LOAD}, {100, OP_JUMP}, {0, OP_EXIT}, {0, OP_PRINT}, {1, OP_ADD}};
+        ProgramAnalysis analysis(broken);
+        EXPECT_EQ((size_t)1, analysis.getBadOperands().size());
+        EXPECT_EQ((size_t)1, analysis.getBadJumps().size());
+        EXPECT_EQ(2, analysis.getBadJumps()[0]);
+        EXPECT_EQ((size_t)3, analysis.getUnreachable().size());  // EXIT, PRINT and ADD
+        EXPECT_EQ(false, analysis.getFallsOff());
+        broken[0].operand = 5;
+        EXPECT_EQ(true, ProgramAnalysis(broken).getFallsOff());  // The ADD is the last cell
+    }
+    END
+
+    // The lanes give the results of separate runs, also when their branches diverge
+    TEST(LockstepRunner, run)
+    {
+        std::vector<std::string> inputs;
+        for (int n = 0; n < 300; n++)
+            inputs.push_back(std::to_string(n % 50));  // Two groups, the last one is not full
+        inputs[7] = "x";  // Wrong input
+        inputs[8] = "";   // No input
+        for (const char *file : {"Fb.txt", "Onmodosito.txt"})
+        {
+            std::shared_ptr<const ProgramImage> image = ProgramImage::load(file);
+            LockstepRunner lanes(image, 2, 500);
+            EXPECT_EQ(std::string(file) == "Fb.txt", lanes.isLockstep());  // Onmodosito writes its own code
+            std::vector<ForkResult> results = lanes.run(inputs);
+            EXPECT_EQ(inputs.size(), results.size());
+            for (size_t i = 0; i < inputs.size(); i++)
+            {
+                std::istringstream input1(inputs[i]);
+                std::ostringstream output;
+                ControlUnit CU1(image, output, input1);
+                RunResult expected = CU1.run(500);
+                EXPECT_EQ(expected.status, results[i].status);
+                EXPECT_EQ(expected.steps, results[i].steps);
+                EXPECT_EQ(output.str(), results[i].output);
+            }
+        }
+        EXPECT_EQ(STATUS_STEP_LIMIT, LockstepRunner(ProgramImage::load("Fb.txt"), 1, 500).run({"49"})[0].status);
+    }
+    END
+
+    // The trace records every instruction in a few bytes, the replay runs the same instructions
+    TEST(TraceRecorder, visszajatszas)
+    {
+        std::string traces[2];
+        RunResult result{STATUS_RUNNING, 0};
+        for (Engine engine : {ENGINE_SWITCH, ENGINE_THREADED})
+        {
+            std::istringstream input1("20");
+            std::ostringstream output, trace;
+            ControlUnit CU1("Fb.txt", output, input1, engine);
+            CU1.setFusion(true);
+            TraceRecorder recorder(trace, CU1);
+            result = CU1.runWith(recorder, ~0ULL);
+            recorder.close(result);
+            traces[engine] = trace.str();
+        }
+        EXPECT_EQ(traces[ENGINE_SWITCH], traces[ENGINE_THREADED]);  // Fused or not, the same instructions ran
+        EXPECT_EQ(true, traces[ENGINE_SWITCH].size() < 16 + 3 * result.steps);
+
+        std::istringstream trace(traces[ENGINE_SWITCH]);
+        TraceReader reader(trace);
+        TraceEvent event;
+        unsigned long long events = 0;
+        int printed = 0;
+        while (reader.next(event))
+        {
+            if (event.op == OP_READ)
+                EXPECT_EQ(20, event.value);
+            if (event.op == OP_STORE && event.address == 31)
+                printed = event.value;  // The last STORE to 0x31 is the result
+            events++;
+        }
+        EXPECT_EQ(OP_EXIT, event.op);
+        EXPECT_EQ(6765, printed);
+        EXPECT_EQ(result.steps, events);
+        EXPECT_EQ(STATUS_HALTED, reader.getStatus());
+
+        std::istringstream again(traces[ENGINE_SWITCH]);
+        ReplayResult replay = replayTrace(again, ProgramImage::load("Fb.txt"));
+        EXPECT_EQ(true, replay.deterministic);
+        EXPECT_EQ(events, replay.events);
+
+        // A trace of Countdown replayed on Sum: both read, load, then Sum branches where Countdown subtracts
+        std::istringstream input2("3");
+        std::ostringstream output2, countdown;
+        ControlUnit CU2("Countdown.txt", output2, input2);
+        TraceRecorder recorder(countdown, CU2);
+        recorder.close(CU2.runWith(recorder, ~0ULL));
+        std::istringstream other(countdown.str());
+        replay = replayTrace(other, ProgramImage::load("Sum.txt"));
+        EXPECT_EQ(false, replay.deterministic);
+        EXPECT_EQ(2ULL, replay.divergence);
+    }
+    END
+
+    // Any earlier step can be reached from the nearest checkpoint, also the last write of an address
+    TEST(TimeTravel, visszalepes)
+    {
+        std::istringstream input1("20");
+        std::ostringstream output;
+        ControlUnit CU1("Fb.txt", output, input1, ENGINE_THREADED);
+        CU1.setFusion(true);
+        TimeTravel debugger(CU1, 16);
+        RunResult result = debugger.forward();
+        EXPECT_EQ(STATUS_HALTED, result.status);
+        EXPECT_EQ(result.steps, debugger.getStep());
+        EXPECT_EQ(result.steps / 16 + 1, (unsigned long long)debugger.getCheckpoints().size());
+
+        std::istringstream input2("20");
+        std::ostringstream output2;
+        ControlUnit CU2("Fb.txt", output2, input2);
+        CU2.run(50);
+        EXPECT_EQ(true, debugger.seek(50));
+        EXPECT_EQ(CU2.getPC(), CU1.getPC());
+        EXPECT_EQ(CU2.getAcc(), CU1.getAcc());
+        EXPECT_EQ(CU2.readWord(31), CU1.readWord(31));
+        EXPECT_EQ(4ULL, (unsigned long long)debugger.getCheckpoints().size());  // The later ones are dropped
+
+        EXPECT_EQ(true, debugger.stepBack());
+        EXPECT_EQ(49ULL, debugger.getStep());
+        WriteRecord last{0, -1, 0};
+        int before = ProgramImage::load("Fb.txt")->getPage(0)[31].operand;  // The value before the first write
+        for (const WriteRecord &record : debugger.getWriteLog())
+            if (record.address == 31)
+            {
+                if (last.address == 31)
+                    before = last.value;
+                last = record;
+            }
+        EXPECT_EQ(true, debugger.backToWrite(31));
+        EXPECT_EQ(last.step, debugger.getStep());
+        EXPECT_EQ(true, debugger.getStep() < 49);
+        EXPECT_EQ(OP_STORE, CU1.cellAt(CU1.getPC()).op);  // Stopped before the STORE to 31
+        EXPECT_EQ(31, CU1.cellAt(CU1.getPC()).operand);
+        EXPECT_EQ(CU1.getAcc(), last.value);
+        EXPECT_EQ(before, CU1.readWord(31));
+        EXPECT_EQ(false, debugger.backToWrite(40));  // Never written
+
+        EXPECT_EQ(STATUS_HALTED, debugger.forward().status);
+        EXPECT_EQ(result.steps, debugger.getStep());
+        EXPECT_EQ(std::string("6765\n"), output.str());  // Printed once
+        EXPECT_EQ(false, debugger.stepBack(result.steps + 1));
+    }
+    END
+
+    // A long run keeps a bounded number of checkpoints and writes, every step can still be reached
+    TEST(TimeTravel, ritkitas)
+    {
+        std::istringstream input1("40");
+        std::ostringstream output;
         ControlUnit CU1("Fb.txt", output, input1);
-        while (true)
+        TimeTravel debugger(CU1, 4, 8, 16);
+        RunResult result = debugger.forward();
+        EXPECT_EQ(STATUS_HALTED, result.status);
+        EXPECT_EQ(true, debugger.getCheckpoints().size() <= 8);
+        EXPECT_EQ(true, debugger.getInterval() >= result.steps / 8);
+        EXPECT_EQ(true, debugger.getWriteLog().size() <= 32);
+        for (const Checkpoint &checkpoint : debugger.getCheckpoints())
+            EXPECT_EQ(0ULL, checkpoint.step % debugger.getInterval());
+
+        for (unsigned long long target : {result.steps - 1, result.steps / 2, 3ULL, 0ULL})
         {
-            CU1.cycle();
-            if (CU1.fetch(CU1.getPC())->getOperand() == 0)
+            std::istringstream input2("40");
+            std::ostringstream output2;
+            ControlUnit CU2("Fb.txt", output2, input2);
+            CU2.run(target);
+            EXPECT_EQ(true, debugger.seek(target));
+            EXPECT_EQ(CU2.getPC(), CU1.getPC());
+            EXPECT_EQ(CU2.getAcc(), CU1.getAcc());
+            EXPECT_EQ(CU2.readWord(31), CU1.readWord(31));
+        }
+        EXPECT_EQ(STATUS_HALTED, debugger.forward().status);
+        EXPECT_EQ(true, debugger.backToWrite(debugger.getWriteLog().back().address));
+        EXPECT_EQ(std::string("102334155\n"), output.str());
+    }
+    END
+
+    // The compiled blocks give the same results as the interpreter, the self-modifying ones stay interpreted
+    // Without a C++ compiler at run time only the generated source is checked
+    TEST(NativeProgram, run)
+    {
+        for (const char *program : {"Fb.txt", "Countdown.txt", "Onmodosito.txt"})
+        {
+            std::shared_ptr<const ProgramImage> image = ProgramImage::load(program);
+            std::unique_ptr<NativeProgram> library;
+            try
+            {
+                library.reset(new NativeProgram(*image));
+            }
+            catch (const char *p)
             {
-                std::istringstream expect(output.str());
-                expect >> val;
+                std::cout << "Native code is not tested: " << p;
                 break;
             }
+            NativeProgram &compiled = *library;
+            for (const char *number : {"0", "1", "3", "9", "47"})
+                for (unsigned long long budget : {~0ULL, 5ULL})
+                {
+                    std::istringstream input1(number), input2(number);
+                    std::ostringstream output1, output2;
+                    ControlUnit plain(image, output1, input1);
+                    ControlUnit CU1(image, output2, input2);
+                    RunResult r1{STATUS_STEP_LIMIT, 0}, r2{STATUS_STEP_LIMIT, 0};
+                    for (int run = 0; run < 200 && r1.status == STATUS_STEP_LIMIT; run++)
+                    {
+                        r1 = plain.run(budget);
+                        r2 = compiled.run(CU1, budget);
+                        EXPECT_EQ(r1.status, r2.status);
+                        EXPECT_EQ(r1.steps, r2.steps);
+                        EXPECT_EQ(plain.getPC(), CU1.getPC());
+                        EXPECT_EQ(plain.getAcc(), CU1.getAcc());
+                    }
+                    EXPECT_EQ(output1.str(), output2.str());
+                    for (int i = 0; i < static_cast<int>(plain.getStorage()); i++)
+                        EXPECT_EQ(plain.cellAt(i).operand, CU1.cellAt(i).operand);  // Every written cell was copied back
+                }
+            if (std::string(program) == "Countdown.txt")
+            {
+                std::istringstream input1("2000000000");
+                std::ostringstream output;
+                ControlUnit CU1(image, output, input1);
+                CU1.setTimeLimit(0.01);
+                RunResult result = compiled.run(CU1);
+                EXPECT_EQ(STATUS_TIMEOUT, result.status);  // The native code runs in slices too
+                EXPECT_EQ(0ULL, result.steps % WATCHDOG_SLICE);
+            }
+        }
+
+        std::vector<bool> native;
+        std::string source = NativeProgram::generate(*ProgramImage::load("Fb.txt"), native);
+        EXPECT_EQ(true, (bool)native[14]);  // The loop is one block
+        EXPECT_EQ(true, source.find("block_14(") != std::string::npos);
+        NativeProgram::generate(*ProgramImage::load("Onmodosito.txt"), native);
+        EXPECT_EQ(false, (bool)native[0]);  // Its ADD is overwritten
+    }
+    END
+
+    // The JIT gives the same results as the interpreter, also when the program overwrites compiled code
+    TEST(JitRunner, run)
+    {
+        for (const char *program : {"Fb.txt", "Countdown.txt", "Onmodosito.txt"})
+        {
+            std::shared_ptr<const ProgramImage> image = ProgramImage::load(program);
+            for (const char *number : {"0", "1", "9", "47", "1000"})
+                for (unsigned long long budget : {~0ULL, 5ULL, 1000ULL})
+                {
+                    std::istringstream input1(number), input2(number);
+                    std::ostringstream output1, output2;
+                    ControlUnit plain(image, output1, input1);
+                    ControlUnit CU1(image, output2, input2);
+                    JitRunner jit(CU1, 4);
+                    RunResult r1{STATUS_STEP_LIMIT, 0}, r2{STATUS_STEP_LIMIT, 0};
+                    for (int run = 0; run < 200 && r1.status == STATUS_STEP_LIMIT; run++)
+                    {
+                        r1 = plain.run(budget);
+                        r2 = jit.run(budget);
+                        EXPECT_EQ(r1.status, r2.status);
+                        EXPECT_EQ(r1.steps, r2.steps);
+                        EXPECT_EQ(plain.getPC(), CU1.getPC());
+                        EXPECT_EQ(plain.getAcc(), CU1.getAcc());
+                    }
+                    EXPECT_EQ(output1.str(), output2.str());
+                    if (JitRunner::isSupported() && std::string(program) == "Fb.txt" && std::string(number) == "1000")
+                        EXPECT_EQ(true, jit.getCompiledBlocks() > 0);
+                }
         }
-        EXPECT_EQ(34, val);  // Verifies the correct Fibonacci value for n = 9
+
+        // The loop overwrites its own SUB once it is compiled
+        std::shared_ptr<const ProgramImage> image = ProgramImage::load("Countdown.txt");
+        std::istringstream input1("1000"), input2("1000");
+        std::ostringstream output1, output2;
+        ControlUnit plain(image, output1, input1);
+        ControlUnit CU1(image, output2, input2);
+        for (ControlUnit *CU : {&plain, &CU1})
+        {
+            for (int address = 0; address < static_cast<int>(CU->getStorage()); address++)
+            {
+                CU->setMAR(address);
+                CU->setMDR(Cell{0, OP_EMPTY});
+                CU->writeEnable();
+            }
+            Cell cells[] = {{16, OP_READ}, {16, OP_LOAD}, {17, OP_SUB}, {16, OP_STORE},
+                            {1, OP_BRANCHGT}, {18, OP_LOAD}, {2, OP_STORE}, {1, OP_JUMP}};
+            for (int address = 0; address < 8; address++)
+            {
+                CU->setMAR(address);
+                CU->setMDR(cells[address]);
+                CU->writeEnable();
+            }
+            int variables[] = {0, 1, 5};
+            for (int address = 16; address < 19; address++)
+            {
+                CU->setMAR(address);
+                CU->setMDR(Cell{variables[address - 16], OP_VAR});
+                CU->writeEnable();
+            }
+        }
+        JitRunner jit(CU1);
+        RunResult r1 = plain.run(), r2 = jit.run();
+        EXPECT_EQ(STATUS_VAR_EXECUTED, r2.status);
+        EXPECT_EQ(r1.status, r2.status);
+        EXPECT_EQ(r1.steps, r2.steps);
+        EXPECT_EQ(plain.getPC(), CU1.getPC());
+        EXPECT_EQ(plain.getAcc(), CU1.getAcc());
+        if (JitRunner::isSupported())
+            EXPECT_EQ(1ULL, jit.getInvalidations());
+
+        // A small executable memory is reset when it is full, a time limit stops the compiled loop
+        image = ProgramImage::load("Fb.txt");
+        std::istringstream input3("1000"), input4("1000"), input5("2000000000");
+        std::ostringstream output3, output4, output5;
+        ControlUnit plain2(image, output3, input3), CU2(image, output4, input4);
+        JitRunner small(CU2, 1, 512);
+        r1 = plain2.run();
+        r2 = small.run();
+        EXPECT_EQ(r1.status, r2.status);
+        EXPECT_EQ(r1.steps, r2.steps);
+        EXPECT_EQ(output3.str(), output4.str());
+        if (JitRunner::isSupported())
+            EXPECT_LT(0ULL, small.getCodeResets());
+        ControlUnit CU3(ProgramImage::load("Countdown.txt"), output5, input5);
+        CU3.setTimeLimit(0.01);
+        JitRunner timed(CU3);
+        RunResult result = timed.run();
+        EXPECT_EQ(STATUS_TIMEOUT, result.status);
+        EXPECT_EQ(0ULL, result.steps % WATCHDOG_SLICE);  // Stopped at a slice boundary
     }
     END
 
@@ -0,0 +1,81 @@
+#include "timeTravel.h"
+#include <algorithm>
+
+TimeTravel::TimeTravel(ControlUnit &CU, unsigned long long interval, size_t maxCheckpoints, size_t maxWrites)
+    : CU(CU), interval(std::max(interval, 1ULL)), maxCheckpoints(std::max(maxCheckpoints, (size_t)2)),
+      maxWrites(std::max(maxWrites, (size_t)1))
+{
+    checkpoints.push_back(Checkpoint{0, CU.snapshot()});
+}
+
+/// The runs end on the multiples of the interval, where the checkpoints are taken.
+RunResult TimeTravel::forward(unsigned long long maxSteps)
+{
+    RunResult total{STATUS_STEP_LIMIT, 0};
+    CU.setQuiet(written);
+    while (total.steps < maxSteps)
+    {
+        unsigned long long next = (step / interval + 1) * interval;
+        calls = 0;
+        RunResult part = CU.runWith(*this, std::min(maxSteps - total.steps, next - step));
+        step += part.steps;
+        total.steps += part.steps;
+        total.status = part.status;
+        if (step == next)
+        {
+            checkpoints.push_back(Checkpoint{step, CU.snapshot()});
+            if (checkpoints.size() > maxCheckpoints)
+                thinCheckpoints();
+        }
+        if (part.status != STATUS_STEP_LIMIT)
+            break;
+    }
+    written = std::max(written, CU.getPrinted());
+    return total;
+}
+
+/// The first checkpoint is at step 0, so it always stays.
+void TimeTravel::thinCheckpoints()
+{
+    interval *= 2;
+    std::vector<Checkpoint>::iterator kept = std::remove_if(
+        checkpoints.begin(), checkpoints.end(),
+        [this](const Checkpoint &checkpoint) { return checkpoint.step % interval != 0; });
+    checkpoints.erase(kept, checkpoints.end());
+}
+
+/// Backwards: restores the last checkpoint at or before the target, then runs forward to it.
+bool TimeTravel::seek(unsigned long long target)
+{
+    if (target < step)
+    {
+        std::vector<Checkpoint>::iterator last = std::upper_bound(
+            checkpoints.begin(), checkpoints.end(), target,
+            [](unsigned long long t, const Checkpoint &checkpoint) { return t < checkpoint.step; }) - 1;
+        CU.restore(last->state);
+        step = last->step;
+        checkpoints.erase(last + 1, checkpoints.end());
+        std::vector<WriteRecord>::iterator later = std::lower_bound(
+            writeLog.begin(), writeLog.end(), step,
+            [](const WriteRecord &record, unsigned long long s) { return record.step < s; });
+        writeLog.erase(later, writeLog.end());
+    }
+    if (target > step)
+        forward(target - step);
+    return step == target;
+}
+
+bool TimeTravel::stepBack(unsigned long long count)
+{
+    if (count > step)
+        return false;
+    return seek(step - count);
+}
+
+bool TimeTravel::backToWrite(int address)
+{
+    for (std::vector<WriteRecord>::reverse_iterator record = writeLog.rbegin(); record != writeLog.rend(); ++record)
+        if (record->address == address)
+            return seek(record->step);
+    return false;
+}
@@ -0,0 +1,133 @@
+#ifndef TIMETRAVEL_H_INCLUDED
+#define TIMETRAVEL_H_INCLUDED
+
+#include "controlUnit.h"
+#include <vector>
+
+/// Default number of instructions between two checkpoints.
+const unsigned long long TIME_TRAVEL_INTERVAL = 4096;
+
+/// Default number of checkpoints kept, more of them thin out the older ones.
+const size_t TIME_TRAVEL_CHECKPOINTS = 256;
+
+/// Default number of the newest memory writes kept in the write log.
+const size_t TIME_TRAVEL_WRITES = 1 << 20;
+
+/// Checkpoint struct
+struct Checkpoint{
+    unsigned long long step;        /// Number of instructions executed before the snapshot
+    Snapshot state;                 /// The machine after those instructions
+};
+
+/// WriteRecord struct
+/* One entry of the write log: a STORE or READ that wrote the memory. */
+struct WriteRecord{
+    unsigned long long step;        /// Index of the writing instruction, counted from 0
+    int address;                    /// The written address
+    int value;                      /// The written value
+};
+
+/// TimeTravel class
+/* Reverse debugging of a ControlUnit. The program runs forward through TimeTravel, which
+ * takes a snapshot every interval instructions and keeps a log of the memory writes.
+ * Going back to any earlier step restores the last checkpoint before it and runs forward
+ * from there: it costs at most interval instructions, wherever the step is.
+ * The memory stays bounded on long runs: when there are too many checkpoints every second
+ * one is dropped and the interval doubles, and the log only keeps the newest writes.
+ * The log tells which instruction wrote an address last, so the program can be run
+ * back to a write. Going back drops the history after the new position, running forward
+ * records it again: the program is deterministic because the input is rewound too.
+ * The input of the ControlUnit must be seekable (a file or a string, not the console).
+ * The values PRINTed once are not written again when a part of the program runs again.
+ * TimeTravel is also the probe of the runs, the engines call the member functions below.
+ */
+class TimeTravel{
+    ControlUnit& CU;                        /// The debugged machine
+    unsigned long long interval;            /// Instructions between two checkpoints
+    size_t maxCheckpoints;                  /// Most checkpoints kept
+    size_t maxWrites;                       /// Writes kept in the log, it is trimmed at twice as many
+    std::vector<Checkpoint> checkpoints;    /// Snapshots in step order, the first one at the start
+    std::vector<WriteRecord> writeLog;      /// The newest memory writes in step order
+    unsigned long long step=0;              /// Instructions executed since the start
+    unsigned long long calls=0;             /// Instructions dispatched in the current run
+    unsigned long long written=0;           /// Most values PRINTed so far
+
+    TimeTravel(const TimeTravel&);
+    TimeTravel& operator=(const TimeTravel&);
+
+    /// Drops every second checkpoint, the ones left are at the multiples of the doubled interval.
+    void thinCheckpoints();
+public:
+    /// Constructor.
+    /// Takes the first checkpoint: the current state is step 0.
+    /// @param CU - the machine to debug, it must live as long as the TimeTravel
+    /// @param interval - instructions between two checkpoints at the start
+    /// @param maxCheckpoints - most checkpoints kept, at least 2
+    /// @param maxWrites - number of the newest writes backToWrite can find
+    TimeTravel(ControlUnit& CU, unsigned long long interval=TIME_TRAVEL_INTERVAL,
+               size_t maxCheckpoints=TIME_TRAVEL_CHECKPOINTS, size_t maxWrites=TIME_TRAVEL_WRITES);
+
+    /// Runs the program forward like ControlUnit::run(), with checkpoints and the write log.
+    /// @param maxSteps - maximum number of instructions to execute
+    /// @return the status and the number of executed instructions
+    RunResult forward(unsigned long long maxSteps=~0ULL);
+
+    /// Goes to the state after a number of instructions, backwards or forwards.
+    /// Throws an exception if the input can't be rewound.
+    /// @param target - number of instructions from the start
+    /// @return false if the program stopped before the target
+    bool seek(unsigned long long target);
+
+    /// Goes back some instructions.
+    /// @param count - number of instructions to undo
+    /// @return false if there were not so many instructions
+    bool stepBack(unsigned long long count=1);
+
+    /// Goes back to the last instruction that wrote an address, before it was executed.
+    /// Only the writes in the log are found.
+    /// @param address - the watched address
+    /// @return false if the address was not written, the position does not change then
+    bool backToWrite(int address);
+
+    /// Get the position.
+    /// @return the number of instructions executed since the start
+    unsigned long long getStep() const { return step; }
+
+    /// Get the interval.
+    /// @return the instructions between two checkpoints, it doubles when they are thinned
+    unsigned long long getInterval() const { return interval; }
+
+    /// Get the checkpoints.
+    /// @return the snapshots in step order
+    const std::vector<Checkpoint>& getCheckpoints() const { return checkpoints; }
+
+    /// Get the write log.
+    /// @return the newest memory writes up to the position, in step order
+    const std::vector<WriteRecord>& getWriteLog() const { return writeLog; }
+
+    /// Counts a dispatched instruction.
+    void executed(int, Opcode){ calls++; }
+
+    /// A failing instruction writes nothing, the step count of the run is enough.
+    void failed(int, Opcode){}
+
+    /// Branches are not recorded.
+    void branch(int, int, bool){}
+
+    /// Reads are not recorded.
+    void memoryRead(int){}
+
+    /// Records a write in the log, the older half is dropped when the log is full.
+    /// @param address - the written address
+    /// @param value - the written value
+    void memoryWrite(int address, int value){
+        if(writeLog.size() == 2 * maxWrites)
+            writeLog.erase(writeLog.begin(), writeLog.begin() + maxWrites);
+        writeLog.push_back(WriteRecord{step + calls - 1, address, value});
+    }
+
+    /// The accumulator is in the checkpoints.
+    void accumulator(int){}
+};
+
+#endif // TIMETRAVEL_H_INCLUDED
@@ -0,0 +1,195 @@
+#include "trace.h"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+/// Magic bytes at the start of a trace.
+static const char TRACE_MAGIC[8] = {'N', 'E', 'U', 'T', 'R', 'A', 'C', 'E'};
+
+TraceRecorder::TraceRecorder(std::ostream &os, ControlUnit &CU) : os(os), ring(TRACE_BLOCKS * TRACE_BLOCK_SIZE)
+{
+    unsigned storage = static_cast<unsigned>(CU.getStorage());
+    char header[16] = {};
+    std::memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    for (int i = 0; i < 4; i++)
+        header[8 + i] = (char)(storage >> (8 * i));
+    header[12] = (char)CU.getArithmetic();
+    os.write(header, sizeof(header));
+    block = ring.data();
+    writer = std::thread(&TraceRecorder::drain, this);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    close(RunResult{STATUS_RUNNING, 0});
+}
+
+/// The engine is the only producer: head is only written here, tail only by the writer.
+void TraceRecorder::publish()
+{
+    unsigned long long published = head.load(std::memory_order_relaxed);
+    sizes[published % TRACE_BLOCKS] = used;
+    head.store(published + 1, std::memory_order_release);
+    while (published + 1 - tail.load(std::memory_order_acquire) >= TRACE_BLOCKS)
+        std::this_thread::yield();  // Every block is waiting to be written
+    block = &ring[((published + 1) % TRACE_BLOCKS) * TRACE_BLOCK_SIZE];
+    used = 0;
+}
+
+void TraceRecorder::drain()
+{
+    while (true)
+    {
+        unsigned long long written = tail.load(std::memory_order_relaxed);
+        if (written == head.load(std::memory_order_acquire))
+        {
+            if (closing.load(std::memory_order_acquire))
+            {
+                if (written == head.load(std::memory_order_acquire))
+                    return;
+                continue;  // The last block was published before closing
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        size_t slot = written % TRACE_BLOCKS;
+        os.write(&ring[slot * TRACE_BLOCK_SIZE], sizes[slot]);
+        tail.store(written + 1, std::memory_order_release);
+    }
+}
+
+void TraceRecorder::close(RunResult result)
+{
+    if (closed)
+        return;
+    closed = true;
+    if (used + 32 > TRACE_BLOCK_SIZE)
+        publish();
+    block[used++] = (char)TRACE_END;
+    putVarint(result.status);
+    putVarint(result.steps);
+    unsigned long long published = head.load(std::memory_order_relaxed);
+    sizes[published % TRACE_BLOCKS] = used;
+    head.store(published + 1, std::memory_order_release);
+    closing.store(true, std::memory_order_release);
+    writer.join();
+    os.flush();
+}
+
+TraceReader::TraceReader(std::istream &is) : is(is)
+{
+    char header[16];
+    if (!is.read(header, sizeof(header)) || std::memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+        throw "Not a trace file.\n";
+    unsigned size = 0;
+    for (int i = 0; i < 4; i++)
+        size |= (unsigned)(unsigned char)header[8 + i] << (8 * i);
+    storage = static_cast<int>(size);
+    arithmetic = static_cast<Arithmetic>(header[12]);
+}
+
+unsigned long long TraceReader::getVarint()
+{
+    unsigned long long value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = is.get();
+        if (byte == EOF)
+            throw "Trace is damaged.\n";
+        value |= (unsigned long long)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return value;
+    }
+    throw "Trace is damaged.\n";
+}
+
+bool TraceReader::next(TraceEvent &event)
+{
+    int tag = is.get();
+    if (tag == EOF)
+        throw "Trace is damaged.\n";  // No end record: the recorder did not finish
+    if ((tag & 0x0F) == TRACE_END)
+    {
+        status = static_cast<Status>(getVarint());
+        steps = getVarint();
+        return false;
+    }
+    if ((tag & 0x0F) >= OP_COUNT)
+        throw "Trace is damaged.\n";
+    event.op = static_cast<Opcode>(tag & 0x0F);
+    event.pc = lastPc + 1;
+    if (tag & TRACE_JUMP)
+        event.pc = (int)((unsigned)event.pc + (unsigned)getSigned());
+    lastPc = event.pc;
+    event.hasAcc = (tag & TRACE_ACC) != 0;
+    if (event.hasAcc)
+        lastAcc = (int)((unsigned)lastAcc + (unsigned)getSigned());
+    event.acc = lastAcc;
+    event.hasWrite = (tag & TRACE_WRITE) != 0;
+    event.address = event.hasWrite ? (int)getVarint() : 0;
+    event.value = event.hasWrite ? getSigned() : 0;
+    return true;
+}
+
+/// Two events are the same if every recorded field is the same.
+static bool sameEvent(const TraceEvent &a, const TraceEvent &b)
+{
+    return a.pc == b.pc && a.op == b.op && a.hasAcc == b.hasAcc && a.acc == b.acc && a.hasWrite == b.hasWrite &&
+           a.address == b.address && a.value == b.value;
+}
+
+/// The first pass collects the numbers of the READs, the replay is recorded into memory.
+/* A run that stopped early (step limit, time limit or an unfinished trace) is replayed
+ * for the same number of instructions, only its events are compared.
+ */
+ReplayResult replayTrace(std::istream &trace, std::shared_ptr<const ProgramImage> image)
+{
+    std::streampos start = trace.tellg();
+    TraceReader original(trace);
+    if (image == nullptr || static_cast<size_t>(original.getStorage()) != image->getStorage())
+        throw "Trace does not match the program.\n";
+    std::ostringstream numbers;
+    TraceEvent event;
+    unsigned long long events = 0;
+    while (original.next(event))
+    {
+        if (event.op == OP_READ)
+            numbers << (event.hasWrite ? event.value : 0) << ' ';  // A failed READ consumed a number too
+        events++;
+    }
+    Status status = original.getStatus();
+    bool stopped = status != STATUS_RUNNING && status != STATUS_STEP_LIMIT && status != STATUS_TIMEOUT;
+    unsigned long long budget = stopped ? ~0ULL : original.getSteps() != 0 ? original.getSteps() : events;
+
+    std::istringstream input(numbers.str());
+    std::ostringstream output;
+    std::stringstream replayed;
+    ControlUnit CU(image, output, input);
+    CU.setArithmetic(original.getArithmetic());
+    RunResult result;
+    {
+        TraceRecorder recorder(replayed, CU);
+        result = CU.runWith(recorder, budget);
+        recorder.close(result);
+    }
+
+    trace.clear();
+    trace.seekg(start);
+    TraceReader first(trace);
+    TraceReader second(replayed);
+    TraceEvent a, b;
+    ReplayResult replay{true, events, events, result.status};
+    for (unsigned long long i = 0; i < events; i++)
+    {
+        first.next(a);
+        if (!second.next(b) || !sameEvent(a, b))
+        {
+            replay.deterministic = false;
+            replay.divergence = i;
+            return replay;
+        }
+    }
+    if (second.next(b) || (stopped && result.status != status))
+        replay.deterministic = false;  // The replay went on or stopped for another reason
+    return replay;
+}
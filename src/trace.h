@@ -0,0 +1,210 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include "controlUnit.h"
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/// Size of one block of the trace ring buffer.
+const size_t TRACE_BLOCK_SIZE = 65536;
+
+/// Number of blocks in the trace ring buffer.
+const size_t TRACE_BLOCKS = 8;
+
+/* Trace format
+ * A 16 byte header: "NEUTRACE", the storage of the program as a little-endian uint32
+ * and the Arithmetic of the run as one byte. Every executed instruction is an event:
+ * a tag byte, then the fields the tag announces.
+ *   bits 0-3 - the opcode, TRACE_END for the end record
+ *   TRACE_JUMP - the PC is not the previous PC + 1: a zigzag varint of the difference follows
+ *   TRACE_ACC - LOAD, ADD or SUB: a zigzag varint of the change of the accumulator follows
+ *   TRACE_WRITE - STORE or READ: the address and the zigzag value follow as varints
+ * An instruction that failed has no fields after its tag. The end record holds the status
+ * and the number of executed instructions as varints.
+ */
+const unsigned char TRACE_JUMP = 0x10;      /// Tag bit of an event with a PC difference
+const unsigned char TRACE_ACC = 0x20;       /// Tag bit of an event with a new accumulator
+const unsigned char TRACE_WRITE = 0x40;     /// Tag bit of an event with a memory write
+const unsigned char TRACE_END = 0x0F;       /// Tag of the end record
+
+/// TraceEvent struct
+/* One executed instruction, read back from a trace. */
+struct TraceEvent{
+    int pc;                 /// Address of the instruction
+    Opcode op;              /// Opcode of the instruction
+    bool hasAcc;            /// The instruction set the accumulator
+    int acc;                /// Accumulator after the instruction
+    bool hasWrite;          /// The instruction wrote the memory
+    int address;            /// Written address
+    int value;              /// Written value
+};
+
+/// TraceRecorder class
+/* Instrumentation policy that records every executed instruction: run the program with
+ * ControlUnit::runWith(recorder, maxSteps), then close() the trace with the result.
+ * The engine thread only encodes the events into the current block of a ring buffer.
+ * A full block is handed over to a background thread without a lock, which writes it to
+ * the output stream. The engine waits only if the writer is TRACE_BLOCKS blocks behind.
+ */
+class TraceRecorder{
+    std::ostream& os;                           /// Where the trace is written
+    std::vector<char> ring;                     /// TRACE_BLOCKS blocks of TRACE_BLOCK_SIZE bytes
+    size_t sizes[TRACE_BLOCKS];                 /// Used bytes of every published block
+    std::atomic<unsigned long long> head{0};    /// Number of blocks published by the engine
+    std::atomic<unsigned long long> tail{0};    /// Number of blocks written by the writer thread
+    std::atomic<bool> closing{false};           /// No more blocks will be published
+    std::thread writer;                         /// Drains the published blocks
+    char* block;                                /// The block being filled
+    size_t used=0;                              /// Bytes in the current block
+    size_t tag=0;                               /// Position of the tag of the last event
+    int lastPc=-1;                              /// Address of the last event
+    int lastAcc=0;                              /// Accumulator after the last LOAD, ADD or SUB
+    bool closed=false;                          /// The end record was written
+
+    /// Publishes the current block and continues in the next free one.
+    void publish();
+
+    /// Writes the published blocks until the recorder is closed, runs on the writer thread.
+    void drain();
+
+    /// Appends an unsigned varint to the current block.
+    /// @param value - the value
+    void putVarint(unsigned long long value){
+        while(value >= 0x80){
+            block[used++] = (char)(value | 0x80);
+            value >>= 7;
+        }
+        block[used++] = (char)value;
+    }
+
+    /// Appends a zigzag varint to the current block.
+    /// @param value - the value, small negative values take few bytes too
+    void putSigned(int value){ putVarint(((unsigned)value << 1) ^ (unsigned)(value >> 31)); }
+
+    TraceRecorder(const TraceRecorder&);
+    TraceRecorder& operator=(const TraceRecorder&);
+public:
+    /// Constructor.
+    /// Writes the header and starts the writer thread.
+    /// @param os - the stream the trace is written to, it must live as long as the recorder
+    /// @param CU - the machine that will be traced, from the start of its program
+    TraceRecorder(std::ostream& os, ControlUnit& CU);
+
+    /// Closes the trace if close() was not called, with STATUS_RUNNING.
+    ~TraceRecorder();
+
+    /// Records an instruction.
+    /// @param address - where the instruction was fetched from
+    /// @param op - opcode of the instruction
+    void executed(int address, Opcode op){
+        if(op >= OP_COUNT)
+            return;  // The threaded engine dispatches the end of the memory like an instruction
+        if(used + 32 > TRACE_BLOCK_SIZE)  // No room for the longest event
+            publish();
+        tag = used;
+        block[used++] = (char)op;
+        if(address != lastPc + 1){
+            block[tag] |= TRACE_JUMP;
+            putSigned((int)((unsigned)address - (unsigned)lastPc - 1u));
+        }
+        lastPc = address;
+    }
+
+    /// The failing instruction stays in the trace, it shows where the program stopped.
+    void failed(int, Opcode){}
+
+    /// The branches are in the PC differences.
+    void branch(int, int, bool){}
+
+    /// Reads are not recorded.
+    void memoryRead(int){}
+
+    /// Records the write of the last instruction.
+    /// @param address - the written address
+    /// @param value - the written value
+    void memoryWrite(int address, int value){
+        block[tag] |= TRACE_WRITE;
+        putVarint((unsigned)address);
+        putSigned(value);
+    }
+
+    /// Records the accumulator after the last instruction.
+    /// @param acc - the new value
+    void accumulator(int acc){
+        block[tag] |= TRACE_ACC;
+        putSigned((int)((unsigned)acc - (unsigned)lastAcc));
+        lastAcc = acc;
+    }
+
+    /// Writes the end record, waits for the writer thread and flushes the stream.
+    /// Nothing can be recorded after it.
+    /// @param result - the status and the number of executed instructions of the traced runs
+    void close(RunResult result);
+};
+
+/// TraceReader class
+/* Decodes a trace written by a TraceRecorder. */
+class TraceReader{
+    std::istream& is;               /// The trace
+    int storage;                    /// Storage of the traced program
+    Arithmetic arithmetic;          /// Arithmetic of the traced run
+    int lastPc=-1;                  /// Address of the last event
+    int lastAcc=0;                  /// Accumulator after the last LOAD, ADD or SUB
+    Status status=STATUS_RUNNING;   /// Status of the end record
+    unsigned long long steps=0;     /// Executed instructions of the end record
+
+    /// Reads an unsigned varint. Throws an exception at the end of the stream.
+    /// @return the value
+    unsigned long long getVarint();
+
+    /// Reads a zigzag varint.
+    /// @return the value
+    int getSigned(){ unsigned long long v = getVarint(); return (int)((unsigned)(v >> 1) ^ (0u - (unsigned)(v & 1))); }
+public:
+    /// Constructor.
+    /// Reads the header. Throws an exception if the stream is not a trace.
+    /// @param is - the trace
+    TraceReader(std::istream& is);
+
+    /// Get the storage of the traced program.
+    /// @return the number of cells
+    int getStorage() const { return storage; }
+
+    /// Get the arithmetic of the traced run.
+    /// @return the overflow behaviour of ADD and SUB
+    Arithmetic getArithmetic() const { return arithmetic; }
+
+    /// Reads the next event. Throws an exception if the trace ends without an end record.
+    /// @param event - receives the event
+    /// @return false at the end record
+    bool next(TraceEvent& event);
+
+    /// Get the status of the end record.
+    /// @return the status passed to TraceRecorder::close()
+    Status getStatus() const { return status; }
+
+    /// Get the number of executed instructions of the end record.
+    /// @return the steps passed to TraceRecorder::close()
+    unsigned long long getSteps() const { return steps; }
+};
+
+/// ReplayResult struct
+struct ReplayResult{
+    bool deterministic;             /// The replay made the same events and stopped the same way
+    unsigned long long events;      /// Number of events in the trace
+    unsigned long long divergence;  /// Index of the first different event, events if there is none
+    Status status;                  /// How the replay stopped
+};
+
+/// Runs a program again with the numbers its READ instructions got in a trace, and compares
+/// the new trace with the old one. The trace must start at the beginning of the program.
+/// Throws an exception if the trace is damaged or was made of another program.
+/// @param trace - the recorded trace, read twice
+/// @param image - the program
+/// @return where the replay diverged from the trace, if it did
+ReplayResult replayTrace(std::istream& trace, std::shared_ptr<const ProgramImage> image);
+
+#endif // TRACE_H_INCLUDED
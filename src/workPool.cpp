@@ -0,0 +1,67 @@
+#include "workPool.h"
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+unsigned poolThreads(unsigned requested)
+{
+    if (requested == 0)
+        requested = std::thread::hardware_concurrency();
+    if (requested == 0)
+        requested = 1;  // The number of cores is unknown
+    return requested;
+}
+
+/// WorkQueue struct
+/* Task indices of one worker. The owner takes from the back, the other workers steal from the front. */
+struct WorkQueue{
+    std::mutex lock;            /// Protects the queue
+    std::deque<size_t> tasks;   /// Indices of the tasks waiting to run
+};
+
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)> &task)
+{
+    size_t workers = std::min<size_t>(threads, count);
+    if (workers == 0)
+        return;
+    std::vector<WorkQueue> queues(workers);
+    for (size_t i = 0; i < count; i++)
+        queues[i % workers].tasks.push_back(i);
+
+    auto worker = [&](size_t self)
+    {
+        while (true)
+        {
+            size_t next = count;
+            for (size_t k = 0; k < workers && next == count; k++)
+            {
+                WorkQueue &queue = queues[(self + k) % workers];
+                std::lock_guard<std::mutex> guard(queue.lock);
+                if (queue.tasks.empty())
+                    continue;
+                if (k == 0)
+                {
+                    next = queue.tasks.back();  // Own queue
+                    queue.tasks.pop_back();
+                }
+                else
+                {
+                    next = queue.tasks.front();  // Steal
+                    queue.tasks.pop_front();
+                }
+            }
+            if (next == count)
+                return;  // Every queue is empty, no new tasks arrive
+            task(next);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < workers; i++)
+        pool.emplace_back(worker, i);
+    worker(0);  // The calling thread works too
+    for (std::thread &t : pool)
+        t.join();
+}
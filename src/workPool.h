@@ -0,0 +1,22 @@
+#ifndef WORKPOOL_H_INCLUDED
+#define WORKPOOL_H_INCLUDED
+
+#include <cstddef>
+#include <functional>
+
+/// Gives the number of worker threads to use.
+/// @param requested - number of threads, 0 for one thread per core
+/// @return the number of threads, at least 1
+unsigned poolThreads(unsigned requested);
+
+/* Work-stealing thread pool: the tasks are dealt out round-robin. A worker that runs out
+ * of tasks steals the oldest task of another worker, so a few long tasks do not keep the
+ * other threads idle. The calling thread works too.
+ */
+/// Runs task(0), ..., task(count - 1) and returns when every task has finished.
+/// @param count - number of tasks
+/// @param threads - number of worker threads
+/// @param task - runs one task, it is called from several threads at once
+void parallelFor(size_t count, unsigned threads, const std::function<void(size_t)>& task);
+
+#endif // WORKPOOL_H_INCLUDED